@@ -0,0 +1,91 @@
+#ifndef PYRAMID_HPP
+#define PYRAMID_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <mutex>
+#include <atomic>
+
+#include "geometry.hpp"
+
+#define PYRAMID_MAX_LEVELS 16
+
+/**
+ * @brief Header of a heightmap pyramid file (.hmp).
+ *
+ * File layout: [pyramidHeader] [level 0 tiles] [level 1 tiles] ... Each tile is tileSize x tileSize floats (row-major),
+ * and tiles of each level are stored row-major too. Level 0 samples are "spacing" world units apart; each next level halves
+ * the resolution (2x2 average) so a tile covers 4 times the area of the previous level's tiles.
+ */
+struct pyramidHeader
+{
+    char     magic[8];                          ///< "HMPYRAMD"
+    uint32_t version;
+    uint32_t tileSize;                          ///< Samples per tile side
+    uint32_t numLevels;
+    uint32_t padding;
+    float    x0, y0;                            ///< World coordinates of the first sample of level 0
+    float    spacing;                           ///< Distance between samples in level 0
+    float    maxHeight;                         ///< Maximum height the noise can produce
+    uint64_t fingerprint;                       ///< Noise fingerprint (noiseSet::getFingerprint())
+    uint32_t tilesX[PYRAMID_MAX_LEVELS];        ///< Number of tiles along X in each level
+    uint32_t tilesY[PYRAMID_MAX_LEVELS];        ///< Number of tiles along Y in each level
+    uint64_t levelOffset[PYRAMID_MAX_LEVELS];   ///< Position (bytes) of each level in the file
+};
+
+/**
+ * @brief Bakes a rectangular region of the world into a tiled, mip-mapped heightmap pyramid file.
+ *
+ * Tiles are computed in parallel (one worker per thread). Every finished tile is recorded in a checkpoint file
+ * (<output>.ckpt), so an interrupted bake resumes where it stopped if it is run again with the same parameters.
+ */
+class pyramidBaker
+{
+    noiseSet      noise;
+    pyramidHeader header;
+    std::string   outputPath;
+    std::fstream  file;
+    std::ofstream checkpoint;
+    std::mutex    fileMutex;
+
+    std::vector<std::vector<bool>> done;        ///< Finished tiles of each level
+    std::atomic<size_t> nextTile;               ///< Next tile to compute in the current level
+    std::atomic<size_t> tilesDone;              ///< Tiles finished in the current level
+    std::atomic<bool>   failed;                 ///< An I/O error happened: the workers stop and the bake is left resumable
+
+    size_t   tileBytes() const;
+    uint64_t tileOffset(unsigned level, unsigned tx, unsigned ty) const;
+    bool     readTile(unsigned level, unsigned tx, unsigned ty, float *tile);            ///< False (and sets failed) on a short read
+    bool     writeTile(unsigned level, unsigned tx, unsigned ty, const float *tile);     ///< False (and sets failed) if the tile or its checkpoint record couldn't be written
+    bool     bakeTile(unsigned level, unsigned tx, unsigned ty, noiseSet &noise, std::vector<float> &tile, std::vector<float> &child);
+    void     worker(unsigned level);
+    bool     loadCheckpoint();
+
+public:
+    /*
+    *   @brief Constructor. Configure the bake:
+    *   @param noise Noise generator
+    *   @param x0 World X coordinate of the region's corner
+    *   @param y0 World Y coordinate of the region's corner
+    *   @param x1 World X coordinate of the opposite corner
+    *   @param y1 World Y coordinate of the opposite corner
+    *   @param spacing Distance between samples in level 0
+    *   @param tileSize Samples per tile side
+    *   @param numLevels Number of levels (0: as many as needed to get a single tile in the last level)
+    */
+    pyramidBaker(noiseSet noise, float x0, float y0, float x1, float y1, float spacing, unsigned tileSize, unsigned numLevels = 0);
+
+    /*
+    *   @brief Bake the pyramid
+    *   @param outputPath Output file. If a checkpoint for the same parameters exists, the bake is resumed.
+    *   @param numThreads Number of worker threads (0: all the hardware threads)
+    *   @return True if the file was completed. False on an I/O error (the checkpoint is kept, so the bake can be resumed).
+    */
+    bool bake(const std::string &outputPath, unsigned numThreads = 0);
+
+    const pyramidHeader& getHeader() const;     ///< Get the header of the file
+};
+
+#endif
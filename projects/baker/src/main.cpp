@@ -0,0 +1,92 @@
+/*
+    baker: Offline world baking. Evaluates the terrain noise over a rectangular region and stores it as a tiled heightmap
+    pyramid (level 0 at full resolution, each next level at half resolution). If it is interrupted, running it again
+    with the same parameters resumes the bake.
+
+    Usage: baker <output.hmp> [options]
+        --region x0 y0 x1 y1    World region (default: -1024 -1024 1024 1024)
+        --spacing s             Distance between samples in level 0 (default: 1)
+        --tile n                Samples per tile side (default: 256)
+        --levels n              Number of levels (default: 0 = until a single tile remains)
+        --threads n             Worker threads (default: 0 = all the cores)
+        --preset name           Noise preset: desert, mountains (default: desert)
+        --seed n                Seed for the octave offsets (default: 0)
+*/
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+
+#include "pyramid.hpp"
+
+void printUsage();
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2 || argv[1][0] == '-')
+    {
+        printUsage();
+        return 1;
+    }
+
+    std::string output = argv[1];
+    float x0 = -1024, y0 = -1024, x1 = 1024, y1 = 1024;
+    float spacing     = 1;
+    unsigned tileSize = 256;
+    unsigned levels   = 0;
+    unsigned threads  = 0;
+    std::string preset = "desert";
+    unsigned seed     = 0;
+
+    for(int i = 2; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        int remaining   = argc - i - 1;
+
+        if     (arg == "--region"  && remaining >= 4) { x0 = std::atof(argv[++i]); y0 = std::atof(argv[++i]); x1 = std::atof(argv[++i]); y1 = std::atof(argv[++i]); }
+        else if(arg == "--spacing" && remaining >= 1) spacing  = std::atof(argv[++i]);
+        else if(arg == "--tile"    && remaining >= 1) tileSize = std::atoi(argv[++i]);
+        else if(arg == "--levels"  && remaining >= 1) levels   = std::atoi(argv[++i]);
+        else if(arg == "--threads" && remaining >= 1) threads  = std::atoi(argv[++i]);
+        else if(arg == "--preset"  && remaining >= 1) preset   = argv[++i];
+        else if(arg == "--seed"    && remaining >= 1) seed     = std::atoi(argv[++i]);
+        else
+        {
+            std::cerr << "Unknown or incomplete option: " << arg << std::endl;
+            printUsage();
+            return 1;
+        }
+    }
+
+    // Same presets as the player (global.hpp)
+    noiseSet noise;
+    if     (preset == "desert")    noise = noiseSet(5, 1.5, 0.28, 1., 75, 0, 0, 0, FastNoiseLite::NoiseType_Cellular, true, seed);
+    else if(preset == "mountains") noise = noiseSet(5, 1.5, 0.28, 1., 130, 2, 0, 0, FastNoiseLite::NoiseType_Perlin, true, seed);
+    else
+    {
+        std::cerr << "Unknown preset: " << preset << std::endl;
+        return 1;
+    }
+
+    pyramidBaker baker(noise, x0, y0, x1, y1, spacing, tileSize, levels);
+    const pyramidHeader &header = baker.getHeader();
+
+    std::cout << "Baking [" << x0 << ", " << y0 << "] - [" << x1 << ", " << y1 << "] into " << output
+              << "\n  Tile size: " << header.tileSize << "  Levels: " << header.numLevels
+              << "  Level 0 tiles: " << header.tilesX[0] << " x " << header.tilesY[0] << std::endl;
+
+    return baker.bake(output, threads) ? 0 : 1;
+}
+
+void printUsage()
+{
+    std::cout << "Usage: baker <output.hmp> [options]\n"
+                 "  --region x0 y0 x1 y1   World region (default: -1024 -1024 1024 1024)\n"
+                 "  --spacing s            Distance between samples in level 0 (default: 1)\n"
+                 "  --tile n               Samples per tile side (default: 256)\n"
+                 "  --levels n             Number of levels (default: 0 = until a single tile remains)\n"
+                 "  --threads n            Worker threads (default: 0 = all the cores)\n"
+                 "  --preset name          Noise preset: desert, mountains (default: desert)\n"
+                 "  --seed n               Seed for the octave offsets (default: 0)" << std::endl;
+}
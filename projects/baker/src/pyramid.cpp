@@ -0,0 +1,312 @@
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+
+#include "pyramid.hpp"
+
+// pyramidBaker -----------------------------------------------------------------
+
+pyramidBaker::pyramidBaker(noiseSet noise, float x0, float y0, float x1, float y1, float spacing, unsigned tileSize, unsigned numLevels)
+    : noise(noise), nextTile(0), tilesDone(0), failed(false)
+{
+    if(x1 < x0) std::swap(x0, x1);
+    if(y1 < y0) std::swap(y0, y1);
+    if(tileSize < 2) tileSize = 2;
+    if(spacing <= 0) spacing = 1;
+
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "HMPYRAMD", 8);
+    header.version     = 2;                // 2: edge padding of the coarse levels (version 1 bakes are not resumed)
+    header.tileSize    = tileSize;
+    header.x0          = x0;
+    header.y0          = y0;
+    header.spacing     = spacing;
+    header.maxHeight   = this->noise.getMaxHeight();
+    header.fingerprint = this->noise.getFingerprint();
+
+    // Level 0 covers [x0, x1] x [y0, y1] (rounded up to whole tiles)
+    unsigned samplesX = (unsigned)std::ceil((x1 - x0) / spacing) + 1;
+    unsigned samplesY = (unsigned)std::ceil((y1 - y0) / spacing) + 1;
+    unsigned tilesX   = (samplesX + tileSize - 1) / tileSize;
+    unsigned tilesY   = (samplesY + tileSize - 1) / tileSize;
+
+    if(numLevels == 0 || numLevels > PYRAMID_MAX_LEVELS) numLevels = PYRAMID_MAX_LEVELS;
+
+    uint64_t offset = sizeof(pyramidHeader);
+    unsigned level  = 0;
+    while(level < numLevels)
+    {
+        header.tilesX[level]      = tilesX;
+        header.tilesY[level]      = tilesY;
+        header.levelOffset[level] = offset;
+        offset += (uint64_t)tilesX * tilesY * tileBytes();
+        ++level;
+
+        if(tilesX == 1 && tilesY == 1) break;
+        tilesX = (tilesX + 1) / 2;
+        tilesY = (tilesY + 1) / 2;
+    }
+    header.numLevels = level;
+
+    done.resize(header.numLevels);
+    for(unsigned i = 0; i < header.numLevels; i++)
+        done[i].assign((size_t)header.tilesX[i] * header.tilesY[i], false);
+}
+
+const pyramidHeader& pyramidBaker::getHeader() const { return header; }
+
+size_t pyramidBaker::tileBytes() const { return (size_t)header.tileSize * header.tileSize * sizeof(float); }
+
+uint64_t pyramidBaker::tileOffset(unsigned level, unsigned tx, unsigned ty) const
+{
+    return header.levelOffset[level] + ((uint64_t)ty * header.tilesX[level] + tx) * tileBytes();
+}
+
+bool pyramidBaker::readTile(unsigned level, unsigned tx, unsigned ty, float *tile)
+{
+    std::lock_guard<std::mutex> lock(fileMutex);
+    file.seekg(tileOffset(level, tx, ty));
+    file.read((char*)tile, tileBytes());
+
+    if(!file) failed = true;
+    return !failed;
+}
+
+bool pyramidBaker::writeTile(unsigned level, unsigned tx, unsigned ty, const float *tile)
+{
+    std::lock_guard<std::mutex> lock(fileMutex);
+    file.seekp(tileOffset(level, tx, ty));
+    file.write((const char*)tile, tileBytes());
+    file.flush();
+    if(!file)
+    {
+        failed = true;
+        return false;
+    }
+
+    // The tile is recorded in the checkpoint only once its data is in the file
+    uint32_t record[2] = { level, ty * header.tilesX[level] + tx };
+    checkpoint.write((const char*)record, sizeof(record));
+    checkpoint.flush();
+
+    if(!checkpoint) failed = true;
+    return !failed;
+}
+
+bool pyramidBaker::bakeTile(unsigned level, unsigned tx, unsigned ty, noiseSet &noise, std::vector<float> &tile, std::vector<float> &child)
+{
+    unsigned size = header.tileSize;
+
+    if(level == 0)
+    {
+        // Heights only (same samples as terrainGenerator::computeTerrain(), without its normals, indices and bounds)
+        float x0 = header.x0 + tx * size * header.spacing;
+        float y0 = header.y0 + ty * size * header.spacing;
+
+        for(unsigned y = 0; y < size; y++)
+            for(unsigned x = 0; x < size; x++)
+                tile[(size_t)y * size + x] = noise.applyCurve(noise.GetRawNoise(x0 + x * header.spacing, y0 + y * header.spacing));
+        return true;
+    }
+
+    // Gather the 2x2 child tiles into a (2*size)^2 grid. Children past the border of the previous level (odd number of
+    // tiles) don't exist: their half of the grid replicates the edge samples of the existing ones.
+    unsigned numX = (2 * tx + 1 < header.tilesX[level - 1]) ? 2 : 1;
+    unsigned numY = (2 * ty + 1 < header.tilesY[level - 1]) ? 2 : 1;
+
+    for(unsigned j = 0; j < numY; j++)
+        for(unsigned i = 0; i < numX; i++)
+        {
+            if(!readTile(level - 1, 2 * tx + i, 2 * ty + j, tile.data())) return false;
+
+            for(unsigned y = 0; y < size; y++)
+                std::memcpy(&child[(size_t)(j * size + y) * 2 * size + i * size], &tile[(size_t)y * size], size * sizeof(float));
+        }
+
+    if(numX == 1)
+        for(unsigned y = 0; y < numY * size; y++)
+            std::fill_n(&child[(size_t)y * 2 * size + size], size, child[(size_t)y * 2 * size + size - 1]);
+    if(numY == 1)
+        for(unsigned y = size; y < 2 * size; y++)
+            std::memcpy(&child[(size_t)y * 2 * size], &child[(size_t)(size - 1) * 2 * size], 2 * size * sizeof(float));
+
+    // 2x2 box filter
+    for(unsigned y = 0; y < size; y++)
+        for(unsigned x = 0; x < size; x++)
+        {
+            size_t pos = (size_t)(2 * y) * 2 * size + 2 * x;
+            tile[(size_t)y * size + x] = 0.25f * (child[pos] + child[pos + 1] + child[pos + 2 * size] + child[pos + 2 * size + 1]);
+        }
+
+    return true;
+}
+
+void pyramidBaker::worker(unsigned level)
+{
+    noiseSet localNoise = noise;        // GetRawNoise() is not const
+    std::vector<float> tile((size_t)header.tileSize * header.tileSize);
+    std::vector<float> child(4 * tile.size());
+
+    size_t numTiles = done[level].size();
+    for(size_t t = nextTile++; t < numTiles && !failed; t = nextTile++)
+    {
+        if(done[level][t]) continue;
+
+        unsigned tx = t % header.tilesX[level];
+        unsigned ty = t / header.tilesX[level];
+
+        if(!bakeTile(level, tx, ty, localNoise, tile, child) || !writeTile(level, tx, ty, tile.data()))
+            return;                     // I/O error: stop every worker (see bake())
+        ++tilesDone;
+    }
+}
+
+bool pyramidBaker::loadCheckpoint()
+{
+    std::ifstream ckpt(outputPath + ".ckpt", std::ios::binary);
+    std::ifstream out(outputPath, std::ios::binary);
+    if(!ckpt.is_open() || !out.is_open()) return false;
+
+    pyramidHeader saved, written;
+    if(!ckpt.read((char*)&saved, sizeof(saved)) || std::memcmp(&saved, &header, sizeof(header))) return false;
+    if(!out.read((char*)&written, sizeof(written)) || std::memcmp(&written, &header, sizeof(header))) return false;
+
+    uint32_t record[2];
+    while(ckpt.read((char*)record, sizeof(record)))     // A truncated last record is ignored
+        if(record[0] < header.numLevels && record[1] < done[record[0]].size())
+            done[record[0]][record[1]] = true;
+
+    return true;
+}
+
+bool pyramidBaker::bake(const std::string &outputPath, unsigned numThreads)
+{
+    this->outputPath = outputPath;
+    if(numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    size_t totalTiles = 0, resumedTiles = 0;
+    bool resumed = loadCheckpoint();
+    for(const std::vector<bool> &level : done)
+        for(bool tileDone : level)
+        {
+            ++totalTiles;
+            if(tileDone) ++resumedTiles;
+        }
+
+    if(resumed)
+    {
+        std::cout << "Resuming bake: " << resumedTiles << '/' << totalTiles << " tiles already done" << std::endl;
+        file.open(outputPath, std::ios::in | std::ios::out | std::ios::binary);
+    }
+    else
+    {
+        for(std::vector<bool> &level : done) level.assign(level.size(), false);
+        file.open(outputPath, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+        file.write((const char*)&header, sizeof(header));
+    }
+
+    if(!file.is_open() || !file)
+    {
+        std::cerr << "Cannot open " << outputPath << std::endl;
+        return false;
+    }
+
+    // Rewrite the checkpoint (drops a possibly truncated last record)
+    checkpoint.open(outputPath + ".ckpt", std::ios::binary | std::ios::trunc);
+    checkpoint.write((const char*)&header, sizeof(header));
+    for(unsigned level = 0; level < header.numLevels; level++)
+        for(uint32_t t = 0; t < done[level].size(); t++)
+            if(done[level][t])
+            {
+                uint32_t record[2] = { level, t };
+                checkpoint.write((const char*)record, sizeof(record));
+            }
+    checkpoint.flush();
+
+    if(!checkpoint)
+    {
+        std::cerr << "Cannot write " << outputPath << ".ckpt" << std::endl;
+        return false;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    size_t bakedTiles = 0, level0Tiles = 0;
+    double level0Seconds = 0;
+
+    for(unsigned level = 0; level < header.numLevels; level++)
+    {
+        size_t levelTiles = done[level].size(), levelDone = 0;
+        for(bool tileDone : done[level]) if(tileDone) ++levelDone;
+
+        nextTile  = 0;
+        tilesDone = 0;
+        std::chrono::steady_clock::time_point levelStart = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> workers;
+        for(unsigned i = 0; i < numThreads; i++)
+            workers.push_back(std::thread(&pyramidBaker::worker, this, level));
+
+        // Progress report (every half second, and when the level is finished)
+        std::chrono::steady_clock::time_point lastReport = std::chrono::steady_clock::now();
+        while(true)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            size_t current = tilesDone;
+            bool finished  = (levelDone + current >= levelTiles) || failed;
+
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if(!finished && now - lastReport < std::chrono::milliseconds(500)) continue;
+            lastReport = now;
+
+            // Throughput of this level. Only level 0 evaluates noise samples; coarse levels just filter the previous one.
+            double seconds = std::chrono::duration<double>(now - levelStart).count();
+            double bytes   = (double)current * tileBytes();
+
+            std::cout << "\rLevel " << level << ": " << levelDone + current << '/' << levelTiles << " tiles ("
+                      << std::fixed << std::setprecision(1) << 100. * (levelDone + current) / levelTiles << "%)  " << std::setprecision(2);
+            if(level == 0)
+                std::cout << (double)current * header.tileSize * header.tileSize / seconds / 1e6 << " Msamples/s  ";
+            std::cout << bytes / seconds / (1024 * 1024) << " MB/s      " << std::flush;
+
+            if(finished) break;
+        }
+        std::cout << std::endl;
+
+        for(std::thread &thr : workers) thr.join();
+        if(failed) break;
+
+        bakedTiles += tilesDone;
+        done[level].assign(levelTiles, true);
+        if(level == 0)
+        {
+            level0Tiles   = tilesDone;
+            level0Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - levelStart).count();
+        }
+    }
+
+    // On an I/O error the checkpoint is kept (it only lists the tiles that were written), so the bake can be resumed
+    if(failed || !checkpoint)
+    {
+        std::cerr << "Write error in " << outputPath << ": bake stopped (run it again to resume)" << std::endl;
+        file.close();
+        checkpoint.close();
+        return false;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Baked " << bakedTiles << " tiles in " << std::setprecision(2) << seconds << " s ("
+              << bakedTiles * tileBytes() / (1024. * 1024.) << " MB written";
+    if(level0Tiles)
+        std::cout << ", level 0: " << (double)level0Tiles * header.tileSize * header.tileSize / level0Seconds / 1e6 << " Msamples/s";
+    std::cout << ")" << std::endl;
+
+    file.close();
+    checkpoint.close();
+    std::remove((outputPath + ".ckpt").c_str());
+    return true;
+}
@@ -102,6 +102,14 @@ public:
      */
     void ProcessMouseScroll(float yoffset);
 
+    /**
+     * @brief Place the camera (used for scripted camera paths)
+     * @param position Camera position
+     * @param yaw Yaw (degrees)
+     * @param pitch Pitch (degrees)
+     */
+    void SetPose(glm::vec3 position, float yaw, float pitch);
+
 private:
     /// Calculate front vector from the updated Euler angles (Pitch, Yaw, Roll)
     void updateCameraVectors();
@@ -81,6 +81,8 @@
 
 #include <array>
 
+struct cookedTextures;
+
 /*
 *	@brief Create VAO (Vertex Array Object)
 *	@return VAO identifier
@@ -132,6 +134,16 @@ void configVAO(unsigned VAO, unsigned VBO, int* sizes, unsigned numAtribs);
 */
 void configVAO(unsigned VAO, unsigned VBO, unsigned EBO, int *sizes, unsigned numAtribs, bool bindVAO = true);
 
+/*
+*	@brief Add an attribute of 4 normalized unsigned bytes (RGBA8, read as a vec4 in [0, 1]) to a VAO. The attribute array is tightly packed and may be stored in the VBO after the data of the other attributes.
+*	@param VAO to configure
+*	@param VBO Buffer containing the attribute array
+*	@param location Attribute location (after the attributes set by configVAO())
+*	@param offset Offset (bytes) of the attribute array inside the VBO
+*	@param bindVAO If false, the VAO is assumed to be bound already
+*/
+void configByteAttrib(unsigned VAO, unsigned VBO, unsigned location, size_t offset, bool bindVAO = true);
+
 /*
 *	@brief Get a 2D texture from a file
 *	@param fileAddress Address of the file containing the texture
@@ -140,4 +152,63 @@ void configVAO(unsigned VAO, unsigned VBO, unsigned EBO, int *sizes, unsigned nu
 */
 unsigned createTexture2D(const char *fileAddress, int internalFormat);
 
+/*
+*	@brief Get a 2D texture from decoded pixels (rows from bottom to top)
+*	@param pixels Pixel data (8 bits per channel). If nullptr, the texture is created without data.
+*	@param width Width in pixels
+*	@param height Height in pixels
+*	@param numberChannels Channels per pixel (3: RGB, 4: RGBA)
+*	@param internalFormat Format of the texture in the GPU. Options: GL_RGB, GL_RGBA
+*	@return Texture identifier
+*/
+unsigned createTexture2D(const unsigned char *pixels, int width, int height, int numberChannels, int internalFormat);
+
+/*
+*	@brief Create a 2D texture array from cooked textures (see cookTextureArray()). Mip levels are uploaded as they are (not generated).
+*	@param cooked Cooked textures (RGB8 or DXT1)
+*	@return Texture identifier
+*/
+unsigned createTextureArray(const cookedTextures &cooked);
+
+/*
+*	@brief Check whether the context supports S3TC (DXT) compressed textures
+*	@return True if GL_COMPRESSED_RGB_S3TC_DXT1_EXT is available
+*/
+bool isS3TCSupported();
+
+/*
+*	@brief Create a UBO (Uniform Buffer Object) and attach it to a binding point (see Shader::bindUniformBlock())
+*	@param num_bytes Size in bytes (std140 layout)
+*	@param bindingPoint Binding point of the uniform block
+*	@return UBO identifier
+*/
+unsigned createUBO(unsigned long num_bytes, unsigned bindingPoint);
+
+/*
+*	@brief Update the content of a UBO
+*	@param UBO UBO identifier
+*	@param num_bytes Size in bytes of the data
+*	@param pointerToData Pointer to the data (std140 layout)
+*/
+void updateUBO(unsigned UBO, unsigned long num_bytes, const void* pointerToData);
+
+/*
+*	@brief Bind a 2D texture to a texture unit. The bindings are tracked, so nothing is done if the texture is already bound there.
+*	@param unit Texture unit (0, 1, 2...)
+*	@param texture Texture identifier
+*/
+void bindTexture2D(unsigned unit, unsigned texture);
+
+/*
+*	@brief Bind a 2D texture array to a texture unit (tracked, like bindTexture2D())
+*	@param unit Texture unit (0, 1, 2...)
+*	@param texture Texture identifier
+*/
+void bindTextureArray(unsigned unit, unsigned texture);
+
+/*
+*	@brief Forget the tracked texture bindings. Call it after binding textures without bindTexture2D() or bindTextureArray().
+*/
+void resetTextureBinds();
+
 #endif
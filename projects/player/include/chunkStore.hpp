@@ -0,0 +1,103 @@
+#ifndef CHUNKSTORE_HPP
+#define CHUNKSTORE_HPP
+
+#include <cstdint>
+#include <string>
+#include <map>
+#include <set>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class BinaryKey;
+
+/**
+ * @brief Persistent store of terrain chunks (one file per world), memory-mapped on opening.
+ *
+ * A world is identified by the noise fingerprint (noiseSet::getFingerprint()), the chunk size and the number of vertex per
+ * side. The file contains a header, a tile index and fixed-size records (the VBO of each chunk), and is mapped as a whole
+ * when it is opened. New chunks are appended by a background thread. Only available in POSIX systems (otherwise, open()
+ * returns false and the store stays disabled).
+ *
+ * File layout: [storeHeader] [capacity x storeIndexEntry] [capacity x record (vertexPerSide^2 * 8 floats)]
+ */
+class chunkStore
+{
+    struct storeHeader
+    {
+        char     magic[8];          ///< "CHUNKSTR"
+        uint32_t version;
+        uint32_t vertexPerSide;
+        float    chunkSize;
+        uint32_t floatsPerVertex;
+        uint64_t fingerprint;
+        uint32_t capacity;          ///< Maximum number of records
+        uint32_t count;             ///< Number of records written (updated after each record is complete)
+        uint32_t padding[6];
+    };
+
+    struct storeIndexEntry
+    {
+        int32_t x;
+        int32_t y;
+    };
+
+    struct writeJob
+    {
+        int x, y;
+        std::vector<float> data;
+    };
+
+    int       fd;
+    char*     mapping;
+    size_t    mappingSize;
+    size_t    recordSize;           ///< Bytes per record
+    storeHeader* header;
+    storeIndexEntry* entries;
+    char*     records;
+
+    std::map<std::pair<int, int>, uint32_t> index;      ///< Chunk key -> record number
+    std::set<std::pair<int, int>> queued;               ///< Chunks waiting to be written
+    std::deque<writeJob> jobs;
+    std::thread writer;
+    std::mutex mut;
+    std::condition_variable cond;
+    bool stopWriter;
+
+    void writerLoop();
+
+public:
+    chunkStore();
+    ~chunkStore();
+    chunkStore(const chunkStore&) = delete;
+    chunkStore& operator = (const chunkStore&) = delete;
+
+    /*
+    *   @brief Open (or create) the store of a world. Closes the previous one, if any.
+    *   @param directory Directory where store files are kept
+    *   @param fingerprint Noise fingerprint (noiseSet::getFingerprint())
+    *   @param chunkSize Size of each chunk
+    *   @param vertexPerSide Number of vertex per chunk's side
+    *   @param capacity Maximum number of chunks stored in the file (the file is sparse, so unused records take no disk space)
+    *   @return True if the store is ready
+    */
+    bool open(const std::string &directory, uint64_t fingerprint, float chunkSize, unsigned vertexPerSide, unsigned capacity = 4096);
+    void close();                   ///< Finish pending writes, unmap and close the file
+    bool isOpen() const;            ///< True if a store file is open
+
+    /*
+    *   @brief Look up a chunk
+    *   @return Pointer to the chunk's VBO data (inside the mapped file), or nullptr if the chunk is not stored
+    */
+    const float* find(const BinaryKey &key);
+
+    /// Queue a chunk for being appended to the file (in the background). The data is copied.
+    void save(const BinaryKey &key, const float (*vertex)[8]);
+
+    size_t getNumStored();          ///< Number of chunks in the file
+    size_t getNumQueued();          ///< Number of chunks waiting to be written
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef CPUPROFILER_HPP
+#define CPUPROFILER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <chrono>
+
+// Profiling zones are compiled only in debug builds (or if CPU_PROFILER is defined). In release builds, PROFILE_ZONE() and
+// PROFILE_FRAME() expand to nothing. NO_CPU_PROFILER compiles them out in any build (for targets without frames, like the
+// baker, whose zones would never be dropped from the window).
+#if (!defined(NDEBUG) || defined(CPU_PROFILER)) && !defined(NO_CPU_PROFILER)
+    #define CPU_PROFILER_ENABLED 1
+#endif
+
+#ifdef CPU_PROFILER_ENABLED
+    #define PROFILE_CONCAT_(a, b) a##b
+    #define PROFILE_CONCAT(a, b)  PROFILE_CONCAT_(a, b)
+    #define PROFILE_ZONE(name)    cpuZone PROFILE_CONCAT(profileZone_, __LINE__)(name)     ///< Time the rest of the scope (name: string literal)
+    #define PROFILE_FRAME()       cpuProfiler::get().beginFrame()                           ///< Mark the start of a frame
+#else
+    #define PROFILE_ZONE(name)
+    #define PROFILE_FRAME()
+#endif
+
+/// Interval of time measured by a cpuZone
+struct cpuZoneEvent
+{
+    const char* name;               ///< String literal
+    int64_t     start, end;         ///< Nanoseconds since the profiler was created
+    uint32_t    thread;             ///< Small thread identifier (see cpuProfiler::threadId())
+    uint32_t    depth;              ///< Nesting level inside its thread (0: outermost zone)
+    uint64_t    frame;              ///< Frame when the zone ended
+};
+
+/**
+ * @brief Collects the zones timed in all the threads (see PROFILE_ZONE()) and keeps those of the last frames (rolling window).
+ * The zones of the last complete frame can be shown (getLastFrame()), and the whole window exported in the Chrome trace
+ * format (chrome://tracing, Perfetto).
+ *
+ * Recording a zone costs two steady_clock reads and a short locked push_back.
+ */
+class cpuProfiler
+{
+    std::mutex mut;
+    std::deque<cpuZoneEvent> events;        ///< Zones of the frames in the window
+    std::deque<int64_t> frameStarts;        ///< Start time of the frames in the window
+    std::vector<cpuZoneEvent> lastFrame;    ///< Zones of the last complete frame
+    int64_t  lastFrameStart, lastFrameEnd;
+    uint64_t frame;
+    uint32_t frameThread;                   ///< Thread that calls beginFrame()
+    std::chrono::steady_clock::time_point timeZero;
+
+    cpuProfiler();
+
+public:
+    static cpuProfiler& get();              ///< Global profiler
+
+    unsigned windowFrames;                  ///< Number of frames kept (default: 300)
+
+    int64_t  now() const;                   ///< Nanoseconds since the profiler was created
+    static uint32_t threadId();             ///< Small identifier of the calling thread
+    void record(const char* name, int64_t start, int64_t end, uint32_t depth);
+    void beginFrame();                      ///< Close the current frame (its zones become the last frame) and start another one
+
+    /*
+    *   @brief Get the zones of the last complete frame (sorted by start time)
+    *   @param zones Receives the zones
+    *   @param start Receives the frame start (ns)
+    *   @param end Receives the frame end (ns)
+    */
+    void getLastFrame(std::vector<cpuZoneEvent> &zones, int64_t &start, int64_t &end);
+
+    /*
+    *   @brief Save the zones of the window in the Chrome trace event format (JSON)
+    *   @param file File path
+    *   @return False if the file couldn't be written
+    */
+    bool exportChromeTrace(const std::string &file);
+};
+
+/// Times the scope where it is declared (use PROFILE_ZONE(), which is compiled out in release builds)
+class cpuZone
+{
+    const char* name;
+    int64_t     start;
+    uint32_t    depth;
+
+public:
+    cpuZone(const char* name);
+    ~cpuZone();
+    cpuZone(const cpuZone&) = delete;
+    cpuZone& operator = (const cpuZone&) = delete;
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef DRAWLIST_HPP
+#define DRAWLIST_HPP
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "glm/glm.hpp"
+
+#include "terrainBackend.hpp"
+#include "simulation.hpp"
+
+/**
+ * @brief Builds the terrain draw list of a frame in parallel. The visible chunks of a snapshot are split in tiles (runs of
+ * tileSize chunks in map order, so each tile is a compact strip of the world). Worker threads take tiles, cull their chunks
+ * against the view frustum, get their draw commands from the backend (buffers, offsets, index counts) and sort them front to
+ * back. Then, the sorted tiles are merged. The GL thread only replays the resulting array (terrainBackend::draw()).
+ *
+ * The calling thread works on tiles too, and build() returns when every worker is done. Small lists (a single tile) are
+ * built by the calling thread alone. The backend and the upload ring are only read meanwhile (getDrawCall()), so they must
+ * not be modified by other threads during build().
+ */
+class drawListBuilder
+{
+    std::vector<std::thread> workers;
+    std::mutex mut;
+    std::condition_variable cond;           ///< Wakes the workers (new build, or stop)
+    std::condition_variable doneCond;       ///< Wakes the caller (all workers done)
+    bool     stopWorkers;
+    unsigned generation;                    ///< Incremented with each parallel build (workers wait for a new one)
+    unsigned workersDone;                   ///< Workers that finished the current build (every worker takes part in each one)
+
+    // Current build (read by the workers)
+    const frameSnapshot  *snapshot;
+    const terrainBackend *backend;
+    glm::vec4 planes[6];                    ///< View frustum (world space; inside if dot(plane, point) >= 0)
+    bool      cull, sort;
+    size_t    numTiles;
+    std::atomic<size_t> nextTile;
+    std::atomic<size_t> numCulled;
+
+    std::vector<std::vector<chunkDrawCall>> tiles;      ///< Draw commands of each tile (reused each frame)
+
+    void workerLoop();
+    void buildTiles();                      ///< Take tiles until none is left
+    void buildTile(size_t tile);
+    bool insideFrustum(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const;
+
+public:
+    unsigned tileSize;                      ///< Chunks per tile
+
+    /*
+    *   @brief Constructor
+    *   @param numThreads Number of worker threads, besides the caller's (0: one less than the hardware threads, up to 7)
+    *   @param tileSize Chunks per tile
+    */
+    drawListBuilder(unsigned numThreads = 0, unsigned tileSize = 64);
+    ~drawListBuilder();
+    drawListBuilder(const drawListBuilder&) = delete;
+    drawListBuilder& operator = (const drawListBuilder&) = delete;
+
+    /*
+    *   @brief Build the draw list of the chunks of a snapshot (chunks whose data is not in GPU memory yet are skipped)
+    *   @param snapshot Visible chunks and camera matrices
+    *   @param backend Backend that will draw the list
+    *   @param frustumCulling Skip the chunks outside the view frustum
+    *   @param sortFrontToBack Sort by distance to the camera. Otherwise, map order is kept.
+    *   @param drawList Receives the draw commands
+    */
+    void build(const frameSnapshot &snapshot, const terrainBackend &backend, bool frustumCulling, bool sortFrontToBack, std::vector<chunkDrawCall> &drawList);
+
+    unsigned getNumThreads() const;         ///< Threads building tiles (workers and caller)
+    size_t   getNumCulled() const;          ///< Chunks outside the frustum in the last build
+};
+
+#endif
@@ -2,6 +2,8 @@
 #define GEOMETRY_HPP
 
 #include <random>
+#include <cstdint>
+#include <vector>
 
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
@@ -39,6 +41,7 @@ class noiseSet
     float (*octaveOffsets)[2];
 
     float maxHeight;
+    float amplitudeSum;         // Sum of the amplitudes of all the octaves (maximum raw sum)
 
 public:
     /*  @brief Constructor. Configure your noise generator:
@@ -79,7 +82,29 @@ public:
     */
     float GetNoise(float x, float y);
 
+    /*
+    *   @brief Given xy coordinates, get the fBm sum normalized to [0, 1], before applying multiplier and curve degree. GetNoise(x, y) == applyCurve(GetRawNoise(x, y)).
+    *   @param x X coordinate of noise
+    *   @param y Y coordinate of noise
+    *   @return Raw noise value
+    */
+    float GetRawNoise(float x, float y);
+
+    /*
+    *   @brief Get the value of a single octave, in range [0, 1] (before applying its amplitude). GetRawNoise() is the sum of each octave multiplied by persistance^octave, divided by getAmplitudeSum().
+    *   @param x X coordinate of noise
+    *   @param y Y coordinate of noise
+    *   @param octave Octave (0 is the first one)
+    */
+    float GetOctaveNoise(float x, float y, unsigned octave);
+
+    float applyCurve(float rawNoise) const;                 ///< Get the height for a raw noise value (applies scale, multiplier and curve degree)
+    float removeCurve(float height) const;                  ///< Get the raw noise value for a height (inverse of applyCurve())
+    bool  sameRawNoise(const noiseSet& obj) const;          ///< True if both noises only differ in multiplier and/or curve degree (same raw noise)
+    bool  sameOctaves(const noiseSet& obj) const;           ///< True if both noises only differ in number of octaves, persistance, multiplier and/or curve degree (the common octaves are the same)
+
     float           getMaxHeight() const;   ///< Get the maximum value that this noise can get. Noise range: [0, maxHeight]
+    float           getAmplitudeSum() const;///< Get the sum of the amplitudes of all the octaves
 
     unsigned        getNoiseType() const;   ///< Get noise type
     unsigned        getNumOctaves() const;  ///< Get number of octaves
@@ -92,6 +117,7 @@ public:
     float           getOffsetY() const;     ///< Get the Y offset
     unsigned int    getSeed() const;        ///< Get the seed
     float*          getOffsets() const;     ///< Get an array with the offsets for each x and y coordinate of each octave
+    uint64_t        getFingerprint() const; ///< Get a hash of all the parameters (including octave offsets). Identifies the terrain produced by this noise.
 
     /*
      *  @brief Used for testing purposes. Checks the noise values for a size x size terrain and outputs the absolute maximum and minimum
@@ -102,19 +128,40 @@ public:
 
 std::ostream& operator << (std::ostream& os, const noiseSet& obj);      ///< Operator << overloading for class noiseSet
 
+enum terrainBiome { biomeDesert, biomeGrassRock };      ///< Selects the terrain materials (splat weights and shader variant)
+
+/// Biome of a noise preset: the cellular noise makes the desert dunes, the other noise types make grassland and mountains
+inline terrainBiome getBiome(const noiseSet &noise) { return noise.getNoiseType() == FastNoiseLite::NoiseType_Cellular ? biomeDesert : biomeGrassRock; }
+
 // -----------------------------------------------------------------------------------
 
 /// Given a noiseSet object, and the xy dimensions, generates a terrain buffer
 class terrainGenerator
 {
     size_t    getPos(size_t x, size_t y) const;
+    size_t    getApronPos(int x, int y) const;                                  // Position in rawNoise. Range: [-1, numVertex_X/Y]
+    float     getApronHeight(int x, int y, const noiseSet &noise) const;
     glm::vec3 getVertex(size_t position) const;
-    void      computeGridNormals(float (*vertex)[8], unsigned numVertexX, unsigned numVertexY, float stride, noiseSet &noise);
+    void      resize(unsigned numVertexX, unsigned numVertexY);
+    void      computeIndices();
+    void      computeGridNormals(float (*vertex)[8], unsigned numVertexX, unsigned numVertexY, float stride, const noiseSet &noise);
 
     unsigned numVertexX;
     unsigned numVertexY;
     unsigned numVertex;         // example: a square has 4 vertex
     unsigned numIndices;        // example: a square has 6 indices
+    float    *rawNoise;         // Raw noise (noiseSet::GetRawNoise()) of each vertex plus a 1 vertex apron around the grid: (numVertexX + 2) * (numVertexY + 2). nullptr if unknown.
+    float    *octaveNoise;      // Optional per-octave cache (SoA): numOctavePlanes planes with the same layout as rawNoise (noiseSet::GetOctaveNoise()). nullptr if not cached.
+    unsigned numOctavePlanes;
+
+    void computeOctaves(noiseSet &noise, float x0, float y0, float stride);    // Compute the octave planes still missing
+    void combineOctaves(const noiseSet &noise);                                 // rawNoise = weighted sum of the octave planes
+
+    std::vector<std::vector<glm::vec2>> heightBounds;   // Min/max height quadtree. Level 0 has the (min, max) of each square of the grid. Each next level merges 2x2 nodes, until there is 1 node.
+
+    void computeBounds();
+    bool raycastNode(unsigned level, unsigned nodeX, unsigned nodeY, const glm::vec3 &origin, const glm::vec3 &direction, float tMin, float tMax, float &t) const;
+    bool raycastSquare(unsigned x, unsigned y, const glm::vec3 &origin, const glm::vec3 &direction, float tMin, float tMax, float &t) const;
 
 public:
     terrainGenerator();                                         ///< Default constructor
@@ -123,6 +170,7 @@ public:
 
     float        (*vertex)[8];      ///< VBO (vertex position, texture coordinates, normals)
     unsigned int (*indices)[3];     ///< EBO
+    uint8_t      (*splat)[4];       ///< Material weights of each vertex (RGBA8: grass, rock, snow, sand. plainSand = 1 - sum). See computeSplat().
 
     /*
     *   @brief Compute VBO and EBO (creates some terrain specified by the user)
@@ -133,8 +181,55 @@ public:
     *   @param numVertex_X Number of vertex along the X axis
     *   @param numVertex_Y Number of vertex along the Y axis
     *   @param textureFactor How much of the texture surface will fit in a square of 4 contiguous vertex
+    *   @param keepOctaves Keep the noise of each octave (memory cost: numOctaves floats per vertex), so changes in the number of octaves or persistance can be applied by reshape() evaluating only the new octaves
+    */
+    void computeTerrain(noiseSet &noise, float x0, float y0, float stride, unsigned numVertexX, unsigned numVertexY, float textureFactor = 1.f, bool keepOctaves = false);
+
+    /*
+    *   @brief Set VBO from already computed vertex data (for example, a chunk stored on disk), and compute EBO
+    *   @param vertexData Vertex data (numVertexX * numVertexY * 8 floats, with the same layout as vertex)
+    *   @param numVertex_X Number of vertex along the X axis
+    *   @param numVertex_Y Number of vertex along the Y axis
+    */
+    void setTerrain(const float *vertexData, unsigned numVertexX, unsigned numVertexY);
+
+    /*
+    *   @brief Recompute heights and normals for a new noise without evaluating the whole fBm again. Works if the new noise only differs in multiplier and/or curve degree (see noiseSet::sameRawNoise()), or, if the octaves are cached (see computeTerrain()), also in number of octaves and/or persistance (see noiseSet::sameOctaves()). Only the new octaves are evaluated.
+    *   @param oldNoise Noise used for computing the current heights
+    *   @param newNoise New noise
+    *   @return False if the chunk could not be reshaped (it must be computed again)
+    */
+    bool reshape(const noiseSet &oldNoise, noiseSet &newNoise);
+    /*
+    *   @brief Get the height of the terrain surface at some point, interpolating (barycentric) inside the triangle that contains it (same triangles as in the EBO). Points outside the grid are clamped to its border.
+    *   @param x X coordinate
+    *   @param y Y coordinate
+    *   @return Height (Z coordinate)
+    */
+    float getHeight(float x, float y) const;
+
+    /*
+    *   @brief Compute the material weights of each vertex (splat), from its slope and height. Call it after the vertex data changes.
+    *   @param biome Desert: sand and plainSand, depending on the slope. GrassRock: grass, rock (slope) and snow (slope and height).
+    *   @param verticalScale Scale applied to the heights when rendering (see terrainChunks::verticalScale)
+    */
+    void computeSplat(terrainBiome biome, float verticalScale);
+
+    bool hasRawNoise() const;       ///< True if the raw noise is cached (the chunk was computed from noise, not loaded with setTerrain())
+    void dropOctaves();             ///< Free the per-octave cache
+    size_t getOctaveBytes() const;  ///< Memory used by the per-octave cache
+
+    /*
+    *   @brief Intersect a ray with the terrain triangles. The min/max quadtree is traversed front to back, and only the triangles of the leaves reached are tested.
+    *   @param origin Ray origin
+    *   @param direction Ray direction (not necessarily normalized; distances are measured in multiples of it)
+    *   @param tMin Start of the ray segment tested
+    *   @param tMax End of the ray segment tested
+    *   @param t Ray parameter of the nearest hit (origin + t * direction), if any
+    *   @return True if the ray hits the terrain between tMin and tMax
     */
-    void computeTerrain(noiseSet &noise, float x0, float y0, float stride, unsigned numVertexX, unsigned numVertexY, float textureFactor = 1.f);
+    bool raycast(const glm::vec3 &origin, const glm::vec3 &direction, float tMin, float tMax, float &t) const;
+    glm::vec2 getHeightRange() const;  ///< Minimum and maximum height of the chunk
 
     unsigned getXside() const;      ///< Get number of vertex along X axis
     unsigned getYside() const;      ///< Get number of vertex along Y axis
@@ -6,11 +6,14 @@
 #include "geometry.hpp"
 #include "world.hpp"
 #include "timelib.hpp"
+#include "replay.hpp"
+#include "terrainBackend.hpp"
+#include "simulation.hpp"
 
 // Settings (typedef and global data section)
 
 // camera --------------------
-Camera cam(glm::vec3(128.0f, -30.0f, 150.0f));
+Camera cam(glm::vec3(128.0f, -30.0f, 150.0f));     ///< Camera of the frame being rendered (copied from the latest simulation snapshot). Move it with sim.setPose().
 float lastX =  SCR_WIDTH  / 2.0;
 float lastY =  SCR_HEIGHT / 2.0;
 bool firstMouse = true;
@@ -25,10 +28,61 @@ timerSet timer(30);
 //noiseSet noise(5, 1.5, 0.28, 1., 130, 2, 0, 0, FastNoiseLite::NoiseType_Perlin, true, 0);    // Country + Mountains
 noiseSet noise(5, 1.5, 0.28, 1., 75, 0, 0, 0, FastNoiseLite::NoiseType_Cellular, true, 0); // Desert
 terrainChunks worldChunks(noise, 300, 50, 51);
+simulation sim(cam, worldChunks);           ///< Owns the camera movement and the chunks residency (own thread). Hold sim.worldMutex to use worldChunks.
 bool newTerrain = true;
 float seaLevel = -1;
 
+// Shading benchmark --------------------
+/// Compares the terrain shading variants (lighting per material vs. blended materials) along a fixed camera path, timing the terrain draws in the GPU
+struct shadingBenchmark
+{
+    bool      running       = false;
+    bool      warmup        = false;        ///< Untimed lap before pass 0 (makes the path's chunks resident and builds the shader variant)
+    unsigned  pass          = 0;            ///< 0: lighting per material (LIGHT_PER_MATERIAL), 1: blended materials
+    unsigned  frame         = 0;            ///< Frame of the current pass
+    unsigned  framesPerPass = 600;          ///< Frames per pass (a full turn of the camera path)
+    double    gpuTime[2]    = { 0, 0 };     ///< Accumulated GPU time (ms) of the terrain draws in each pass (GL_TIMESTAMP, so it doesn't interfere with gpuProfiler)
+    double    wallTime[2]   = { 0, 0 };     ///< Accumulated time (ms) from the first draw until glFinish() returns (some drivers, like llvmpipe, report 0 GPU time)
+    unsigned  queries[2]    = { 0, 0 };     ///< Timestamps before and after the terrain draws
+    std::chrono::steady_clock::time_point start;
+    glm::vec3 savedPosition;                ///< Camera pose before the benchmark
+    float     savedYaw, savedPitch;
+} shadingBench;
+
+// Command line --------------------
+/// Options given in the command line (see parseArguments())
+struct commandLine
+{
+    bool        benchmark    = false;       ///< Replay a camera path (--benchmark <path file>), save the measures and exit
+    std::string output;                     ///< Prefix of the benchmark results (--output <prefix>): <prefix>.csv and <prefix>.json
+    std::string recordFile;                 ///< Save the camera path of this session (--record <path file>)
+    double      recordInterval = 0.1;       ///< Seconds between recorded keys
+    std::string contextAPI;                 ///< "egl" or "osmesa" (--context). Empty: native.
+    bool        visible      = false;       ///< Show the window while benchmarking (--visible)
+    std::vector<terrainBackendType> backends;   ///< Terrain backends compared in benchmark mode (--backend <id|all>). The path is replayed with each one.
+    bool        occlusion    = false;       ///< Start with occlusion culling enabled (--occlusion)
+} options;
+
+replayBenchmark benchmark;                  ///< Camera path replayed in benchmark mode, and its measures
+cameraPath recordedPath;                    ///< Camera path recorded in this session (see commandLine::recordFile)
+
+// Terrain drawing --------------------
+/// Terrain drawing options and statistics
+struct terrainDrawing
+{
+    bool     sortFrontToBack   = true;      ///< Draw the nearest chunks first, so hidden fragments fail the depth test before being shaded
+    bool     frustumCulling    = true;      ///< Skip the chunks outside the view frustum (see drawListBuilder)
+    bool     occlusionCulling  = false;     ///< Skip the chunks hidden by nearer terrain in the previous frame (see occlusionCuller)
+    bool     depthPrepass      = false;     ///< Fill the depth buffer first (trivial fragment shader), so terrain.fs runs about once per pixel
+    bool     showOverdraw      = false;     ///< Draw the terrain additively with a flat color (brighter: more fragments shaded per pixel)
+    terrainBackendType backend = backendChunkVAO;   ///< How chunks are kept in GPU memory and drawn (see terrainBackend)
+    unsigned queries[2]        = { };       ///< GL_SAMPLES_PASSED queries (double buffered: results are read 2 frames later). GPU time: see gpuProfiler.
+    unsigned frame             = 0;
+    double   fragmentsPerPixel = 0;         ///< Fragments shaded by terrain.fs divided by the pixels of the window
+} terrainDraw;
+
 // Fog --------------------
+bool fogEnabled = true;
 float fogMinR = 230;
 float fogMaxR = 290;
 glm::vec4 skyColor = glm::vec4(0.0f, 0.24f, 0.39f, 1.0f);
@@ -36,6 +90,7 @@ glm::vec4 skyColor = glm::vec4(0.0f, 0.24f, 0.39f, 1.0f);
 // Paths --------------------
 std::string path_shaders  = "../../../projects/player/shaders/";
 std::string path_textures = "../../../textures/";
+std::string path_cache    = "../../../_BUILD/cache/";      // Files generated at runtime (chunk store, ...)
 
 // Lighting --------------------
 
@@ -114,4 +169,59 @@ material sand      ( 32 );
 material plainSand ( 32 );
 material sun;
 
+unsigned materialMaps     = 0;      ///< Texture array with the diffuse and specular maps of grass, rock, sand and plainSand (see cookTextureArray())
+unsigned materialMapsSize = 1024;   ///< Side of the layers of materialMaps
+
+// Uniform blocks --------------------
+// Mirror the std140 uniform blocks declared in the shaders ("Camera" and "Lighting"). Filled once per frame.
+
+#define CAMERA_BLOCK_BINDING   0
+#define LIGHTING_BLOCK_BINDING 1
+
+struct cameraBlock
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec4 camPos;           ///< Camera position (w unused)
+};
+
+struct lightBlock
+{
+    int       lightType;
+    float     padding0[3];
+    glm::vec3 position;
+    float     padding1;
+    glm::vec3 direction;
+    float     padding2;
+    glm::vec3 ambient;
+    float     padding3;
+    glm::vec3 diffuse;
+    float     padding4;
+    glm::vec3 specular;
+    float     constant;         ///< Packed after the vec3, as std140 does
+    float     linear;
+    float     quadratic;
+    float     cutOff;
+    float     outerCutOff;
+};
+
+struct materialBlock
+{
+    glm::vec3 diffuse;
+    float     padding;
+    glm::vec3 specular;
+    float     shininess;
+};
+
+struct lightingBlock
+{
+    lightBlock    sun;
+    materialBlock grass, rock, snow, sand, plainSand, water;
+};
+
+static_assert(sizeof(cameraBlock)   == 144, "cameraBlock doesn't match the std140 layout");
+static_assert(sizeof(lightBlock)    == 112, "lightBlock doesn't match the std140 layout");
+static_assert(sizeof(materialBlock) == 32,  "materialBlock doesn't match the std140 layout");
+static_assert(sizeof(lightingBlock) == 304, "lightingBlock doesn't match the std140 layout");
+
 #endif
@@ -0,0 +1,82 @@
+#ifndef GPUPROFILER_HPP
+#define GPUPROFILER_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+
+/**
+ * @brief Measures the GPU time of each render pass with GL_TIME_ELAPSED queries.
+ *
+ * Queries are N-buffered: the queries issued in a frame are read N-1 frames later (in beginFrame()), when the GPU has
+ * normally finished them, so reading never stalls the pipeline. If they are still not available, that frame's results
+ * are dropped. Passes can't be nested (one GL_TIME_ELAPSED query can be active at a time).
+ *
+ * If timer queries are not available (no GL_TIME_ELAPSED counter bits), every method is a no-op and isSupported() is false.
+ *
+ * Usage:
+ *     profiler.beginFrame();
+ *     profiler.begin("Terrain");  drawTerrain();  profiler.end();
+ *     profiler.begin("Water");    drawWater();    profiler.end();
+ */
+class gpuProfiler
+{
+    struct frameQueries
+    {
+        std::vector<unsigned> queries;      ///< Query objects (created on demand, reused)
+        std::vector<unsigned> passes;       ///< Pass index of each query used in this frame
+        size_t frame;                       ///< Frame number when they were issued
+    };
+
+    std::vector<std::string>  passNames;
+    std::vector<frameQueries> ring;         ///< One set of queries per buffered frame
+    unsigned current;                       ///< Set of queries of the current frame
+    size_t   frameNumber;
+    bool     passOpen;
+    bool     supported;
+
+    std::vector<double> lastTimes;          ///< Milliseconds per pass (latest frame read)
+    std::vector<double> averages;           ///< Milliseconds per pass (exponential moving average)
+    std::deque<std::pair<size_t, std::vector<double>>> history;    ///< Frame number and milliseconds per pass of the last frames read
+    size_t   historySize;
+    size_t   numDropped;                    ///< Frames whose results weren't available in time
+    long     lastFrameRead;                 ///< Frame number of lastTimes (-1: none)
+
+    unsigned getPassIndex(const std::string &name);
+    void     readResults(frameQueries &frame);
+
+public:
+    /*
+    *   @brief Constructor. Requires a current GL context.
+    *   @param numBuffers Number of frames in flight (results are read numBuffers - 1 frames later)
+    *   @param historySize Number of frames kept for exportCSV()
+    */
+    gpuProfiler(unsigned numBuffers = 3, size_t historySize = 1000);
+    ~gpuProfiler();
+    gpuProfiler(const gpuProfiler&) = delete;
+    gpuProfiler& operator = (const gpuProfiler&) = delete;
+
+    void beginFrame();                      ///< Read the results of the oldest frame in flight and start a new frame (call it once per frame, before the first pass)
+    void begin(const std::string &pass);    ///< Start timing a pass (a pass can be timed several times per frame; times are added)
+    void end();                             ///< Stop timing the current pass
+
+    bool     isSupported() const;           ///< False if timer queries are not available
+    unsigned getNumPasses() const;
+    const std::string& getPassName(unsigned pass) const;
+    double   getTime(unsigned pass) const;  ///< Milliseconds (latest frame read)
+    double   getAverage(unsigned pass) const;   ///< Milliseconds (moving average)
+    double   getTime(const std::string &pass) const;    ///< Milliseconds (latest frame read). 0 if the pass is unknown.
+    double   getTotal() const;              ///< Milliseconds of all the passes (latest frame read)
+    size_t   getNumDropped() const;         ///< Frames whose results were dropped (not available after numBuffers - 1 frames)
+    size_t   getFrameNumber() const;        ///< Number of the current frame (the first beginFrame() starts frame 0)
+    long     getLastFrameRead() const;      ///< Frame number whose times getTime() returns (-1: none read yet)
+
+    /*
+    *   @brief Save the per-pass times of the last frames read (one row per frame: frame number, then one column per pass)
+    *   @param file File path
+    *   @return False if the file couldn't be written
+    */
+    bool exportCSV(const std::string &file) const;
+};
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef OCCLUSION_HPP
+#define OCCLUSION_HPP
+
+#include <vector>
+#include <map>
+
+#include "glm/glm.hpp"
+
+#include "shader.hpp"
+#include "terrainBackend.hpp"
+#include "simulation.hpp"
+
+/**
+ * @brief Occlusion culling of terrain chunks with hardware queries. After the terrain is drawn, the bounding box of each
+ * chunk in the draw list is drawn (no color or depth writes) inside a GL_ANY_SAMPLES_PASSED query. In the next frame, each
+ * chunk is drawn inside glBeginConditionalRender() with its query, so the GPU skips the chunks whose box was hidden by
+ * nearer terrain. The CPU never waits for the results (GL_QUERY_NO_WAIT: if a result is not ready yet, the chunk is drawn).
+ *
+ * Results are one frame old (temporal coherence), so a chunk that becomes visible is drawn one frame late. Chunks without
+ * a query yet (new in the draw list) and chunks whose box contains the camera (the box could be clipped by the near plane)
+ * are always drawn.
+ *
+ * Conditional rendering works per draw call: chunks with a query are drawn one by one, so the batching of the shared
+ * buffer backends (multi-draw, instanced) is only kept for runs of chunks without one.
+ *
+ * Usage (each frame):
+ *     culler.beginFrame(snapshot, drawList);
+ *     culler.draw(backend, drawList);              // Every terrain pass (depth pre-pass, shading)
+ *     culler.issueQueries(boxProgram, snapshot, drawList);
+ */
+class occlusionCuller
+{
+    struct chunkQuery
+    {
+        unsigned query;
+        size_t   frame;                     ///< Last frame the chunk was in the draw list
+        bool     issued;                    ///< The query has been used (it has a result, or will have it)
+    };
+
+    std::map<BinaryKey, chunkQuery> queries;
+    std::vector<unsigned> freeQueries;      ///< Query objects of chunks that left the draw list
+    std::vector<unsigned> conditions;       ///< Query of each chunk of the current draw list (0: draw unconditionally)
+    std::vector<chunkDrawCall> run;         ///< Chunks drawn by a single backend call (reused)
+    unsigned VAO, VBO, EBO;                 ///< Unit cube
+    size_t   frame;
+    size_t   numTested;                     ///< Chunks drawn conditionally this frame
+    size_t   numOccluded;                   ///< Of them, the ones known to be hidden (results available)
+
+    static const float nearMargin;          ///< Boxes closer than this to the camera are considered to contain it
+
+public:
+    occlusionCuller();
+    ~occlusionCuller();
+    occlusionCuller(const occlusionCuller&) = delete;
+    occlusionCuller& operator = (const occlusionCuller&) = delete;
+
+    /*
+    *   @brief Choose the chunks drawn conditionally this frame and count the occluded ones (from the results already available). Queries of chunks no longer drawn are released.
+    *   @param snapshot Snapshot the draw list was built from
+    *   @param drawList Chunks to draw this frame
+    */
+    void beginFrame(const frameSnapshot &snapshot, const std::vector<chunkDrawCall> &drawList);
+
+    /*
+    *   @brief Draw the chunks of the draw list, skipping (on the GPU) the ones occluded in the previous frame. The terrain program must be in use.
+    *   @param backend Backend that holds the chunks
+    *   @param drawList Same list passed to beginFrame()
+    */
+    void draw(terrainBackend &backend, const std::vector<chunkDrawCall> &drawList);
+
+    /*
+    *   @brief Draw the bounding box of each chunk of the draw list inside its query, against the current depth buffer. Call after drawing the terrain.
+    *   @param program Box program (box.vs, depth.fs), with the Camera uniform block bound
+    *   @param snapshot Snapshot the draw list was built from
+    *   @param drawList Same list passed to beginFrame()
+    */
+    void issueQueries(Shader &program, const frameSnapshot &snapshot, const std::vector<chunkDrawCall> &drawList);
+
+    void clear();                           ///< Release every query (results are dropped)
+
+    size_t getNumTested() const;            ///< Chunks drawn conditionally in the current frame
+    size_t getNumOccluded() const;          ///< Chunks skipped in the current frame (as far as results were available in beginFrame())
+};
+
+#endif
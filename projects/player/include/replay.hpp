@@ -0,0 +1,120 @@
+#ifndef REPLAY_HPP
+#define REPLAY_HPP
+
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+/**
+ * @brief Camera poses keyed by time. Poses between keys are linearly interpolated.
+ *
+ * File format (text): one key per line, "time x y z yaw pitch" (seconds, meters, degrees). Lines starting with '#' are comments.
+ */
+class cameraPath
+{
+    struct key
+    {
+        double    time;
+        glm::vec3 position;
+        float     yaw, pitch;
+    };
+
+    std::vector<key> keys;          ///< Sorted by time
+
+public:
+    bool   load(const std::string &file);           ///< Replace the keys with those of a file. False if it can't be read or has no keys.
+    bool   save(const std::string &file) const;     ///< False if the file can't be written
+    void   addKey(double time, glm::vec3 position, float yaw, float pitch);    ///< Keys must be added in time order
+    void   clear();
+
+    size_t size() const;
+    double getDuration() const;     ///< Time of the last key
+
+    /*
+    *   @brief Get the camera pose at some time (clamped to the first and last keys)
+    *   @param time Time (seconds)
+    *   @param position Receives the camera position
+    *   @param yaw Receives the yaw (degrees)
+    *   @param pitch Receives the pitch (degrees)
+    *   @return False if the path has no keys
+    */
+    bool getPose(double time, glm::vec3 &position, float &yaw, float &pitch) const;
+};
+
+/// Measures of one frame of a replayBenchmark
+struct benchmarkFrame
+{
+    size_t run;                 ///< Index of the run (see replayBenchmark::beginRun())
+    size_t frame;               ///< Frame of the run
+    double time;                ///< Path time (seconds)
+    double frameTime;           ///< CPU time (ms) between this frame and the previous one
+    double submitTime;          ///< CPU time (ms) spent issuing the terrain draw calls
+    double gpuTime;             ///< GPU time (ms) of the render passes (see gpuProfiler). -1 if not available.
+    double terrainGpuTime;      ///< GPU time (ms) of the terrain passes. -1 if not available.
+    size_t chunks;              ///< Chunks in memory
+    size_t chunksGenerated;     ///< Chunks generated from noise during this frame
+    size_t chunksLoaded;        ///< Chunks loaded from the chunk store during this frame
+    size_t chunksDrawn;
+    size_t memoryKB;            ///< Resident memory of the process (0 if unknown)
+    size_t gpuKB;               ///< Terrain buffers (see terrainBackend::getGpuBytes())
+};
+
+/**
+ * @brief Replays a cameraPath at a fixed timestep (frame i shows the pose at time i * timeStep, whatever the real frame
+ * time is) and collects the measures of each frame. At the end, they are saved as CSV (one row per frame) and JSON (summary).
+ *
+ * The path can be replayed several times in a row (runs), changing some setting between them (A/B comparisons). Frames
+ * are numbered from the start of the session (like gpuProfiler frames), and getRunFrame() gives the frame within the run.
+ */
+class replayBenchmark
+{
+    struct run
+    {
+        std::string name;
+        size_t      firstFrame;
+    };
+
+    std::vector<benchmarkFrame> frames;     ///< One per session frame
+    std::vector<run> runs;
+
+    struct runSummary
+    {
+        size_t numFrames;
+        double mean, p50, p95, p99, max;    ///< Frame time (ms)
+        double submitMean, gpuMean, terrainGpuMean;     ///< Means (ms). GPU times: -1 if not available.
+        size_t generated, loaded, peakMemoryKB, peakGpuKB;
+    };
+    runSummary summarize(size_t firstFrame, size_t endFrame) const;     ///< Measures of frames [firstFrame, endFrame)
+
+public:
+    cameraPath path;
+    std::string pathFile;
+    double timeStep = 1. / 60;      ///< Path time (seconds) advanced per frame
+
+    size_t getNumFrames() const;    ///< Number of frames needed to replay the path (per run)
+    double getTime(size_t frame) const;     ///< Path time of some frame of a run
+
+    void   beginRun(const std::string &name, size_t firstFrame);     ///< Start a new replay at some session frame. Without runs, the session is a single unnamed run.
+    size_t getRun() const;                  ///< Index of the current run
+    size_t getRunFrame(size_t frame) const; ///< Frame of the current run, given the session frame
+
+    void addFrame(const benchmarkFrame &frame);     ///< Frames must be added for every session frame, in order
+    void setGpuTime(size_t frame, double gpuTime, double terrainGpuTime);  ///< GPU times are known a few frames later (session frame)
+
+    bool writeCSV(const std::string &file) const;   ///< Per-frame measures. False if the file can't be written.
+
+    /*
+    *   @brief Save a summary of the session and of each run (frame time percentiles, mean CPU submit and GPU times, chunks, peak memory)
+    *   @param file File path
+    *   @param renderer GL_RENDERER string (identifies the driver used)
+    *   @return False if the file can't be written
+    */
+    bool writeJSON(const std::string &file, const std::string &renderer) const;
+
+    void printSummary() const;      ///< Runs side by side (console)
+
+    static size_t getResidentMemory();      ///< Resident memory (KB) of the process (Linux: /proc/self/statm). 0 if unknown.
+};
+
+#endif
@@ -14,23 +14,49 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <map>
+#include <vector>
+#include <functional>
+#include <cstdint>
 
 /// Compiles and uses a GPU program. Sets uniforms.
 class Shader
 {
     void checkCompileErrors(unsigned int shaderID, std::string type);
 
+    mutable std::unordered_map<std::string, int> uniformLocations;     ///< Cache of uniform locations (name -> location)
+    int getUniformLocation(const std::string &name) const;              ///< Get a uniform location (glGetUniformLocation() is only called the first time)
+
+    uint64_t binaryKey(const std::string &vertexCode, const std::string &fragmentCode) const;   ///< Hash of the sources and the driver (vendor, renderer, version)
+    bool loadBinary(const std::string &fileName, uint64_t key);         ///< Load the program from the binary cache. False if there is no binary or the driver rejects it.
+    void saveBinary(const std::string &fileName, uint64_t key);         ///< Save the linked program in the binary cache
+
 public:
     unsigned int ID;        ///< Program identifier
 
+    static std::string binaryCacheDirectory;    ///< Directory for program binaries (glGetProgramBinary). Empty: binary cache disabled.
+    double buildTime;                           ///< Milliseconds spent building the program (compile + link, or binary load)
+    bool   fromBinaryCache;                     ///< True if the program was loaded from the binary cache
+
     /*
-    *   @brief Constructor. Creates a program, so the program's identifier is defined
+    *   @brief Constructor. Creates a program, so the program's identifier is defined. If binaryCacheDirectory is set and the
+    *   driver supports program binaries, a binary cached by a previous run for the same sources and driver is used instead of
+    *   compiling the shaders (it falls back to compiling if the driver rejects the binary).
     *   @param vertexPath Path for the vertex shader file
     *   @param fragmentPath Path for the fragment shader file
+    *   @param defines Macros defined in both shaders (inserted after the #version line). Example: { "FOG", "LIGHT_SPOT" }
     */
-    Shader(const char *vertexPath, const char *fragmentPath);
+    Shader(const char *vertexPath, const char *fragmentPath, const std::vector<std::string> &defines = std::vector<std::string>());
     void UseProgram();                                          ///< Use the program: Make it active in the current context
 
+    /*
+    *   @brief Connect a uniform block of the program to a binding point (GLSL 330 has no "binding" layout qualifier). Nothing is done if the program doesn't use the block.
+    *   @param blockName Name of the uniform block in the shaders
+    *   @param bindingPoint Binding point of the UBO (see createUBO())
+    */
+    void bindUniformBlock(const std::string &blockName, unsigned bindingPoint);
+
     // Uniforms ------------------------------
     void setBool (const std::string &name, bool value) const;                         ///< Boolean uniform creator (converted to int). 
     void setInt  (const std::string &name, int value) const;                          ///< Integer uniform creator
@@ -46,4 +72,32 @@ public:
     void setMat4 (const std::string &name, const glm::mat4 &mat) const;               ///< Mat4 uniform creator
 };
 
+/**
+ * @brief Compiled permutations (variants) of a program: same shader files, different sets of #defines. Each variant is
+ * built the first time it is requested, and kept for the next requests.
+ */
+class shaderVariants
+{
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::function<void(Shader&)> setup;
+    std::map<std::string, Shader*> variants;    ///< Key: defines separated by spaces
+
+public:
+    /*
+    *   @brief Constructor. No program is built until get() is called.
+    *   @param vertexPath Path for the vertex shader file
+    *   @param fragmentPath Path for the fragment shader file
+    *   @param setup Function called once for each new variant (set sampler units, bind uniform blocks...)
+    */
+    shaderVariants(const std::string &vertexPath, const std::string &fragmentPath, std::function<void(Shader&)> setup = nullptr);
+    ~shaderVariants();
+    shaderVariants(const shaderVariants&) = delete;
+    shaderVariants& operator = (const shaderVariants&) = delete;
+
+    Shader& get(const std::vector<std::string> &defines);      ///< Get the variant for a set of defines (built if needed)
+    void    deletePrograms();                                   ///< Delete all the variants (requires the GL context)
+    size_t  size() const;                                       ///< Number of variants built
+};
+
 #endif
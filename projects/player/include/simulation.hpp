@@ -0,0 +1,156 @@
+#ifndef SIMULATION_HPP
+#define SIMULATION_HPP
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+#include "glm/glm.hpp"
+
+#include "camera.hpp"
+#include "world.hpp"
+
+/**
+ * @brief Lock-free single producer/single consumer triple buffer. The writer fills the back buffer and publishes it; the
+ * reader acquires the latest published buffer. Neither side waits for the other: the writer never overwrites the buffer
+ * being read, and the reader skips the buffers published while it was busy.
+ */
+template<typename T>
+class tripleBuffer
+{
+    static const unsigned freshBit = 4;     ///< Set in middle when it holds a buffer not acquired yet
+
+    T buffers[3];
+    std::atomic<unsigned> middle;           ///< Buffer exchanged between writer and reader (index | freshBit)
+    unsigned back;                          ///< Owned by the writer
+    unsigned front;                         ///< Owned by the reader
+
+public:
+    tripleBuffer() : middle(1), back(0), front(2) { }
+
+    T&       getBack()        { return buffers[back]; }     ///< Buffer to fill (writer)
+    const T& getFront() const { return buffers[front]; }    ///< Latest acquired buffer (reader)
+
+    void publish() { back = middle.exchange(back | freshBit) & ~freshBit; }     ///< Make the back buffer available to the reader (writer)
+
+    /// Make the latest published buffer the front one (reader). False if nothing was published since the last call.
+    bool acquire()
+    {
+        if(!(middle.load() & freshBit)) return false;
+        front = middle.exchange(front) & ~freshBit;
+        return true;
+    }
+};
+
+/// Chunk in a frameSnapshot
+struct visibleChunk
+{
+    BinaryKey key;
+    glm::vec3 boxMin, boxMax;               ///< Bounding box (verticalScale applied)
+    float     squareDistance;               ///< Squared distance from the camera to the box center
+};
+
+/// State of one simulation tick, published for the renderer. It's never modified after being published.
+struct frameSnapshot
+{
+    size_t    tick          = 0;
+    double    time          = 0;            ///< Simulation time (seconds)
+    Camera    camera;                       ///< Simulation camera at the end of the tick
+    glm::mat4 view          = glm::mat4(1.f);
+    glm::mat4 projection    = glm::mat4(1.f);
+    std::vector<visibleChunk> chunks;       ///< Chunks in the world that are not completely fogged (in map order)
+    size_t    numChunks     = 0;            ///< Chunks in the world
+    size_t    pendingChunks = 0;            ///< Chunks still showing a placeholder
+    size_t    chunksGenerated = 0;          ///< Totals of the world so far (see terrainChunks)
+    size_t    chunksLoaded    = 0;
+};
+
+/**
+ * @brief Runs the simulation (camera movement and chunk residency) at a fixed tick rate in its own thread, so it doesn't
+ * slow down when rendering stalls (uploads, shader compilation, vsync). Each tick publishes a frameSnapshot through a
+ * tripleBuffer, and the render thread draws the latest one.
+ *
+ * Input: GLFW delivers events in the main thread (the render thread), so input is forwarded here with the set/add methods
+ * (mouse offsets and scroll are accumulated until the next tick).
+ *
+ * The world (terrainChunks) is shared: a tick holds worldMutex while it updates the chunks, and the render thread must
+ * hold it while reading chunk data (uploads) or editing the world (GUI). The renderer should try_lock it for uploads, so
+ * it skips them instead of waiting while a tick generates chunks.
+ *
+ * Without start(), ticks run when tick() is called (deterministic replays: one tick per frame).
+ */
+class simulation
+{
+    typedef std::chrono::steady_clock clock;
+
+    /// Input forwarded by the render thread
+    struct inputState
+    {
+        bool      keys[6]       = { };      ///< Held keys (see Camera_Movement)
+        float     mouseX        = 0;        ///< Mouse offsets since the last tick
+        float     mouseY        = 0;
+        float     scroll        = 0;        ///< Scroll since the last tick
+        int       width         = SCR_WIDTH;
+        int       height        = SCR_HEIGHT;
+        float     movementSpeed = SPEED;
+        float     fogRadius     = 0;        ///< Chunks farther are not generated nor listed as visible (0: no fog)
+        bool      poseRequested = false;    ///< Teleport the camera in the next tick
+        glm::vec3 position;
+        float     yaw, pitch;
+    };
+
+    Camera         camera;                  ///< Owned by the simulation thread
+    terrainChunks &world;
+    double         tickRate;                ///< Ticks per second
+    size_t         ticks;
+    double         time;
+
+    std::mutex     inputMutex;
+    inputState     input;
+    tripleBuffer<frameSnapshot> snapshots;
+
+    std::thread       thread;
+    std::atomic<bool> running;
+
+    void run();                             ///< Thread loop: a tick every 1/tickRate seconds
+
+public:
+    std::mutex worldMutex;                  ///< Held while the world's chunks are changed or read (see class description)
+
+    /*
+    *   @brief Constructor
+    *   @param camera Initial camera
+    *   @param world Chunks whose residency is updated each tick (around the camera)
+    *   @param tickRate Ticks per second
+    */
+    simulation(const Camera &camera, terrainChunks &world, double tickRate = 120);
+    ~simulation();
+    simulation(const simulation&) = delete;
+    simulation& operator = (const simulation&) = delete;
+
+    void start();                           ///< Run the ticks in a thread
+    void stop();                            ///< Wait for the current tick and stop the thread
+    bool isRunning() const;
+    double getTickRate() const;
+
+    /*
+    *   @brief Advance the simulation: apply the input to the camera, update the chunks in range and publish a snapshot. Called by the thread, or directly if it's not running.
+    *   @param deltaTime Simulated time (seconds)
+    */
+    void tick(double deltaTime);
+
+    bool acquireSnapshot();                 ///< Make the latest snapshot current (render thread). False if there is no new one.
+    const frameSnapshot& getSnapshot() const;   ///< Current snapshot (render thread)
+
+    void setKey(Camera_Movement key, bool pressed);
+    void addMouseMovement(float xoffset, float yoffset);
+    void addScroll(float yoffset);
+    void setViewport(int width, int height);
+    void setMovementSpeed(float speed);
+    void setFogRadius(float radius);
+    void setPose(glm::vec3 position, float yaw, float pitch);   ///< Applied in the next tick
+};
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef TERRAINBACKEND_HPP
+#define TERRAINBACKEND_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <chrono>
+
+#include "world.hpp"
+#include "upload.hpp"
+
+/// Chunk ready to be drawn (filled by terrainBackend::getDrawCall(), drawn by terrainBackend::draw())
+struct chunkDrawCall
+{
+    unsigned VAO, VBO, EBO;                 ///< With backends that share buffers, the shared ones
+    unsigned numIndices;
+    size_t   splatOffset;                   ///< Offset (bytes) of the splat weights in the VBO
+    int      baseVertex;                    ///< First vertex of the chunk in the VBO (shared buffers)
+    size_t   indexOffset;                   ///< Offset (bytes) of the first index of the chunk in the EBO (shared buffers)
+    unsigned numVertex;
+    float    squareDistance;                ///< Squared distance from the camera to the chunk's center
+    unsigned chunk;                         ///< Index of the chunk in frameSnapshot::chunks (set by drawListBuilder)
+};
+
+enum terrainBackendType { backendChunkVAO, backendSharedVAO, backendMultiDraw, backendInstanced, numTerrainBackends };
+
+extern const char* terrainBackendNames[numTerrainBackends];    ///< Names shown in the GUI
+extern const char* terrainBackendIds[numTerrainBackends];      ///< Names used in the command line (--backend)
+
+/**
+ * @brief Keeps the terrain chunks in GPU memory and draws them. Each backend organizes buffers and draw calls in a different way:
+ * <ul>
+ *  <li>backendChunkVAO: a VAO, VBO and EBO per chunk. One glDrawElements() per chunk.</li>
+ *  <li>backendSharedVAO: a VBO and EBO per chunk, and one VAO reconfigured before each glDrawElements().</li>
+ *  <li>backendMultiDraw: all the chunks in shared buffers (fixed size slots), drawn with one glMultiDrawElementsBaseVertex().</li>
+ *  <li>backendInstanced: shared buffers, read in terrain.vs as texture buffers (INSTANCED). Chunks with the same number of
+ *      vertex share an index buffer and are drawn with one glDrawElementsInstanced().</li>
+ * </ul>
+ * Chunk data is streamed through an uploadRing. A chunk is drawn once its copies have been issued.
+ */
+class terrainBackend
+{
+protected:
+    uploadRing &uploader;
+    size_t   gpuBytes;                      ///< Bytes of the buffers created by the backend
+    unsigned vertexPerSide;                 ///< Vertex per side of the full resolution chunks (set by update())
+    std::set<BinaryKey> keys;               ///< Chunks with GPU data
+
+    /*
+    *   @brief Copy a chunk to staging memory ([vertex (8 floats)][splat (4 bytes)][indices]). Returns false if there is no staging memory available.
+    *   @param chunk Chunk
+    *   @param ticket Receives the staging region
+    */
+    bool stageChunk(const terrainGenerator &chunk, uploadTicket &ticket);
+    static size_t vertexBytes(const terrainGenerator &chunk);
+    static size_t splatBytes(const terrainGenerator &chunk);
+    static size_t indexBytes(const terrainGenerator &chunk);
+
+    virtual bool addChunk(const BinaryKey &key, const terrainGenerator &chunk) = 0;    ///< Create the GPU data of a chunk. False if it can't be done now (try again next frame).
+    virtual void removeChunk(const BinaryKey &key) = 0;                                 ///< Delete the GPU data of a chunk
+
+public:
+    terrainBackend(uploadRing &uploader);
+    virtual ~terrainBackend();
+    terrainBackend(const terrainBackend&) = delete;
+    terrainBackend& operator = (const terrainBackend&) = delete;
+
+    virtual terrainBackendType getType() const = 0;
+    const char* getName() const;
+    virtual std::vector<std::string> getDefines() const;    ///< Defines required by terrain.vs (see shaderVariants)
+    size_t getGpuBytes() const;
+    size_t getNumChunks() const;            ///< Chunks with GPU data (their copies may still be pending)
+
+    /*
+    *   @brief Delete the GPU data of the chunks no longer in world.chunkDict or in world.refreshedChunks (then, refreshedChunks is cleared), and create it for new chunks, until world.frameBudget is used up. Call uploader.flush() after this.
+    *   @param world Chunks
+    *   @param startTime Start of the frame budget. If chunks were generated in this frame, the time they took (the budget is shared).
+    */
+    void update(terrainChunks &world, std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now());
+
+    /*
+    *   @brief Get the data needed for drawing a chunk (everything but squareDistance and chunk). Only GPU-side data is used, so the chunk may have left the world (see simulation).
+    *   @return False if the chunk is not in GPU memory yet
+    */
+    virtual bool getDrawCall(const BinaryKey &key, chunkDrawCall &drawCall) const = 0;
+
+    virtual void draw(const std::vector<chunkDrawCall> &drawList) = 0;     ///< Draw some chunks, in order (the terrain program must be in use)
+    virtual void clear() = 0;               ///< Delete the GPU data of all the chunks
+};
+
+/// Create a backend (delete it before the GL context is destroyed)
+terrainBackend* createTerrainBackend(terrainBackendType type, uploadRing &uploader);
+
+/// backendChunkVAO: a VAO, VBO and EBO per chunk
+class chunkVAOBackend : public terrainBackend
+{
+    struct chunkBuffers { unsigned VAO, VBO, EBO, numVertex, numIndices; size_t bytes; };
+    std::map<BinaryKey, chunkBuffers> buffers;
+
+    bool addChunk(const BinaryKey &key, const terrainGenerator &chunk) override;
+    void removeChunk(const BinaryKey &key) override;
+
+public:
+    chunkVAOBackend(uploadRing &uploader);
+    ~chunkVAOBackend();
+
+    terrainBackendType getType() const override;
+    bool getDrawCall(const BinaryKey &key, chunkDrawCall &drawCall) const override;
+    void draw(const std::vector<chunkDrawCall> &drawList) override;
+    void clear() override;
+};
+
+/// backendSharedVAO: a VBO and EBO per chunk, and one VAO for all of them
+class sharedVAOBackend : public terrainBackend
+{
+    struct chunkBuffers { unsigned VBO, EBO, numVertex, numIndices; size_t bytes; };
+    std::map<BinaryKey, chunkBuffers> buffers;
+    unsigned VAO;
+
+    bool addChunk(const BinaryKey &key, const terrainGenerator &chunk) override;
+    void removeChunk(const BinaryKey &key) override;
+
+public:
+    sharedVAOBackend(uploadRing &uploader);
+    ~sharedVAOBackend();
+
+    terrainBackendType getType() const override;
+    bool getDrawCall(const BinaryKey &key, chunkDrawCall &drawCall) const override;
+    void draw(const std::vector<chunkDrawCall> &drawList) override;
+    void clear() override;
+};
+
+/**
+ * @brief backendMultiDraw: all the chunks in three shared buffers (vertex, splat weights, indices), divided in slots big
+ * enough for a full resolution chunk. Buffers double their capacity when full (their content is copied on the GPU).
+ */
+class multiDrawBackend : public terrainBackend
+{
+protected:
+    struct chunkSlot { unsigned slot, numVertex, numIndices; };
+    std::map<BinaryKey, chunkSlot> slots;
+    std::vector<unsigned> freeSlots;
+    unsigned capacity;                      ///< Number of slots in the buffers
+    unsigned usedSlots;                     ///< Slots ever used (the rest are after them)
+    unsigned slotVertex, slotIndices;       ///< Size of a slot (0: not set; set with the first chunk added)
+    unsigned VAO, vertexBuffer, splatBuffer, indexBuffer;
+    bool     storeIndices;                  ///< False if indexBuffer is not used (instancedBackend)
+
+    std::vector<GLsizei> counts;            ///< Arguments of glMultiDrawElementsBaseVertex() (reused each frame)
+    std::vector<const void*> offsets;
+    std::vector<GLint> baseVertices;
+
+    bool addChunk(const BinaryKey &key, const terrainGenerator &chunk) override;
+    void removeChunk(const BinaryKey &key) override;
+    bool grow(unsigned newCapacity);        ///< Create bigger buffers and copy the old ones. False if some copy to them is pending.
+    virtual void buffersChanged();          ///< Called when the shared buffers are created again (grow())
+    virtual unsigned maxSlots() const;      ///< Maximum capacity
+
+public:
+    multiDrawBackend(uploadRing &uploader);
+    ~multiDrawBackend();
+
+    terrainBackendType getType() const override;
+    bool getDrawCall(const BinaryKey &key, chunkDrawCall &drawCall) const override;
+    void draw(const std::vector<chunkDrawCall> &drawList) override;
+    void clear() override;
+};
+
+/**
+ * @brief backendInstanced: the shared buffers of multiDrawBackend are read in terrain.vs as texture buffers (vertex data: 2
+ * RGBA32F texels per vertex; splat weights: 1 RGBA8 texel per vertex, units 9 and 10). Chunks with the same number of vertex
+ * have the same triangles, so each group is drawn with one glDrawElementsInstanced() using a shared index buffer, and
+ * the first vertex of each instance as a per-instance attribute (location 4).
+ *
+ * Capacity is limited by GL_MAX_TEXTURE_BUFFER_SIZE (at least 65536 texels: 12 chunks of 51x51 vertex).
+ */
+class instancedBackend : public multiDrawBackend
+{
+    struct gridIndices { unsigned EBO, numIndices; };
+    std::map<unsigned, gridIndices> grids;  ///< Index buffer for each number of vertex per chunk
+    unsigned vertexTexture, splatTexture;
+    unsigned instanceVAO;
+    unsigned instanceBuffer;                ///< First vertex of each instance
+    size_t   instanceBufferSize;
+    std::vector<GLint> firstVertices;
+
+    bool addChunk(const BinaryKey &key, const terrainGenerator &chunk) override;
+    void buffersChanged() override;
+    unsigned maxSlots() const override;
+
+public:
+    instancedBackend(uploadRing &uploader);
+    ~instancedBackend();
+
+    terrainBackendType getType() const override;
+    std::vector<std::string> getDefines() const override;
+    void draw(const std::vector<chunkDrawCall> &drawList) override;
+    void clear() override;
+};
+
+#endif
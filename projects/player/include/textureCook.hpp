@@ -0,0 +1,36 @@
+#ifndef TEXTURECOOK_HPP
+#define TEXTURECOOK_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Set of images cooked for a texture array: every layer has the same (square, power of two) size and the whole
+ * mip chain is precomputed on the CPU. Data is either RGB8 or DXT1 (S3TC) blocks.
+ */
+struct cookedTextures
+{
+    unsigned size;                                  ///< Side of the layers in level 0 (pixels)
+    unsigned numLayers;
+    unsigned numLevels;
+    bool     compressed;                            ///< True: DXT1 blocks (8 bytes per 4x4 block). False: RGB8
+    std::vector<std::vector<unsigned char>> levels; ///< Data of each mip level (all the layers, one after the other)
+
+    size_t layerBytes(unsigned level) const;        ///< Bytes per layer in a given mip level
+};
+
+/*
+*   @brief Get the cooked version of a set of images. If the cache directory has a cooked file for the same sources (same
+*   file contents, size and format), it is loaded. Otherwise, images are decoded (in parallel), resampled to size x size,
+*   mip-mapped (2x2 box filter), optionally compressed, and the result is saved in the cache.
+*   @param files Source images (one per layer)
+*   @param cacheDirectory Directory where cooked files are kept
+*   @param size Side of the layers (power of two)
+*   @param compress Compress to DXT1
+*   @param result Cooked textures
+*   @return False if some source image couldn't be loaded
+*/
+bool cookTextureArray(const std::vector<std::string> &files, const std::string &cacheDirectory, unsigned size, bool compress, cookedTextures &result);
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef TEXTURELOADER_HPP
+#define TEXTURELOADER_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "textureCook.hpp"
+
+/**
+ * @brief Loads textures in the background. Images are decoded (or cooked, for texture arrays) by a pool of threads, and
+ * the decoded pixels are uploaded in the GL thread by uploadFinished(), as each one becomes ready.
+ *
+ * Each requested texture is a placeholder (1x1 texture) until its data is uploaded. Then, the placeholder is deleted and
+ * the texture identifier passed in the request is replaced by the real texture's, so that variable must outlive the loader
+ * (or until isDone()).
+ *
+ * The constructor, the requests and uploadFinished() must be called from the thread that owns the GL context.
+ */
+class textureLoader
+{
+    struct loadJob
+    {
+        unsigned* texture;                  ///< Where the texture identifier is stored
+        std::string name;                   ///< For the report
+
+        // Request
+        bool isArray;
+        std::vector<std::string> files;     ///< One file (2D texture) or the layers (texture array)
+        int internalFormat;                 ///< 2D texture: GL_RGB, GL_RGBA
+        std::string cacheDirectory;         ///< Texture array: see cookTextureArray()
+        unsigned size;
+        bool compress;
+
+        // Result
+        bool ok;
+        unsigned char* pixels;              ///< 2D texture (stbi_image_free)
+        int width, height, numberChannels;
+        cookedTextures cooked;              ///< Texture array
+        double decodeTime;                  ///< Milliseconds
+    };
+
+    struct timing
+    {
+        std::string name;
+        double decodeTime;                  ///< Milliseconds spent decoding (worker thread)
+        double uploadTime;                  ///< Milliseconds spent uploading (GL thread)
+        double readyTime;                   ///< Milliseconds since the loader was created until the texture was uploaded
+        bool   ok;
+    };
+
+    std::vector<std::thread> workers;
+    std::deque<loadJob*> pendingJobs;       ///< Waiting for a worker
+    std::deque<loadJob*> finishedJobs;      ///< Waiting for being uploaded
+    std::mutex mut;
+    std::condition_variable cond;
+    bool stopWorkers;
+    unsigned numRequested;
+    unsigned numUploaded;
+
+    std::vector<timing> timings;
+    std::chrono::steady_clock::time_point start;
+
+    void workerLoop();
+    void request(loadJob *job);
+
+public:
+    /*
+    *   @brief Constructor
+    *   @param numThreads Number of worker threads (0: all the hardware threads)
+    */
+    textureLoader(unsigned numThreads = 0);
+    ~textureLoader();
+    textureLoader(const textureLoader&) = delete;
+    textureLoader& operator = (const textureLoader&) = delete;
+
+    /*
+    *   @brief Request a 2D texture from a file. The texture is a 1x1 placeholder until it is uploaded.
+    *   @param texture Receives the texture identifier (placeholder now, the real texture later)
+    *   @param fileAddress Address of the file containing the texture
+    *   @param internalFormat Format of the texture in the GPU. Options: GL_RGB, GL_RGBA
+    */
+    void loadTexture2D(unsigned &texture, const std::string &fileAddress, int internalFormat);
+
+    /*
+    *   @brief Request a texture array cooked from a set of images (see cookTextureArray()). Layers are 1x1 placeholders until it is uploaded.
+    *   @param texture Receives the texture identifier (placeholder now, the real texture later)
+    */
+    void loadTextureArray(unsigned &texture, const std::vector<std::string> &files, const std::string &cacheDirectory, unsigned size, bool compress);
+
+    /*
+    *   @brief Upload the textures whose decoding has finished (call it once per frame)
+    *   @return Number of textures uploaded
+    */
+    unsigned uploadFinished();
+
+    bool isDone();                          ///< True if all the requested textures have been uploaded
+    void printTimings() const;              ///< Print the decode and upload time of each texture
+};
+
+#endif
@@ -3,6 +3,20 @@
 
 #include <chrono>
 #include <thread>
+#include <vector>
+
+/// Statistics of the frame times in the window of timerSet (milliseconds, except low1FPS)
+struct frameTimeStats
+{
+    double mean     = 0;
+    double p50      = 0;            ///< Median
+    double p95      = 0;
+    double p99      = 0;
+    double max      = 0;
+    double low1FPS  = 0;            ///< 1% low: FPS computed with the mean of the slowest 1% of the frames
+    size_t hitches  = 0;            ///< Frames longer than hitchFactor * p50
+    size_t numFrames = 0;           ///< Frames in the window
+};
 
 /**
  * @brief Tracks time and gives time information
@@ -12,40 +26,81 @@
  *  <li>Starts time counting</li>
  *  <li>Computes time between two points in time</li>
  *  <li>Computes fps (frames per second)</li>
- *  <li>Sets a maximum fps (uses sleeps)</li>
+ *  <li>Sets a maximum fps (sleeps until shortly before the deadline, then spins until it)</li>
  *  <li>Counts number of frames</li>
+ *  <li>Keeps the last frame times (rolling window) and computes their statistics (percentiles, hitches, 1% low)</li>
  * </ul>
+ *
+ * Uses steady_clock (monotonic). A single sleep_for() overshoots by ~0.1-2 ms on Linux (timer slack, scheduler), so the
+ * last spinMargin before the deadline is busy-waited.
  */
 class timerSet
 {
-    std::chrono::high_resolution_clock::time_point timeZero;    ///< Initial time
-    std::chrono::high_resolution_clock::time_point lastTime;    ///< Last registered time. Updated in computeDeltaTime()
+    typedef std::chrono::steady_clock clock;
+
+    clock::time_point timeZero;                                 ///< Initial time
+    clock::time_point lastTime;                                 ///< Last registered time. Updated in computeDeltaTime()
     long double lastTimeSeconds;                                ///< lastTime value in seconds
-    long double deltaTime;                                      ///< Difference between the last two frames. Updated in computeDeltaTime()
+    long double deltaTime;                                      ///< Difference (seconds) between the last two frames. Updated in computeDeltaTime()
+    long double workTime;                                       ///< Part of deltaTime (seconds) before waiting for the FPS limit
 
-    int FPS;                                                    ///< Frames Per Second. Updated int computeDeltaTime()
+    int FPS;                                                    ///< Frames Per Second (counted over the last ~0.5 s). Updated in computeDeltaTime()
     int maxFPS;                                                 ///< Maximum number of fps
+    clock::duration spinMargin;                                 ///< Time before the deadline that is busy-waited instead of slept
+    float hitchFactor;                                          ///< A frame is a hitch if it's longer than hitchFactor * p50
 
     size_t frameCounter;
+    size_t fpsFrames;                                           ///< Frames since fpsStart
+    clock::time_point fpsStart;
+
+    std::vector<float> frameTimes;                              ///< Rolling window of frame times (ms). Circular buffer.
+    size_t windowPos;                                           ///< Next position to write in frameTimes
+    size_t windowCount;                                         ///< Valid values in frameTimes
+    frameTimeStats stats;
+    bool statsDirty;                                            ///< A frame was added since the last computeStats()
+
+    void waitUntil(clock::time_point deadline);                 ///< Sleep, then spin, until the deadline
+    void computeStats();
 
 public:
     /// Constructor.
-    /** @param maxFPS Set a maximum number of fps (tracked by calls to getDeltaTime()). If maxFPS==0 (by default), no minimum fps is set. */
-    timerSet(int maxFPS = 0);
+    /** @param maxFPS Set a maximum number of fps (tracked by calls to getDeltaTime()). If maxFPS==0 (by default), no minimum fps is set.
+     *  @param windowSize Number of frame times kept for the statistics */
+    timerSet(int maxFPS = 0, size_t windowSize = 1000);
 
     void        startTime();            ///< Set starting time for the chronometer (timeZero)
     void        computeDeltaTime();     ///< Compute frame's duration (time between two calls to this method)
     void        printTimeData();        ///< Print relevant member variables
 
     long double getDeltaTime();         ///< Returns time (seconds) increment between frames (deltaTime)
+    long double getWorkTime();          ///< Returns time (seconds) of the last frame before waiting for the FPS limit
     long double getTime();              ///< Returns time (seconds) when computeDeltaTime() was called
     long double getTimeNow();           ///< Returns time (seconds) since timeZero, at the moment of calling GetTimeNow()
-    int         getFPS();               ///< Get fps (member variable)
+    int         getFPS();               ///< Get fps (frames counted over the last ~0.5 s)
+    int         getMaxFPS();
     size_t      getFrameCounter();      ///< Get frame number (depends on the number of times getDeltaTime() was called)
 
     /// Given a maximum fps, put thread to sleep to get it.
     /** @param fps Set a maximum number of fps (tracked by calls to getDeltaTime()). If maxFPS==0 (by default), no minimum fps is set. */
     void        setMaxFPS(int fps);
+    void        setSpinMargin(double milliseconds);     ///< Time busy-waited before each deadline (default: 1.5 ms). 0: sleep only.
+    void        setHitchFactor(float factor);           ///< A frame is a hitch if it's longer than factor * p50 (default: 2)
+
+    const frameTimeStats& getStats();   ///< Statistics of the frame times in the window (computed when requested)
+
+    /*
+    *   @brief Get the frame times in the window, from the oldest to the newest
+    *   @param times Receives the frame times (ms)
+    */
+    void getFrameTimes(std::vector<float> &times) const;
+
+    /*
+    *   @brief Get a histogram of the frame times in the window
+    *   @param counts Receives the number of frames per bin (the last bin includes all the frames >= maxTime)
+    *   @param binWidth Width of each bin (ms)
+    *   @param maxTime Upper limit of the histogram (ms)
+    */
+    void getHistogram(std::vector<float> &counts, float binWidth, float maxTime) const;
 };
 
 
@@ -0,0 +1,111 @@
+#ifndef UPLOAD_HPP
+#define UPLOAD_HPP
+
+#ifdef IMGUI_IMPL_OPENGL_LOADER_GLEW
+#include "GL/glew.h"
+#elif IMGUI_IMPL_OPENGL_LOADER_GLAD
+#include "glad/glad.h"
+#endif
+
+#include <vector>
+#include <deque>
+
+/// Region of staging memory returned by uploadRing::allocate(). Pass it to uploadRing::submit() once it has been written.
+struct uploadTicket
+{
+    unsigned staging = 0;       ///< Index of the staging buffer in the ring
+    size_t   offset  = 0;       ///< Offset (bytes) of the region inside the staging buffer
+    size_t   size    = 0;       ///< Size (bytes) of the region
+    void*    data    = nullptr; ///< CPU pointer to the mapped region (write here)
+};
+
+/**
+ * @brief Streams data to GPU buffers through a ring of staging buffers.
+ *
+ * Data is written into mapped staging memory (allocate()), and the copies to the destination buffers (submit()) are issued
+ * later by flush(), without exceeding a per-frame byte budget. Staging buffers are persistently mapped when glBufferStorage
+ * (ARB_buffer_storage, GL 4.4) is available. Otherwise, each one is orphaned and mapped with glMapBufferRange when it starts
+ * being filled, and unmapped before its copies are issued. A fence is inserted after the last copy from a staging buffer,
+ * so it is not reused until the GPU has read it.
+ *
+ * allocate(), submit(), flush() and discard() must be called from the thread that owns the GL context. The pointer returned
+ * by allocate() can be written from any thread, as long as the write finishes before submit() is called.
+ */
+class uploadRing
+{
+    enum stagingState { stagingFree, stagingFilling, stagingRetired };
+
+    struct stagingBuffer
+    {
+        unsigned     buffer;    ///< GL buffer name
+        char*        mapped;    ///< Mapped memory (nullptr if not mapped)
+        size_t       head;      ///< Bytes already allocated
+        unsigned     inFlight;  ///< Copies submitted but not issued yet
+        GLsync       fence;     ///< Signaled when the GPU has finished reading this buffer
+        stagingState state;
+    };
+
+    struct pendingCopy
+    {
+        unsigned staging;       ///< Source staging buffer
+        size_t   srcOffset;
+        unsigned dstBuffer;
+        size_t   dstOffset;
+        size_t   size;
+    };
+
+    std::vector<stagingBuffer> ring;
+    std::deque<pendingCopy>    pending;
+    unsigned current;           ///< Staging buffer being filled
+    size_t   bufferSize;        ///< Size (bytes) of each staging buffer
+    bool     persistent;        ///< True if staging buffers are persistently mapped
+
+    bool acquire(stagingBuffer &sb);
+    void retire(stagingBuffer &sb);
+    void unmap(stagingBuffer &sb);
+
+public:
+    /*
+    *   @brief Constructor. Requires a current GL context.
+    *   @param bufferSize Size (bytes) of each staging buffer. Bigger allocations are rejected.
+    *   @param numBuffers Number of staging buffers in the ring
+    *   @param frameBudget Maximum number of bytes copied per call to flush() (at least one copy is always issued)
+    */
+    uploadRing(size_t bufferSize = 4 * 1024 * 1024, unsigned numBuffers = 3, size_t frameBudget = 2 * 1024 * 1024);
+    ~uploadRing();
+    uploadRing(const uploadRing&) = delete;
+    uploadRing& operator = (const uploadRing&) = delete;
+
+    size_t frameBudget;         ///< Maximum number of bytes copied per flush()
+
+    /*
+    *   @brief Reserve a region of staging memory
+    *   @param size Number of bytes
+    *   @param ticket Filled with the region data (ticket.data is where the data must be written)
+    *   @return False if there is no staging memory available right now (try again in the next frame)
+    */
+    bool allocate(size_t size, uploadTicket &ticket);
+
+    /*
+    *   @brief Queue a copy from a region of staging memory to a destination buffer
+    *   @param ticket Region got from allocate()
+    *   @param srcOffset Offset (bytes) inside the region
+    *   @param size Number of bytes to copy
+    *   @param dstBuffer Destination buffer (must have enough storage already)
+    *   @param dstOffset Offset (bytes) in the destination buffer
+    */
+    void submit(const uploadTicket &ticket, size_t srcOffset, size_t size, unsigned dstBuffer, size_t dstOffset = 0);
+
+    /// Copy data to a destination buffer through the ring (allocate() + memcpy + submit()). Returns false if there is no staging memory available.
+    bool upload(unsigned dstBuffer, const void* data, size_t size, size_t dstOffset = 0);
+
+    void flush();                               ///< Issue pending copies (up to frameBudget bytes). Call it once per frame, before drawing.
+    void discard(unsigned dstBuffer);           ///< Forget pending copies to a buffer (call it before deleting the buffer)
+    bool isPending(unsigned dstBuffer) const;   ///< True if some copy to this buffer has not been issued yet
+    bool isPending(unsigned dstBuffer, size_t dstOffset, size_t size) const;    ///< True if some copy to this region of a buffer has not been issued yet
+    size_t pendingBytes() const;                ///< Number of bytes waiting to be copied
+    size_t pendingCopies() const;               ///< Number of copies waiting to be issued
+    bool isPersistent() const;                  ///< True if staging buffers are persistently mapped (ARB_buffer_storage)
+};
+
+#endif
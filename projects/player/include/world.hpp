@@ -4,12 +4,16 @@
 #include <iostream>
 #include <cmath>
 #include <map>
+#include <set>
+#include <vector>
+#include <chrono>
 
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtc/type_ptr.hpp"
 
 #include "geometry.hpp"
+#include "chunkStore.hpp"
 
 /// Bidimensional index (x, y) that satisfies the "Compare" set of requirements for its use in std::map.
 class BinaryKey
@@ -42,25 +46,82 @@ class terrainChunks
     //std::vector<std::vector<terrainChunk>> chunk;
     //std::vector<std::vector<glm::vec2>> chunkName;
 
+    std::string storeDirectory;                                             ///< Directory of the chunk store files (empty: store disabled)
+
+    bool loadChunk(const BinaryKey &key, terrainGenerator &generator);      ///< Get a full resolution chunk from the store. False if it is not stored.
+    void generateChunk(const BinaryKey &key, terrainGenerator &generator);  ///< Compute a full resolution chunk from noise, and queue it for the store
+    void reopenStore();
+    bool raycast(glm::vec3 origin, glm::vec3 direction, float maxDist, float &distance, const BinaryKey &minKey, const BinaryKey &maxKey) const;
+    void getKeyRange(BinaryKey &minKey, BinaryKey &maxKey) const;           ///< Smallest and biggest x and y of the keys in chunkDict
+
 public:
     noiseSet noise;             ///< Noise generator
     float    maxViewDist;       ///< Maximum view distance from viewer
+    float    fogRadius;         ///< Distance from the viewer where everything is completely fogged (0: no fog). Chunks farther than this are not generated.
     float    chunkSize;         ///< Size of each chunk (meters)
     int      chunksVisible;     ///< Number of chunkSizes for reaching maxViewDist
     int      vertexPerSide;     ///< Number of vertex per chunk's side
+    float    frameBudget;       ///< Maximum time (ms) spent per frame generating chunks and staging them for upload (one budget for both, see terrainBackend::update()). If 0, there is no limit.
+    float    verticalScale;     ///< Scale for the heights of all the chunks, applied in the model matrix (multiplier edits don't recompute chunks)
+    bool     cacheOctaves;      ///< Keep the noise of each octave in new chunks (memory: numOctaves floats per vertex). Octave count and persistance edits then evaluate only the new octaves.
+    size_t   chunksGenerated;   ///< Full resolution chunks generated from noise so far (placeholders excluded)
+    size_t   chunksLoaded;      ///< Chunks loaded from the chunk store so far
 
     std::map<BinaryKey, terrainGenerator> chunkDict;    ///< Collection of all the chunks (as a dictionary)
+    std::vector<BinaryKey> pendingChunks;               ///< Chunks in range still showing a placeholder (nearest first). They are generated in the next frames.
+    std::set<BinaryKey> placeholders;                   ///< Chunks in chunkDict that are still a low resolution placeholder (their resolution can't tell: vertexPerSide may equal the placeholders')
+    std::vector<BinaryKey> refreshedChunks;             ///< Chunks whose data changed after being created (the renderer must upload them again). Cleared by the renderer.
+    chunkStore store;                                   ///< Chunks persisted on disk for the current world (see openStore())
 
-    terrainChunks(noiseSet noise, float maxViewDist, float chunkSize, unsigned vertexPerSide);
+    terrainChunks(noiseSet noise, float maxViewDist, float chunkSize, unsigned vertexPerSide, float frameBudget = 2);
     ~terrainChunks();
 
     int getNumVertex();
     int getNumIndices();
     int getMaxViewDist();
+    float getGenerationRadius() const;      ///< Chunks whose nearest point (XY plane) is farther than this from the viewer are not generated: min(maxViewDist, fogRadius)
+    float getSquareDistance(const BinaryKey &key, glm::vec2 point) const;  ///< Squared distance (XY plane) from some point to the nearest point of a chunk
 
+    /*
+    *   @brief Delete chunks out of range and create the new ones in range. If frameBudget > 0, new chunks get a low resolution placeholder, and pending chunks (nearest first) are generated until frameBudget is used up.
+    *   @param viewerPos Viewer position
+    */
     void updateVisibleChunks(glm::vec3 viewerPos);
     void updateTerrainParameters(noiseSet noise, float maxViewDist, float chunkSize, unsigned vertexPerSide);
     void setNoise(noiseSet newNoise);
+
+    /*
+    *   @brief Change the noise reusing the noise cached in the chunks. Multiplier changes only update verticalScale. Curve degree changes recompute heights and normals from the raw noise of each chunk. If cacheOctaves is set, number of octaves and persistance changes evaluate only the new octaves (chunks without octave cache are deleted, so they are generated again). Changed chunks are added to refreshedChunks.
+    *   @return False if the noise changed in some other way (use setNoise() and regenerate the chunks)
+    */
+    bool reshapeNoise(noiseSet newNoise);
+    size_t getOctaveCacheBytes() const;     ///< Memory used by the per-octave cache of all the chunks
+
+    /*
+    *   @brief Get the terrain height at many points. Points inside loaded chunks are interpolated from the chunk's vertex (exactly the rendered triangles, including placeholders). Points elsewhere are computed from noise. Queries are sorted by chunk, so each chunk is looked up once. verticalScale is applied.
+    *   @param pts XY coordinates of each point
+    *   @param n Number of points
+    *   @param out Array where the n heights are stored
+    */
+    void queryHeights(const glm::vec2* pts, size_t n, float* out);
+    BinaryKey getChunkKey(float x, float y) const;  ///< Key of the chunk that contains some point
+
+    /*
+    *   @brief Cast a ray against the loaded chunks. The chunk grid is traversed (DDA) from the origin, and each chunk crossed is tested with its min/max quadtree (terrainGenerator::raycast()). verticalScale is applied.
+    *   @param origin Ray origin
+    *   @param direction Ray direction
+    *   @param maxDist Maximum distance tested
+    *   @param distance Distance from origin to the hit, if any
+    *   @return True if the ray hits the terrain before maxDist
+    */
+    bool raycast(glm::vec3 origin, glm::vec3 direction, float maxDist, float &distance) const;
+
+    /// Cast many rays (see raycast()). distances[i] is the distance to the hit of ray i, or -1 if it doesn't hit the terrain before maxDist.
+    void raycastMany(const glm::vec3* origins, const glm::vec3* directions, size_t n, float maxDist, float* distances) const;
+
+    /// Enable the on-disk chunk store. Chunks are looked up there before generating them, and new chunks are appended in the background. The store file is switched whenever the noise, chunkSize or vertexPerSide change.
+    void openStore(const std::string &directory);
+    bool budgetUsed(std::chrono::steady_clock::time_point startTime) const;    ///< True if more than frameBudget ms have passed since startTime
 };
 
 #endif
@@ -0,0 +1,20 @@
+// BOX (chunk bounding boxes drawn inside occlusion queries; used with depth.fs)
+
+#version 330 core
+
+layout (location = 0) in vec3 aPos;     // Unit cube
+
+layout (std140) uniform Camera      // Shared by all the programs (updated once per frame)
+{
+    mat4 view;
+    mat4 projection;
+    vec3 camPos;
+};
+
+uniform vec3 boxMin;
+uniform vec3 boxSize;
+
+void main()
+{
+    gl_Position = projection * view * vec4(boxMin + aPos * boxSize, 1.0f);
+}
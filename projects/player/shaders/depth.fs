@@ -0,0 +1,7 @@
+// DEPTH (only the depth buffer is written: terrain depth pre-pass, occlusion boxes)
+
+#version 330 core
+
+void main()
+{
+}
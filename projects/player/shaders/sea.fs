@@ -10,27 +10,47 @@ out vec4 FragColor;
 
 struct Light
 {
-    int lightType;
+    int lightType;      //   0: directional   1: point   2: spot
     vec3 position;
     vec3 direction;
 
     vec3 ambient;
     vec3 diffuse;
     vec3 specular;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    float cutOff;
+    float outerCutOff;
 };
 
 struct Material
 {
-    sampler2D diffuseT;
-    sampler2D specularT;
     vec3 diffuse;
     vec3 specular;
     float shininess;
 };
 
-uniform Material water;
-uniform Light sun;
-uniform vec3 viewPos;
+layout (std140) uniform Camera      // Shared by all the programs (updated once per frame)
+{
+    mat4 view;
+    mat4 projection;
+    vec3 camPos;
+};
+
+layout (std140) uniform Lighting    // Shared by all the programs (updated once per frame)
+{
+    Light sun;
+
+    Material grass;
+    Material rock;
+    Material snow;
+    Material sand;
+    Material plainSand;
+    Material water;
+};
 
 void main()
 {
@@ -45,7 +65,7 @@ void main()
     vec3 diffuse = sun.diffuse * (diff * water.diffuse);
 
     // specular
-    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 viewDir = normalize(camPos - FragPos);
     vec3 reflectDir = reflect(-lightDir, norm);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), water.shininess);
     vec3 specular = sun.specular * (spec * water.specular);
@@ -6,9 +6,14 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec4 aColor;
 layout (location = 2) in vec3 aNormal;
 
+layout (std140) uniform Camera      // Shared by all the programs (updated once per frame)
+{
+    mat4 view;
+    mat4 projection;
+    vec3 camPos;
+};
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 uniform mat3 normalMatrix;
 
 out vec4 ourColor;
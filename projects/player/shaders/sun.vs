@@ -7,9 +7,14 @@ layout (location = 1) in vec2 aTexCoord;
 
 out vec2 TexCoord;
 
+layout (std140) uniform Camera      // Shared by all the programs (updated once per frame)
+{
+    mat4 view;
+    mat4 projection;
+    vec3 camPos;
+};
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 void main()
 {
@@ -2,11 +2,21 @@
 
 #version 330 core
 
+// Variants (defines inserted by the application, see shaderVariants):
+//     Light type: LIGHT_DIRECTIONAL (default), LIGHT_POINT, LIGHT_SPOT
+//     Biome:      BIOME_DESERT (default), BIOME_GRASSROCK
+//     FOG:        Apply fog
+//     OVERDRAW:   Output a flat color, to be blended additively (overdraw visualization)
+//     LIGHT_PER_MATERIAL: Light each material and blend the results (previous shading, kept for benchmarking).
+//                         Otherwise, material inputs are blended with the splat weights (computed on the CPU, see
+//                         terrainGenerator::computeSplat()) and the lighting is computed once.
+
 out vec4 FragColor;
 
 in vec2 TexCoord;
 in vec3 Normal;
 in vec3 FragPos;
+in vec4 Splat;          // Material weights: grass, rock, snow, sand (plainSand = 1 - sum)
 //in vec3 ourColor;
 
 struct Light
@@ -29,40 +39,94 @@ struct Light
 
 struct Material
 {
-    sampler2D diffuseT;
     vec3 diffuse;
-    sampler2D specularT;
     vec3 specular;
     float shininess;
 };
 
-uniform Light sun;
+layout (std140) uniform Camera      // Shared by all the programs (updated once per frame)
+{
+    mat4 view;
+    mat4 projection;
+    vec3 camPos;
+};
 
-uniform Material grass;
-uniform Material rock;
-uniform Material snow;
-uniform Material sand;
-uniform Material plainSand;
+layout (std140) uniform Lighting    // Shared by all the programs (updated once per frame)
+{
+    Light sun;
+
+    Material grass;
+    Material rock;
+    Material snow;
+    Material sand;
+    Material plainSand;
+    Material water;
+};
+
+uniform sampler2DArray materialMaps;    // Diffuse and specular maps of each material (consecutive layers)
+
+const int grassMaps     = 0;
+const int rockMaps      = 2;
+const int sandMaps      = 4;
+const int plainSandMaps = 6;
+
+struct MaterialSample       // Inputs of the lighting for a fragment
+{
+    vec3 diffuse;
+    vec3 specular;
+    float shininess;
+};
 
 uniform vec4 skyColor;
 uniform float fogMaxSquareRadius;
 uniform float fogMinSquareRadius;
 
-uniform vec3 camPos;
-
 vec4 getTerrainTexture_GrassRock( vec4 fragment );
 vec4 getTerrainTexture_Desert( vec4 fragment );
+MaterialSample getMaterial_GrassRock();
+MaterialSample getMaterial_Desert();
+vec4 getFragColor( Light light, vec3 diffuseMap, vec3 specularMap, float shininess, float alpha );
 vec4 applyFog( vec4 fragment );
+vec3 diffuseMap( int maps, vec2 coords );
+vec3 specularMap( int maps, vec2 coords );
 
 
 void main()
 {
-    vec4 result;
+#ifdef OVERDRAW
+    FragColor = vec4(0.1, 0.05, 0.02, 1.0);
+    return;
+#endif
+
+#ifdef FOG
+    vec3 toCamera = FragPos - camPos;
+    if(dot(toCamera, toCamera) > fogMaxSquareRadius)
+    {
+        FragColor = skyColor;       // Completely fogged: no texture sampling nor lighting
+        return;
+    }
+#endif
 
-    //result = getTerrainTexture_GrassRock(result);
-    result = getTerrainTexture_Desert(result);
+    vec4 result;
 
+#if defined(LIGHT_PER_MATERIAL)
+    #if defined(BIOME_GRASSROCK)
+        result = getTerrainTexture_GrassRock(result);
+    #else
+        result = getTerrainTexture_Desert(result);
+    #endif
+#else
+    #if defined(BIOME_GRASSROCK)
+        MaterialSample material = getMaterial_GrassRock();
+    #else
+        MaterialSample material = getMaterial_Desert();
+    #endif
+    result = getFragColor( sun, material.diffuse, material.specular, material.shininess, 1.0 );
+#endif
+
+#ifdef FOG
     result = applyFog(result);
+#endif
 
     FragColor = result;
 }
@@ -73,15 +137,60 @@ vec4 PointLightColor      ( Light light, vec3 diffuseMap, vec3 specularMap, floa
 vec4 SpotLightColor       ( Light light, vec3 diffuseMap, vec3 specularMap, float shininess, float alpha );
 
 
-// Apply the lighting type you want to a fragment
+// Apply the lighting type of this variant to a fragment
 vec4 getFragColor( Light light, vec3 diffuseMap, vec3 specularMap, float shininess, float alpha )
 {
-    if(light.lightType == 0) return DirectionalLightColor( light, diffuseMap, specularMap, shininess, alpha );
-    if(light.lightType == 1) return PointLightColor      ( light, diffuseMap, specularMap, shininess, alpha );
-    if(light.lightType == 2) return SpotLightColor       ( light, diffuseMap, specularMap, shininess, alpha );
+#if defined(LIGHT_POINT)
+    return PointLightColor      ( light, diffuseMap, specularMap, shininess, alpha );
+#elif defined(LIGHT_SPOT)
+    return SpotLightColor       ( light, diffuseMap, specularMap, shininess, alpha );
+#else
+    return DirectionalLightColor( light, diffuseMap, specularMap, shininess, alpha );
+#endif
+}
+
+
+// Sample the maps of a material
+MaterialSample sampleMaterial( int maps, float shininess, vec2 coords )
+{
+    return MaterialSample( diffuseMap(maps, coords), specularMap(maps, coords), shininess );
+}
+
+
+// Get the material inputs for the given fragment (sand-plainSand splat weights)
+MaterialSample getMaterial_Desert()
+{
+    float dtf = 30;                       // sand texture factor
+    float ptf = 30;                       // plainSand texture factor
+
+    MaterialSample sandMaterial  = sampleMaterial( sandMaps, sand.shininess, TexCoord/dtf );
+    MaterialSample plainMaterial = sampleMaterial( plainSandMaps, plainSand.shininess, TexCoord/ptf );
+
+    float w = Splat.a;
+    return MaterialSample( sandMaterial.diffuse   * w + plainMaterial.diffuse   * (1 - w),
+                           sandMaterial.specular  * w + plainMaterial.specular  * (1 - w),
+                           sandMaterial.shininess * w + plainMaterial.shininess * (1 - w) );
 }
 
 
+// Get the material inputs for the given fragment (grass-rock-snow splat weights)
+MaterialSample getMaterial_GrassRock()
+{
+    float rtf = 30;                       // rock texture factor
+    float gtf = 20;                       // grass texture factor
+
+    MaterialSample grassMaterial = sampleMaterial( grassMaps, grass.shininess, TexCoord/gtf );
+    MaterialSample rockMaterial  = sampleMaterial( rockMaps, rock.shininess, TexCoord/rtf );
+
+    vec3 w = Splat.rgb;
+    return MaterialSample( grassMaterial.diffuse   * w.r + rockMaterial.diffuse   * w.g + snow.diffuse   * w.b,
+                           grassMaterial.specular  * w.r + rockMaterial.specular  * w.g + snow.specular  * w.b,
+                           grassMaterial.shininess * w.r + rockMaterial.shininess * w.g + snow.shininess * w.b );
+}
+
+
+#ifdef LIGHT_PER_MATERIAL
+
 // Get the texture for the given fragment (depends upon the slope and lighting)
 vec4 getTerrainTexture_Desert( vec4 fragment)
 {
@@ -94,17 +203,17 @@ vec4 getTerrainTexture_Desert( vec4 fragment)
 
     // >>> DESERT
     if (slope < slopeThreshold - mixRange)
-        fragment = getFragColor( sun, vec3(texture(sand.diffuseT, TexCoord/dtf)), vec3(texture(sand.specularT, TexCoord/dtf)), sand.shininess, 1.0);
+        fragment = getFragColor( sun, diffuseMap(sandMaps, TexCoord/dtf), specularMap(sandMaps, TexCoord/dtf), sand.shininess, 1.0);
 
     // >>> PLAIN
     else if(slope > slopeThreshold + mixRange)
-        fragment = getFragColor( sun, vec3(texture(plainSand.diffuseT, TexCoord/ptf)), vec3(texture(plainSand.specularT, TexCoord/ptf)), plainSand.shininess, 1.0);
+        fragment = getFragColor( sun, diffuseMap(plainSandMaps, TexCoord/ptf), specularMap(plainSandMaps, TexCoord/ptf), plainSand.shininess, 1.0);
 
     // >>> MIXTURE (DESERT + PLAIN)
     else if(slope >= slopeThreshold - mixRange && slope <= slopeThreshold + mixRange)
     {
-        vec4 plainFrag  = getFragColor( sun, vec3(texture(plainSand.diffuseT, TexCoord/dtf)), vec3(texture(plainSand.specularT, TexCoord/dtf)), plainSand.shininess, 1.0 );
-        vec4 sandFrag = getFragColor( sun, vec3(texture(sand.diffuseT, TexCoord/ptf)), vec3(texture(sand.specularT, TexCoord/ptf)), sand.shininess, 1.0 );
+        vec4 plainFrag  = getFragColor( sun, diffuseMap(plainSandMaps, TexCoord/dtf), specularMap(plainSandMaps, TexCoord/dtf), plainSand.shininess, 1.0 );
+        vec4 sandFrag = getFragColor( sun, diffuseMap(sandMaps, TexCoord/ptf), specularMap(sandMaps, TexCoord/ptf), sand.shininess, 1.0 );
 
         float ratio    = (slope - (slopeThreshold - mixRange)) / (2 * mixRange);
         vec3 mixGround = plainFrag.xyz * ratio + sandFrag.xyz * (1-ratio);
@@ -141,8 +250,8 @@ vec4 getTerrainTexture_GrassRock( vec4 fragment )
         // >>> MIXTURE (SNOW + GRASS + ROCK)
         if(slope > (snowSlope - mixSnowRange) && slope < snowSlope)
         {
-            vec4 rockFrag  = getFragColor( sun, vec3(texture(rock.diffuseT, TexCoord/rtf)), vec3(texture(rock.specularT, TexCoord/rtf)), rock.shininess, 1.0 );
-            vec4 grassFrag = getFragColor( sun, vec3(texture(grass.diffuseT, TexCoord/gtf)), vec3(texture(grass.specularT, TexCoord/gtf)), grass.shininess, 1.0 );
+            vec4 rockFrag  = getFragColor( sun, diffuseMap(rockMaps, TexCoord/rtf), specularMap(rockMaps, TexCoord/rtf), rock.shininess, 1.0 );
+            vec4 grassFrag = getFragColor( sun, diffuseMap(grassMaps, TexCoord/gtf), specularMap(grassMaps, TexCoord/gtf), grass.shininess, 1.0 );
             float ratio    = (slope - (slopeThreshold - mixRange)) / (2 * mixRange);
             if(ratio < 0) ratio = 0;
             else if(ratio > 1) ratio = 1;
@@ -160,17 +269,17 @@ vec4 getTerrainTexture_GrassRock( vec4 fragment )
 
     // >>> GRASS
     else if (slope < slopeThreshold - mixRange)
-        fragment = getFragColor( sun, vec3(texture(grass.diffuseT, TexCoord/gtf)), vec3(texture(grass.specularT, TexCoord/gtf)), grass.shininess, 1.0 );
+        fragment = getFragColor( sun, diffuseMap(grassMaps, TexCoord/gtf), specularMap(grassMaps, TexCoord/gtf), grass.shininess, 1.0 );
 
     // >>> ROCK
     else if(slope > slopeThreshold + mixRange)
-        fragment = getFragColor( sun, vec3(texture(rock.diffuseT, TexCoord/rtf)), vec3(texture(rock.specularT, TexCoord/rtf)), rock.shininess, 1.0 );
+        fragment = getFragColor( sun, diffuseMap(rockMaps, TexCoord/rtf), specularMap(rockMaps, TexCoord/rtf), rock.shininess, 1.0 );
 
     // >>> MIXTURE (GRASS + ROCK)
     else if(slope >= slopeThreshold - mixRange && slope <= slopeThreshold + mixRange)
     {
-        vec4 rockFrag  = getFragColor( sun, vec3(texture(rock.diffuseT, TexCoord/rtf)), vec3(texture(rock.specularT, TexCoord/rtf)), rock.shininess, 1.0 );
-        vec4 grassFrag = getFragColor( sun, vec3(texture(grass.diffuseT, TexCoord/gtf)), vec3(texture(grass.specularT, TexCoord/gtf)), grass.shininess, 1.0 );
+        vec4 rockFrag  = getFragColor( sun, diffuseMap(rockMaps, TexCoord/rtf), specularMap(rockMaps, TexCoord/rtf), rock.shininess, 1.0 );
+        vec4 grassFrag = getFragColor( sun, diffuseMap(grassMaps, TexCoord/gtf), specularMap(grassMaps, TexCoord/gtf), grass.shininess, 1.0 );
 
         float ratio    = (slope - (slopeThreshold - mixRange)) / (2 * mixRange);
         vec3 mixGround = rockFrag.xyz * ratio + grassFrag.xyz * (1-ratio);
@@ -182,6 +291,14 @@ vec4 getTerrainTexture_GrassRock( vec4 fragment )
 }
 
 
+#endif
+
+
+// Sample the diffuse/specular map of a material (maps: first layer of the material in materialMaps)
+vec3 diffuseMap( int maps, vec2 coords )  { return vec3(texture(materialMaps, vec3(coords, maps))); }
+vec3 specularMap( int maps, vec2 coords ) { return vec3(texture(materialMaps, vec3(coords, maps + 1))); }
+
+
 // Apply fog (skyColor) to a fragment
 vec4 applyFog(vec4 fragment)
 {
@@ -189,12 +306,9 @@ vec4 applyFog(vec4 fragment)
                            (FragPos.y - camPos.y) * (FragPos.y - camPos.y) +
                            (FragPos.z - camPos.z) * (FragPos.z - camPos.z);
 
-    if(squareDistance > fogMinSquareRadius)
-        if(squareDistance > fogMaxSquareRadius)
-            fragment = skyColor;
-        else
+    if(squareDistance > fogMinSquareRadius)     // Fragments beyond fogMaxSquareRadius got skyColor at the start of main()
     {
-        float ratio  = (squareDistance - fogMinSquareRadius) / (fogMaxSquareRadius - fogMinSquareRadius);
+        float ratio  = min((squareDistance - fogMinSquareRadius) / (fogMaxSquareRadius - fogMinSquareRadius), 1.0);
         fragment = vec4(fragment.xyz * (1-ratio) + skyColor.xyz * ratio, fragment.a);
     }
 
@@ -278,50 +392,3 @@ vec4 SpotLightColor( Light light, vec3 diffuseMap, vec3 specularMap, float shini
     // ----- Result -----
     return vec4(vec3(ambient + diffuse + specular), alpha);
 }
-
-
-vec4 getFragColor_allInOne( Light light, vec3 diffuseMap, vec3 specularMap, float shininess, float alpha )
-{
-    float attenuation;
-    if(light.lightType != 0)
-    {
-        float distance = length(light.position - FragPos);
-        attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * distance * distance);
-    }
-
-    // ----- Ambient lighting -----
-    vec3 ambient = light.ambient * diffuseMap;
-    if(light.lightType != 0) ambient *= attenuation;
-
-    // ----- Diffuse lighting -----
-    vec3 lightDir;
-    float intensity;
-    if     (light.lightType == 0) lightDir = normalize(light.direction);            // directional light
-    else if(light.lightType == 1) lightDir = normalize(light.position - FragPos);   // point light
-    else if(light.lightType == 2)                                                   // spot light
-    {
-        lightDir = normalize(light.position - FragPos);
-        float theta = dot(lightDir, normalize(light.direction));
-        if(theta < light.outerCutOff)
-            return vec4(ambient, 1.0);
-        float epsilon = light.cutOff - light.outerCutOff;
-        intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
-    }
-
-    vec3 norm = normalize(Normal);
-    float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = light.diffuse * diff * diffuseMap;
-    if(light.lightType == 1) diffuse *= attenuation;
-    if(light.lightType == 2) diffuse *= attenuation * intensity;
-
-    // ----- Specular lighting -----
-    vec3 viewDir = normalize(camPos - FragPos);
-    vec3 reflectDir = reflect(-lightDir, norm);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
-    vec3 specular = light.specular * spec * specularMap;
-    if(light.lightType == 1) specular *= attenuation;
-    if(light.lightType == 2) specular *= attenuation * intensity;
-
-    // ----- Result -----
-    return vec4(vec3(ambient + diffuse + specular), alpha);
-}
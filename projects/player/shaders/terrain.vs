@@ -2,27 +2,53 @@
 
 #version 330 core
 
+#ifdef INSTANCED
+layout (location = 4) in int aFirstVertex;  // First vertex of the chunk (per instance). Vertex data is read from texture buffers (see instancedBackend).
+uniform samplerBuffer vertexData;           // 2 texels per vertex: (position, u), (v, normal)
+uniform samplerBuffer splatData;
+#else
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTexCoord;
 layout (location = 2) in vec3 aNormal;
+layout (location = 3) in vec4 aSplat;       // Material weights (grass, rock, snow, sand; plainSand = 1 - sum), computed on the CPU
+#endif
 //layout (location = 1) in vec3 aColor;
 
 out vec2 TexCoord;
 out vec3 Normal;
 out vec3 FragPos;
+out vec4 Splat;
 //out vec3 ourColor;
 
+layout (std140) uniform Camera      // Shared by all the programs (updated once per frame)
+{
+    mat4 view;
+    mat4 projection;
+    vec3 camPos;
+};
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 uniform mat3 normalMatrix;
 
+invariant gl_Position;      // Same depth in the depth pre-pass (depth.fs) and in the color pass (GL_LEQUAL)
+
 void main()
 {
+#ifdef INSTANCED
+    int  vertex    = aFirstVertex + gl_VertexID;
+    vec4 texel0    = texelFetch(vertexData, 2 * vertex);
+    vec4 texel1    = texelFetch(vertexData, 2 * vertex + 1);
+    vec3 aPos      = texel0.xyz;
+    vec2 aTexCoord = vec2(texel0.w, texel1.x);
+    vec3 aNormal   = texel1.yzw;
+    vec4 aSplat    = texelFetch(splatData, vertex);
+#endif
+
     gl_Position = projection * view * model * vec4(aPos, 1.0f);
 
     FragPos = vec3(model * vec4(aPos, 1.0));
     //ourColor = aColor;
     TexCoord = aTexCoord;
     Normal = normalMatrix * aNormal;      // normalMatrix = mat3(transpose(inverse(model)))
+    Splat = aSplat;
 }
@@ -70,6 +70,14 @@ void Camera::ProcessMouseScroll(float yoffset)
         fov = FOV;
 }
 
+void Camera::SetPose(glm::vec3 position, float yaw, float pitch)
+{
+    Position = position;
+    Yaw      = yaw;
+    Pitch    = pitch;
+    updateCameraVectors();
+}
+
 void Camera::updateCameraVectors()
 {
     glm::vec3 front;
@@ -1,5 +1,7 @@
 
 #include <iostream>
+#include <vector>
+#include <algorithm>
 
 #ifdef IMGUI_IMPL_OPENGL_LOADER_GLEW
 #include "GL/glew.h"
@@ -10,6 +12,11 @@
 #include "stb_image.h"
 
 #include "canvas.hpp"
+#include "textureCook.hpp"
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0     // GL_EXT_texture_compression_s3tc (not in the core profile)
+#endif
 
 unsigned int createVAO()
 {
@@ -141,14 +148,40 @@ void configVAO(unsigned VAO, unsigned VBO, unsigned EBO, int *sizes, unsigned nu
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);   // unbind EBO
 }
 
+void configByteAttrib(unsigned VAO, unsigned VBO, unsigned location, size_t offset, bool bindVAO)
+{
+    if(bindVAO) glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+
+    glVertexAttribPointer(location, 4, GL_UNSIGNED_BYTE, GL_TRUE, 4, (void *)offset);
+    glEnableVertexAttribArray(location);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    if(bindVAO) glBindVertexArray(0);
+}
+
 unsigned createTexture2D(const char *fileAddress, int internalFormat)
 {
     stbi_set_flip_vertically_on_load(true);
 
+    int width, height, numberChannels;
+    unsigned char *image = stbi_load(fileAddress, &width, &height, &numberChannels, 0);
+
+    if(!image) std::cout << "Failed to load texture" << std::endl;
+    unsigned texture = createTexture2D(image, width, height, numberChannels, internalFormat);
+
+    stbi_image_free(image);
+
+    return texture;
+}
+
+unsigned createTexture2D(const unsigned char *pixels, int width, int height, int numberChannels, int internalFormat)
+{
     unsigned texture;
 
     glGenTextures(1, &texture);
     glBindTexture(GL_TEXTURE_2D, texture);
+    resetTextureBinds();
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);       // Texture wrapping
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);               // GL_REPEAT  GL_MIRRORED_REPEAT  GL_CLAMP_TO_EDGE  GL_CLAMP_TO_BORDER
@@ -156,23 +189,113 @@ unsigned createTexture2D(const char *fileAddress, int internalFormat)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);   // Texture filtering (?)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);           // GL_LINEAR  GL_NEAREST
 
-    int width, height, numberChannels;
-    unsigned char *image = stbi_load(fileAddress, &width, &height, &numberChannels, 0);
-
-    if(image)
+    if(pixels)
     {
-        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, (numberChannels == 4? GL_RGBA : GL_RGB), GL_UNSIGNED_BYTE, image);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, (numberChannels == 4? GL_RGBA : GL_RGB), GL_UNSIGNED_BYTE, pixels);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
         glGenerateMipmap(GL_TEXTURE_2D);
     }
-    else std::cout << "Failed to load texture" << std::endl;
 
-    stbi_image_free(image);
+    return texture;
+}
+
+unsigned createTextureArray(const cookedTextures &cooked)
+{
+    unsigned texture;
+
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, cooked.numLevels - 1);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);      // RGB8 rows of the smallest levels aren't 4-byte aligned
+
+    for(unsigned level = 0; level < cooked.numLevels; level++)
+    {
+        int side = std::max(1u, cooked.size >> level);
+        if(cooked.compressed)
+            glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, side, side, cooked.numLayers, 0, cooked.levels[level].size(), cooked.levels[level].data());
+        else
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGB8, side, side, cooked.numLayers, 0, GL_RGB, GL_UNSIGNED_BYTE, cooked.levels[level].data());
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    resetTextureBinds();
 
     return texture;
 }
 
+bool isS3TCSupported()
+{
+    int numFormats = 0;
+    glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &numFormats);
 
+    std::vector<int> formats(numFormats);
+    if(numFormats) glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, formats.data());
 
+    for(int format : formats)
+        if(format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) return true;
 
+    return false;
+}
+
+unsigned createUBO(unsigned long num_bytes, unsigned bindingPoint)
+{
+    unsigned UBO;
+    glGenBuffers(1, &UBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+    glBufferData(GL_UNIFORM_BUFFER, num_bytes, nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, UBO);
+    return UBO;
+}
+
+void updateUBO(unsigned UBO, unsigned long num_bytes, const void* pointerToData)
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, num_bytes, pointerToData);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
 
+// Texture bindings tracker ---------------
 
+#define TRACKED_TEXTURE_UNITS 16
+
+static unsigned bound2D[TRACKED_TEXTURE_UNITS];         // GL_TEXTURE_2D bound to each unit (~0u: unknown)
+static unsigned boundArray[TRACKED_TEXTURE_UNITS];      // GL_TEXTURE_2D_ARRAY bound to each unit (~0u: unknown)
+static unsigned activeUnit = ~0u;                       // Active texture unit (~0u: unknown)
+static bool     trackerReady = false;
+
+static void bindTracked(unsigned unit, GLenum target, unsigned texture, unsigned *bound)
+{
+    if(!trackerReady) resetTextureBinds();
+
+    if(unit < TRACKED_TEXTURE_UNITS && bound[unit] == texture) return;
+
+    if(activeUnit != unit)
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        activeUnit = unit;
+    }
+    glBindTexture(target, texture);
+
+    if(unit < TRACKED_TEXTURE_UNITS) bound[unit] = texture;
+}
+
+void bindTexture2D(unsigned unit, unsigned texture) { bindTracked(unit, GL_TEXTURE_2D, texture, bound2D); }
+
+void bindTextureArray(unsigned unit, unsigned texture) { bindTracked(unit, GL_TEXTURE_2D_ARRAY, texture, boundArray); }
+
+void resetTextureBinds()
+{
+    for(unsigned i = 0; i < TRACKED_TEXTURE_UNITS; i++) bound2D[i] = boundArray[i] = ~0u;
+    activeUnit   = ~0u;
+    trackerReady = true;
+}
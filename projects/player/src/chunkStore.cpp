@@ -0,0 +1,212 @@
+#include <iostream>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define CHUNKSTORE_MMAP 1
+#endif
+
+#include "chunkStore.hpp"
+#include "world.hpp"
+
+#define CHUNKSTORE_VERSION 1
+
+// chunkStore -----------------------------------------------------------------
+
+chunkStore::chunkStore()
+    : fd(-1), mapping(nullptr), mappingSize(0), recordSize(0), header(nullptr), entries(nullptr), records(nullptr), stopWriter(false) { }
+
+chunkStore::~chunkStore() { close(); }
+
+bool chunkStore::open(const std::string &directory, uint64_t fingerprint, float chunkSize, unsigned vertexPerSide, unsigned capacity)
+{
+    close();
+
+#ifdef CHUNKSTORE_MMAP
+    std::ostringstream fileName;
+    fileName << directory << "world_" << std::hex << std::setw(16) << std::setfill('0') << fingerprint << std::dec
+             << "_" << chunkSize << "_" << vertexPerSide << ".chunks";
+
+    mkdir(directory.c_str(), 0755);
+    fd = ::open(fileName.str().c_str(), O_RDWR | O_CREAT, 0644);
+    if(fd < 0)
+    {
+        std::cout << "Chunk store: cannot open " << fileName.str() << std::endl;
+        return false;
+    }
+
+    // Check whether the existing file belongs to this world
+    storeHeader fileHeader;
+    bool valid = pread(fd, &fileHeader, sizeof(storeHeader), 0) == sizeof(storeHeader) &&
+                 std::memcmp(fileHeader.magic, "CHUNKSTR", 8) == 0 &&
+                 fileHeader.version         == CHUNKSTORE_VERSION &&
+                 fileHeader.vertexPerSide   == vertexPerSide &&
+                 fileHeader.chunkSize       == chunkSize &&
+                 fileHeader.floatsPerVertex == 8 &&
+                 fileHeader.fingerprint     == fingerprint;
+
+    recordSize = sizeof(float) * vertexPerSide * vertexPerSide * 8;
+
+    if(valid)       // A truncated file (partially written) may keep a valid header, but accessing the missing records raises SIGBUS
+    {
+        struct stat fileStat;
+        size_t fileSize = sizeof(storeHeader) + (size_t)fileHeader.capacity * sizeof(storeIndexEntry) + (size_t)fileHeader.capacity * recordSize;
+        valid = fstat(fd, &fileStat) == 0 && (size_t)fileStat.st_size >= fileSize && fileHeader.count <= fileHeader.capacity;
+    }
+
+    if(valid) capacity = fileHeader.capacity;
+    mappingSize = sizeof(storeHeader) + capacity * sizeof(storeIndexEntry) + capacity * recordSize;
+
+    if(!valid)      // Create a new (sparse) file
+    {
+        std::memset(&fileHeader, 0, sizeof(storeHeader));
+        std::memcpy(fileHeader.magic, "CHUNKSTR", 8);
+        fileHeader.version         = CHUNKSTORE_VERSION;
+        fileHeader.vertexPerSide   = vertexPerSide;
+        fileHeader.chunkSize       = chunkSize;
+        fileHeader.floatsPerVertex = 8;
+        fileHeader.fingerprint     = fingerprint;
+        fileHeader.capacity        = capacity;
+        fileHeader.count           = 0;
+
+        if(ftruncate(fd, 0) || ftruncate(fd, mappingSize) || pwrite(fd, &fileHeader, sizeof(storeHeader), 0) != sizeof(storeHeader))
+        {
+            std::cout << "Chunk store: cannot create " << fileName.str() << std::endl;
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+    }
+
+    void* ptr = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(ptr == MAP_FAILED)
+    {
+        std::cout << "Chunk store: cannot map " << fileName.str() << std::endl;
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    mapping = (char*)ptr;
+    header  = (storeHeader*)mapping;
+    entries = (storeIndexEntry*)(mapping + sizeof(storeHeader));
+    records = mapping + sizeof(storeHeader) + capacity * sizeof(storeIndexEntry);
+
+    // Build the index
+    for(uint32_t i = 0; i < header->count; ++i)
+        index[std::make_pair(entries[i].x, entries[i].y)] = i;
+
+    stopWriter = false;
+    writer = std::thread(&chunkStore::writerLoop, this);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void chunkStore::close()
+{
+    if(writer.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mut);
+            stopWriter = true;
+        }
+        cond.notify_one();
+        writer.join();
+    }
+
+#ifdef CHUNKSTORE_MMAP
+    if(mapping) munmap(mapping, mappingSize);
+    if(fd >= 0) ::close(fd);
+#endif
+
+    fd       = -1;
+    mapping  = nullptr;
+    header   = nullptr;
+    entries  = nullptr;
+    records  = nullptr;
+    index.clear();
+    queued.clear();
+    jobs.clear();
+}
+
+bool chunkStore::isOpen() const { return mapping != nullptr; }
+
+const float* chunkStore::find(const BinaryKey &key)
+{
+    if(!mapping) return nullptr;
+
+    std::lock_guard<std::mutex> lock(mut);
+    std::map<std::pair<int, int>, uint32_t>::const_iterator it = index.find(std::make_pair(key.x, key.y));
+    if(it == index.end()) return nullptr;
+
+    return (const float*)(records + it->second * recordSize);
+}
+
+void chunkStore::save(const BinaryKey &key, const float (*vertex)[8])
+{
+    if(!mapping) return;
+
+    std::pair<int, int> k(key.x, key.y);
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        if(index.count(k) || queued.count(k) || index.size() + queued.size() >= header->capacity) return;
+        queued.insert(k);
+    }
+
+    writeJob job;
+    job.x = key.x;
+    job.y = key.y;
+    job.data.assign(&vertex[0][0], &vertex[0][0] + recordSize / sizeof(float));
+
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        jobs.push_back(std::move(job));
+    }
+    cond.notify_one();
+}
+
+void chunkStore::writerLoop()
+{
+    std::unique_lock<std::mutex> lock(mut);
+
+    while(true)
+    {
+        cond.wait(lock, [this]{ return stopWriter || !jobs.empty(); });
+        if(jobs.empty()) break;                                         // stopWriter and nothing left to write
+
+        writeJob job = std::move(jobs.front());
+        jobs.pop_front();
+        uint32_t slot = header->count;
+        lock.unlock();
+
+        // Record first, then its index entry, then the count (a record is visible only when complete)
+        std::memcpy(records + slot * recordSize, job.data.data(), recordSize);
+        entries[slot].x = job.x;
+        entries[slot].y = job.y;
+
+        lock.lock();
+        header->count = slot + 1;
+        std::pair<int, int> k(job.x, job.y);
+        queued.erase(k);
+        index[k] = slot;
+    }
+}
+
+size_t chunkStore::getNumStored()
+{
+    std::lock_guard<std::mutex> lock(mut);
+    return index.size();
+}
+
+size_t chunkStore::getNumQueued()
+{
+    std::lock_guard<std::mutex> lock(mut);
+    return queued.size();
+}
@@ -0,0 +1,121 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <atomic>
+
+#include "cpuProfiler.hpp"
+
+namespace
+{
+    thread_local uint32_t zoneDepth = 0;    // Zones open in this thread
+}
+
+// cpuProfiler -----------------------------------------------------------------
+
+cpuProfiler::cpuProfiler()
+    : lastFrameStart(0), lastFrameEnd(0), frame(0), frameThread(0), timeZero(std::chrono::steady_clock::now()), windowFrames(300)
+{
+    frameStarts.push_back(0);
+}
+
+cpuProfiler& cpuProfiler::get()
+{
+    static cpuProfiler profiler;
+    return profiler;
+}
+
+int64_t cpuProfiler::now() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - timeZero).count();
+}
+
+uint32_t cpuProfiler::threadId()
+{
+    static std::atomic<uint32_t> numThreads(0);
+    thread_local uint32_t id = numThreads++;
+    return id;
+}
+
+void cpuProfiler::record(const char* name, int64_t start, int64_t end, uint32_t depth)
+{
+    uint32_t thread = threadId();
+
+    std::lock_guard<std::mutex> lock(mut);
+    events.push_back( { name, start, end, thread, depth, frame } );
+}
+
+void cpuProfiler::beginFrame()
+{
+    int64_t time = now();
+    uint32_t thread = threadId();
+
+    std::lock_guard<std::mutex> lock(mut);
+    frameThread = thread;
+
+    // Last frame
+    lastFrame.clear();
+    for(std::deque<cpuZoneEvent>::const_reverse_iterator it = events.rbegin(); it != events.rend() && it->frame == frame; ++it)
+        lastFrame.push_back(*it);
+    std::sort(lastFrame.begin(), lastFrame.end(), [](const cpuZoneEvent &a, const cpuZoneEvent &b) { return a.start < b.start; });
+
+    lastFrameStart = frameStarts.back();
+    lastFrameEnd   = time;
+
+    // New frame. Frames out of the window are dropped.
+    frame++;
+    frameStarts.push_back(time);
+
+    while(frameStarts.size() > windowFrames) frameStarts.pop_front();
+    while(!events.empty() && events.front().frame + windowFrames <= frame) events.pop_front();
+}
+
+void cpuProfiler::getLastFrame(std::vector<cpuZoneEvent> &zones, int64_t &start, int64_t &end)
+{
+    std::lock_guard<std::mutex> lock(mut);
+
+    zones = lastFrame;
+    start = lastFrameStart;
+    end   = lastFrameEnd;
+}
+
+bool cpuProfiler::exportChromeTrace(const std::string &file)
+{
+    std::ofstream output(file);
+    if(!output.is_open())
+    {
+        std::cout << "CPU profiler: cannot write " << file << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mut);
+
+    // Complete events ("ph":"X"). Times in microseconds.
+    output << std::fixed << std::setprecision(3);
+    output << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    output << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << frameThread << ",\"args\":{\"name\":\"Render loop\"}}";
+
+    for(size_t i = 1; i < frameStarts.size(); i++)
+        output << ",\n{\"name\":\"Frame\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":" << frameThread << ",\"ts\":" << frameStarts[i - 1] / 1000.0
+               << ",\"dur\":" << (frameStarts[i] - frameStarts[i - 1]) / 1000.0 << "}";
+
+    for(const cpuZoneEvent &zone : events)
+        output << ",\n{\"name\":\"" << zone.name << "\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":" << zone.thread
+               << ",\"ts\":" << zone.start / 1000.0 << ",\"dur\":" << (zone.end - zone.start) / 1000.0 << "}";
+
+    output << "\n]}\n";
+
+    std::cout << "CPU profiler: " << events.size() << " zones (" << frameStarts.size() << " frames) saved in " << file << std::endl;
+    return true;
+}
+
+// cpuZone -----------------------------------------------------------------
+
+cpuZone::cpuZone(const char* name)
+    : name(name), start(cpuProfiler::get().now()), depth(zoneDepth++) { }
+
+cpuZone::~cpuZone()
+{
+    zoneDepth--;
+    cpuProfiler::get().record(name, start, cpuProfiler::get().now(), depth);
+}
@@ -0,0 +1,165 @@
+#include <algorithm>
+
+#include "drawList.hpp"
+#include "cpuProfiler.hpp"
+
+// drawListBuilder -----------------------------------------------------------------
+
+drawListBuilder::drawListBuilder(unsigned numThreads, unsigned tileSize)
+    : stopWorkers(false), generation(0), workersDone(0), snapshot(nullptr), backend(nullptr), cull(true), sort(true),
+      numTiles(0), nextTile(0), numCulled(0), tileSize(tileSize)
+{
+    if(numThreads == 0) numThreads = std::min(7u, std::max(1u, std::thread::hardware_concurrency()) - 1);
+    for(unsigned i = 0; i < numThreads; i++)
+        workers.push_back(std::thread(&drawListBuilder::workerLoop, this));
+}
+
+drawListBuilder::~drawListBuilder()
+{
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        stopWorkers = true;
+    }
+    cond.notify_all();
+    for(std::thread &worker : workers) worker.join();
+}
+
+unsigned drawListBuilder::getNumThreads() const { return workers.size() + 1; }
+
+size_t drawListBuilder::getNumCulled() const { return numCulled; }
+
+void drawListBuilder::workerLoop()
+{
+    unsigned lastGeneration = 0;
+
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mut);
+            cond.wait(lock, [&]() { return stopWorkers || generation != lastGeneration; });
+            if(stopWorkers) return;
+            lastGeneration = generation;
+        }
+
+        buildTiles();
+
+        std::lock_guard<std::mutex> lock(mut);
+        if(++workersDone == workers.size()) doneCond.notify_one();
+    }
+}
+
+void drawListBuilder::build(const frameSnapshot &snapshot, const terrainBackend &backend, bool frustumCulling, bool sortFrontToBack, std::vector<chunkDrawCall> &drawList)
+{
+    PROFILE_ZONE("Build draw list");
+
+    // View frustum planes (Gribb & Hartmann), from the rows of projection * view
+    glm::mat4 m = glm::transpose(snapshot.projection * snapshot.view);
+    planes[0] = m[3] + m[0];    // Left
+    planes[1] = m[3] - m[0];    // Right
+    planes[2] = m[3] + m[1];    // Bottom
+    planes[3] = m[3] - m[1];    // Top
+    planes[4] = m[3] + m[2];    // Near
+    planes[5] = m[3] - m[2];    // Far
+
+    size_t tileChunks = std::max(1u, tileSize);
+    numTiles = (snapshot.chunks.size() + tileChunks - 1) / tileChunks;
+    if(tiles.size() < numTiles) tiles.resize(numTiles);
+
+    // Run the tiles (workers and this thread). Workers are idle here (the previous build waited for all of them).
+    bool parallel = (numTiles > 1 && !workers.empty());
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        this->snapshot = &snapshot;
+        this->backend  = &backend;
+        cull           = frustumCulling;
+        sort           = sortFrontToBack;
+        nextTile       = 0;
+        numCulled      = 0;
+        if(parallel)
+        {
+            workersDone = 0;
+            generation++;
+        }
+    }
+    if(parallel) cond.notify_all();
+
+    buildTiles();
+
+    if(parallel)
+    {
+        std::unique_lock<std::mutex> lock(mut);
+        doneCond.wait(lock, [this]() { return workersDone == workers.size(); });      // Workers that woke up late find no tiles left
+    }
+
+    // Concatenate the tiles, merging the sorted ones pairwise (they are sorted by distance inside)
+    drawList.clear();
+    std::vector<size_t> bounds(1, 0);       // Start of each tile in drawList
+    for(size_t i = 0; i < numTiles; i++)
+    {
+        drawList.insert(drawList.end(), tiles[i].begin(), tiles[i].end());
+        bounds.push_back(drawList.size());
+    }
+
+    if(!sortFrontToBack) return;
+
+    auto closer = [](const chunkDrawCall &a, const chunkDrawCall &b) { return a.squareDistance < b.squareDistance; };
+    for(size_t step = 1; step < numTiles; step *= 2)
+        for(size_t i = 0; i + step < numTiles; i += 2 * step)
+            std::inplace_merge(drawList.begin() + bounds[i], drawList.begin() + bounds[i + step],
+                               drawList.begin() + bounds[std::min(i + 2 * step, numTiles)], closer);
+}
+
+void drawListBuilder::buildTiles()
+{
+    for(size_t tile = nextTile++; tile < numTiles; tile = nextTile++)
+        buildTile(tile);
+}
+
+void drawListBuilder::buildTile(size_t tile)
+{
+    std::vector<chunkDrawCall> &commands = tiles[tile];
+    commands.clear();
+
+    size_t first = tile * std::max(1u, tileSize), end = std::min(first + std::max(1u, tileSize), snapshot->chunks.size());
+    size_t culled = 0;
+
+    for(size_t i = first; i < end; i++)
+    {
+        const visibleChunk &chunk = snapshot->chunks[i];
+
+        if(cull && !insideFrustum(chunk.boxMin, chunk.boxMax))
+        {
+            culled++;
+            continue;
+        }
+
+        chunkDrawCall drawCall;
+        if(!backend->getDrawCall(chunk.key, drawCall))
+            continue;               // Data not in GPU yet
+
+        drawCall.squareDistance = chunk.squareDistance;
+        drawCall.chunk          = i;
+        commands.push_back(drawCall);
+    }
+
+    if(sort)
+        std::sort(commands.begin(), commands.end(), [](const chunkDrawCall &a, const chunkDrawCall &b) { return a.squareDistance < b.squareDistance; });
+
+    numCulled += culled;
+}
+
+bool drawListBuilder::insideFrustum(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const
+{
+    for(const glm::vec4 &plane : planes)
+    {
+        // Box corner farthest along the plane normal: if it's outside, the whole box is
+        glm::vec3 corner(plane.x >= 0 ? boxMax.x : boxMin.x,
+                         plane.y >= 0 ? boxMax.y : boxMin.y,
+                         plane.z >= 0 ? boxMax.z : boxMin.z);
+
+        if(glm::dot(glm::vec3(plane), corner) + plane.w < 0)
+            return false;
+    }
+
+    return true;
+}
@@ -1,8 +1,11 @@
 
 #include <iostream>
 #include <cmath>
+#include <cstring>
+#include <algorithm>
 
 #include "geometry.hpp"
+#include "cpuProfiler.hpp"
 
 /*
     Vertex data:
@@ -75,16 +78,16 @@ noiseSet::noiseSet( unsigned int NumOctaves,
     }
 
     // Get maximum noise
-    maxHeight = 0;
+    amplitudeSum = 0;
     float amplitude = 1;
 
     for(int i = 0; i < numOctaves; i++)
     {
-        maxHeight += 1 * amplitude;
+        amplitudeSum += 1 * amplitude;
         amplitude *= persistance;
     }
 
-    maxHeight *= scale * multiplier;
+    maxHeight = amplitudeSum * scale * multiplier;
 }
 
 noiseSet::~noiseSet()
@@ -107,6 +110,7 @@ noiseSet::noiseSet(const noiseSet& obj)
     seed        = obj.seed;
     
     maxHeight     = obj.maxHeight;
+    amplitudeSum  = obj.amplitudeSum;
 
     //delete[] octaveOffsets;
     octaveOffsets = new float[numOctaves][2];
@@ -132,6 +136,7 @@ noiseSet& noiseSet::operator = (const noiseSet& obj)
     seed        = obj.seed;
 
     maxHeight     = obj.maxHeight;
+    amplitudeSum  = obj.amplitudeSum;
 
     delete[] octaveOffsets;
     octaveOffsets = new float[numOctaves][2];
@@ -181,11 +186,16 @@ std::ostream& operator << (std::ostream& os, const noiseSet& obj)
 }
 
 float noiseSet::GetNoise(float X, float Y)
+{
+    return applyCurve(GetRawNoise(X, Y));
+}
+
+float noiseSet::GetRawNoise(float X, float Y)
 {
     float result = 0;
     float frequency = 1, amplitude = 1;
 
-    for(int i = 0; i < numOctaves; i++)
+    for(unsigned i = 0; i < numOctaves; i++)
     {
         X = (X / scale) * frequency + octaveOffsets[i][0];
         Y = (Y / scale) * frequency + octaveOffsets[i][1];
@@ -197,13 +207,75 @@ float noiseSet::GetNoise(float X, float Y)
         amplitude *= persistance;
     }
 
-    result = result * scale * multiplier;
-    result *= std::pow(result/maxHeight, curveDegree);
+    return result / amplitudeSum;
+}
+
+float noiseSet::GetOctaveNoise(float X, float Y, unsigned octave)
+{
+    float frequency = 1;
+
+    // Coordinates are chained through the previous octaves (same as in GetRawNoise())
+    for(unsigned i = 0; i <= octave; i++)
+    {
+        X = (X / scale) * frequency + octaveOffsets[i][0];
+        Y = (Y / scale) * frequency + octaveOffsets[i][1];
+
+        frequency *= lacunarity;
+    }
+
+    return (1 + noise.GetNoise(X, Y)) / 2;
+}
+
+float noiseSet::applyCurve(float rawNoise) const
+{
+    // (raw * maxHeight) * (raw * maxHeight / maxHeight)^curveDegree
+    return maxHeight * std::pow(rawNoise, curveDegree + 1);
+}
+
+float noiseSet::removeCurve(float height) const
+{
+    if(maxHeight <= 0) return 0;
+    return std::pow(height / maxHeight, 1.f / (curveDegree + 1));
+}
+
+bool noiseSet::sameRawNoise(const noiseSet& obj) const
+{
+    if( noiseType   != obj.noiseType ||
+        numOctaves  != obj.numOctaves ||
+        lacunarity  != obj.lacunarity ||
+        persistance != obj.persistance ||
+        scale       != obj.scale ||
+        offsetX     != obj.offsetX ||
+        offsetY     != obj.offsetY ||
+        seed        != obj.seed )
+        return false;
 
-    return result;
+    for(size_t i = 0; i < numOctaves; i++)
+        if(octaveOffsets[i][0] != obj.octaveOffsets[i][0] || octaveOffsets[i][1] != obj.octaveOffsets[i][1])
+            return false;
+
+    return true;
+}
+
+bool noiseSet::sameOctaves(const noiseSet& obj) const
+{
+    if( noiseType   != obj.noiseType ||
+        lacunarity  != obj.lacunarity ||
+        scale       != obj.scale ||
+        offsetX     != obj.offsetX ||
+        offsetY     != obj.offsetY ||
+        seed        != obj.seed )
+        return false;
+
+    for(size_t i = 0; i < std::min(numOctaves, obj.numOctaves); i++)
+        if(octaveOffsets[i][0] != obj.octaveOffsets[i][0] || octaveOffsets[i][1] != obj.octaveOffsets[i][1])
+            return false;
+
+    return true;
 }
 
 float        noiseSet::getMaxHeight()   const { return maxHeight; };
+float        noiseSet::getAmplitudeSum() const { return amplitudeSum; }
 
 unsigned     noiseSet::getNoiseType()   const { return noiseType; }
 unsigned     noiseSet::getNumOctaves()  const { return numOctaves; }
@@ -217,6 +289,32 @@ float        noiseSet::getOffsetY()     const { return offsetY; }
 unsigned int noiseSet::getSeed()        const { return seed; }
 float*       noiseSet::getOffsets()     const { return &octaveOffsets[0][0]; }
 
+uint64_t noiseSet::getFingerprint() const
+{
+    // FNV-1a hash
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](const void* data, size_t size)
+    {
+        for(size_t i = 0; i < size; i++)
+        {
+            hash ^= ((const unsigned char*)data)[i];
+            hash *= 1099511628211ull;
+        }
+    };
+
+    add(&noiseType,   sizeof(noiseType));
+    add(&numOctaves,  sizeof(numOctaves));
+    add(&lacunarity,  sizeof(lacunarity));
+    add(&persistance, sizeof(persistance));
+    add(&scale,       sizeof(scale));
+    add(&multiplier,  sizeof(multiplier));
+    add(&curveDegree, sizeof(curveDegree));
+    add(&seed,        sizeof(seed));
+    add(octaveOffsets, sizeof(float) * 2 * numOctaves);
+
+    return hash;
+}
+
 void noiseSet::noiseTester(size_t size)
 {
     float max = 0, min = 0;
@@ -247,12 +345,19 @@ terrainGenerator::terrainGenerator()
 
     vertex     = nullptr;
     indices    = nullptr;
+    splat      = nullptr;
+    rawNoise   = nullptr;
+    octaveNoise     = nullptr;
+    numOctavePlanes = 0;
 }
 
 terrainGenerator::~terrainGenerator()
 {
     if(vertex  != nullptr) delete[] vertex;
     if(indices != nullptr) delete[] indices;
+    if(splat   != nullptr) delete[] splat;
+    if(rawNoise != nullptr) delete[] rawNoise;
+    if(octaveNoise != nullptr) delete[] octaveNoise;
 }
 
 terrainGenerator& terrainGenerator::operator = (const terrainGenerator& obj)
@@ -274,10 +379,34 @@ terrainGenerator& terrainGenerator::operator = (const terrainGenerator& obj)
         for(unsigned j = 0; j < 3; ++j)
             indices[i][j] = obj.indices[i][j];
 
+    if(splat != nullptr) delete[] splat;
+    splat = new uint8_t[numVertex][4];
+    if(obj.splat != nullptr) std::memcpy(splat, obj.splat, sizeof(uint8_t) * numVertex * 4);
+    else                     std::memset(splat, 0, sizeof(uint8_t) * numVertex * 4);
+
+    if(rawNoise != nullptr) delete[] rawNoise;
+    rawNoise = nullptr;
+    if(obj.rawNoise != nullptr)
+    {
+        rawNoise = new float[(numVertexX + 2) * (numVertexY + 2)];
+        std::memcpy(rawNoise, obj.rawNoise, sizeof(float) * (numVertexX + 2) * (numVertexY + 2));
+    }
+
+    if(octaveNoise != nullptr) delete[] octaveNoise;
+    octaveNoise     = nullptr;
+    numOctavePlanes = obj.numOctavePlanes;
+    if(obj.octaveNoise != nullptr)
+    {
+        octaveNoise = new float[numOctavePlanes * (numVertexX + 2) * (numVertexY + 2)];
+        std::memcpy(octaveNoise, obj.octaveNoise, sizeof(float) * numOctavePlanes * (numVertexX + 2) * (numVertexY + 2));
+    }
+
+    heightBounds = obj.heightBounds;
+
     return *this;
 }
 
-void terrainGenerator::computeTerrain(noiseSet &noise, float x0, float y0, float stride, unsigned numVertexX, unsigned numVertexY, float textureFactor)
+void terrainGenerator::resize(unsigned numVertexX, unsigned numVertexY)
 {
     if (this->numVertexX != numVertexX || this->numVertexY != numVertexY)
     {
@@ -290,6 +419,33 @@ void terrainGenerator::computeTerrain(noiseSet &noise, float x0, float y0, float
         vertex = new float[numVertex][8];
         delete[] indices;
         indices = new unsigned int[numIndices/3][3];
+        delete[] splat;
+        splat = new uint8_t[numVertex][4];
+        std::memset(splat, 0, sizeof(uint8_t) * numVertex * 4);
+        delete[] rawNoise;
+        rawNoise = nullptr;
+        dropOctaves();
+    }
+}
+
+void terrainGenerator::computeTerrain(noiseSet &noise, float x0, float y0, float stride, unsigned numVertexX, unsigned numVertexY, float textureFactor, bool keepOctaves)
+{
+    PROFILE_ZONE("computeTerrain");
+    resize(numVertexX, numVertexY);
+    if(rawNoise == nullptr) rawNoise = new float[(numVertexX + 2) * (numVertexY + 2)];
+
+    // Raw noise (including the apron, used for the normals at the border)
+    dropOctaves();
+    if(keepOctaves)
+    {
+        computeOctaves(noise, x0, y0, stride);
+        combineOctaves(noise);
+    }
+    else
+    {
+        for (int y = -1; y <= (int)numVertexY; y++)
+            for (int x = -1; x <= (int)numVertexX; x++)
+                rawNoise[getApronPos(x, y)] = noise.GetRawNoise(x0 + x * stride, y0 + y * stride);
     }
 
     // Vertex data
@@ -301,7 +457,7 @@ void terrainGenerator::computeTerrain(noiseSet &noise, float x0, float y0, float
             // positions
             vertex[pos][0] = x0 + x * stride;
             vertex[pos][1] = y0 + y * stride;
-            vertex[pos][2] = noise.GetNoise((float)vertex[pos][0], (float)vertex[pos][1]);
+            vertex[pos][2] = noise.applyCurve(rawNoise[getApronPos(x, y)]);
 
             // textures
             vertex[pos][3] = vertex[pos][0] * textureFactor;
@@ -312,6 +468,385 @@ void terrainGenerator::computeTerrain(noiseSet &noise, float x0, float y0, float
     computeGridNormals(vertex, numVertexX, numVertexY, stride, noise);
 
     // Indices
+    computeIndices();
+    computeBounds();
+}
+
+void terrainGenerator::setTerrain(const float *vertexData, unsigned numVertexX, unsigned numVertexY)
+{
+    resize(numVertexX, numVertexY);
+
+    std::memcpy(&vertex[0][0], vertexData, sizeof(float) * numVertex * 8);
+
+    delete[] rawNoise;          // Recovered by reshape(), if needed
+    rawNoise = nullptr;
+    dropOctaves();
+
+    computeIndices();
+    computeBounds();
+}
+
+bool terrainGenerator::reshape(const noiseSet &oldNoise, noiseSet &newNoise)
+{
+    if(numVertexX < 2 || numVertexY < 2) return false;
+
+    float x0     = vertex[0][0];
+    float y0     = vertex[0][1];
+    float stride = vertex[1][0] - vertex[0][0];
+
+    // Octaves or persistance changed: compute only the missing octave planes and sum them again with the new weights
+    if(!oldNoise.sameRawNoise(newNoise))
+    {
+        if(octaveNoise == nullptr || !oldNoise.sameOctaves(newNoise)) return false;
+
+        computeOctaves(newNoise, x0, y0, stride);
+        combineOctaves(newNoise);
+    }
+
+    // Chunks not computed from noise (loaded from disk) recover the raw noise from their heights. Only the apron is sampled.
+    if(rawNoise == nullptr)
+    {
+        rawNoise = new float[(numVertexX + 2) * (numVertexY + 2)];
+
+        for (int y = -1; y <= (int)numVertexY; y++)
+            for (int x = -1; x <= (int)numVertexX; x++)
+            {
+                if(x < 0 || y < 0 || x == (int)numVertexX || y == (int)numVertexY)
+                    rawNoise[getApronPos(x, y)] = newNoise.GetRawNoise(x0 + x * stride, y0 + y * stride);
+                else
+                    rawNoise[getApronPos(x, y)] = oldNoise.removeCurve(vertex[getPos(x, y)][2]);
+            }
+    }
+
+    for (size_t y = 0; y < numVertexY; y++)
+        for (size_t x = 0; x < numVertexX; x++)
+            vertex[getPos(x, y)][2] = newNoise.applyCurve(rawNoise[getApronPos(x, y)]);
+
+    computeGridNormals(vertex, numVertexX, numVertexY, stride, newNoise);
+    computeBounds();
+    return true;
+}
+
+float terrainGenerator::getHeight(float x, float y) const
+{
+    float stride = vertex[1][0] - vertex[0][0];
+    float fx = (x - vertex[0][0]) / stride;
+    float fy = (y - vertex[0][1]) / stride;
+
+    // Square containing the point
+    int ix = std::floor(fx);
+    int iy = std::floor(fy);
+    if      (ix < 0) ix = 0;
+    else if (ix > (int)numVertexX - 2) ix = numVertexX - 2;
+    if      (iy < 0) iy = 0;
+    else if (iy > (int)numVertexY - 2) iy = numVertexY - 2;
+
+    fx = std::min(std::max(fx - ix, 0.f), 1.f);
+    fy = std::min(std::max(fy - iy, 0.f), 1.f);
+
+    /*
+        Each square has 2 triangles (see computeIndices()):
+
+            (D)------(C)
+             |     /  |
+             |   /    |
+             | /      |
+            (A)------(B)
+
+        ACD if fy > fx, ABC otherwise
+    */
+    size_t pos = getPos(ix, iy);
+    float A = vertex[pos][2];
+    float B = vertex[pos + 1][2];
+    float C = vertex[pos + numVertexX + 1][2];
+    float D = vertex[pos + numVertexX][2];
+
+    if(fy > fx) return A + fy * (D - A) + fx * (C - D);
+    else        return A + fx * (B - A) + fy * (C - B);
+}
+
+void terrainGenerator::computeSplat(terrainBiome biome, float verticalScale)
+{
+    // Rules (previously evaluated per fragment in terrain.fs). Slope: horizontal component of the normal (0: flat, 1: vertical).
+    const float grassRockSlope = 0.5f;      // grass-rock slope threshold
+    const float grassRockMix   = 0.05f;     // threshold mixing range (slope range)
+    const float maxSnowLevel   = 80;        // maximum snow height (up from here, there's only snow within the maxSnowSlope)
+    const float minSnowLevel   = 50;        // minimum snow height (down from here, there's zero snow)
+    const float maxSnowSlope   = 0.90f;     // maximum slope where snow can rest
+    const float snowMix        = 0.1f;      // snow threshold mixing range (slope range)
+    const float sandSlope      = 0.3f;      // sand-plainSand slope threshold
+    const float sandMix        = 0.1f;      // threshold mixing range (slope range)
+
+    for(size_t i = 0; i < numVertex; i++)
+    {
+        glm::vec3 normal(vertex[i][5], vertex[i][6], vertex[i][7] / verticalScale);     // Same as normalMatrix in the shader
+        float length = glm::length(normal);
+        float slope  = length > 0 ? std::sqrt(normal.x * normal.x + normal.y * normal.y) / length : 0;
+
+        if(biome == biomeDesert)
+        {
+            float plain = glm::clamp((slope - (sandSlope - sandMix)) / (2 * sandMix), 0.f, 1.f);
+
+            splat[i][0] = splat[i][1] = splat[i][2] = 0;
+            splat[i][3] = (uint8_t)std::round((1 - plain) * 255);
+        }
+        else
+        {
+            float snowSlope = std::min(maxSnowSlope * (vertex[i][2] * verticalScale - minSnowLevel) / (maxSnowLevel - minSnowLevel), maxSnowSlope);
+            float snow      = glm::clamp((snowSlope - slope) / snowMix, 0.f, 1.f);
+            float rock      = glm::clamp((slope - (grassRockSlope - grassRockMix)) / (2 * grassRockMix), 0.f, 1.f);
+
+            splat[i][0] = (uint8_t)std::round((1 - rock) * (1 - snow) * 255);
+            splat[i][2] = (uint8_t)std::round(snow * 255);
+            splat[i][1] = 255 - splat[i][0] - splat[i][2];          // Weights add up to 1
+            splat[i][3] = 0;
+        }
+    }
+}
+
+bool terrainGenerator::hasRawNoise() const { return rawNoise != nullptr; }
+
+void terrainGenerator::computeBounds()
+{
+    unsigned width  = numVertexX - 1;       // squares per side
+    unsigned height = numVertexY - 1;
+
+    heightBounds.clear();
+    heightBounds.push_back(std::vector<glm::vec2>(width * height));
+
+    // Level 0: one node per square
+    for (size_t y = 0; y < height; y++)
+        for (size_t x = 0; x < width; x++)
+        {
+            size_t pos = getPos(x, y);
+            float A = vertex[pos][2], B = vertex[pos + 1][2], C = vertex[pos + numVertexX + 1][2], D = vertex[pos + numVertexX][2];
+
+            heightBounds[0][y * width + x] = glm::vec2( std::min(std::min(A, B), std::min(C, D)),
+                                                        std::max(std::max(A, B), std::max(C, D)) );
+        }
+
+    // Next levels: merge 2x2 nodes
+    while (width > 1 || height > 1)
+    {
+        unsigned newWidth  = (width  + 1) / 2;
+        unsigned newHeight = (height + 1) / 2;
+        const std::vector<glm::vec2> &child = heightBounds.back();
+        std::vector<glm::vec2> parent(newWidth * newHeight, glm::vec2(INFINITY, -INFINITY));
+
+        for (size_t y = 0; y < height; y++)
+            for (size_t x = 0; x < width; x++)
+            {
+                glm::vec2 &node = parent[(y / 2) * newWidth + x / 2];
+                node.x = std::min(node.x, child[y * width + x].x);
+                node.y = std::max(node.y, child[y * width + x].y);
+            }
+
+        heightBounds.push_back(parent);
+        width  = newWidth;
+        height = newHeight;
+    }
+}
+
+glm::vec2 terrainGenerator::getHeightRange() const { return heightBounds.back()[0]; }
+
+// Slab test. Returns the ray segment [t0, t1] inside the box (clipped to the input t0 and t1).
+static bool rayBox(const glm::vec3 &origin, const glm::vec3 &invDirection, const glm::vec3 &boxMin, const glm::vec3 &boxMax, float &t0, float &t1)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        float tNear = (boxMin[i] - origin[i]) * invDirection[i];
+        float tFar  = (boxMax[i] - origin[i]) * invDirection[i];
+        if (tNear > tFar) std::swap(tNear, tFar);
+        if (tNear != tNear) tNear = -INFINITY;  // 0 * inf (ray parallel to the slab, and origin on its border)
+        if (tFar  != tFar ) tFar  =  INFINITY;
+
+        t0 = std::max(t0, tNear);
+        t1 = std::min(t1, tFar);
+        if (t0 > t1) return false;
+    }
+
+    return true;
+}
+
+bool terrainGenerator::raycast(const glm::vec3 &origin, const glm::vec3 &direction, float tMin, float tMax, float &t) const
+{
+    if (heightBounds.empty()) return false;
+
+    unsigned top = heightBounds.size() - 1;
+    return raycastNode(top, 0, 0, origin, direction, tMin, tMax, t);
+}
+
+bool terrainGenerator::raycastNode(unsigned level, unsigned nodeX, unsigned nodeY, const glm::vec3 &origin, const glm::vec3 &direction, float tMin, float tMax, float &t) const
+{
+    unsigned squaresX = numVertexX - 1;
+    unsigned squaresY = numVertexY - 1;
+    unsigned width    = (squaresX + (1u << level) - 1) >> level;
+    float    stride   = vertex[1][0] - vertex[0][0];
+
+    // Node box
+    unsigned x0 = nodeX << level, x1 = std::min((nodeX + 1) << level, squaresX);
+    unsigned y0 = nodeY << level, y1 = std::min((nodeY + 1) << level, squaresY);
+    const glm::vec2 &bounds = heightBounds[level][nodeY * width + nodeX];
+
+    glm::vec3 boxMin(vertex[0][0] + x0 * stride, vertex[0][1] + y0 * stride, bounds.x);
+    glm::vec3 boxMax(vertex[0][0] + x1 * stride, vertex[0][1] + y1 * stride, bounds.y);
+    glm::vec3 invDirection = 1.f / direction;
+
+    float t0 = tMin, t1 = tMax;
+    if (!rayBox(origin, invDirection, boxMin, boxMax, t0, t1)) return false;
+
+    if (level == 0)
+        return raycastSquare(nodeX, nodeY, origin, direction, tMin, tMax, t);
+
+    // Children, front to back (their boxes don't overlap in XY, so the first hit is the nearest one)
+    unsigned childWidth  = (squaresX + (1u << (level - 1)) - 1) >> (level - 1);
+    unsigned childHeight = (squaresY + (1u << (level - 1)) - 1) >> (level - 1);
+    unsigned children[4][2];
+    float    entry[4];
+    unsigned numChildren = 0;
+
+    for (unsigned j = 0; j < 2; j++)
+        for (unsigned i = 0; i < 2; i++)
+        {
+            unsigned cx = 2 * nodeX + i, cy = 2 * nodeY + j;
+            if (cx >= childWidth || cy >= childHeight) continue;
+
+            float ex = -INFINITY, ey = -INFINITY;    // Entry distance (approximate: enough for ordering). An axis the ray is parallel to doesn't constrain it (0 * inf would be NaN)
+            if (direction.x != 0)
+            {
+                float c0 = (vertex[0][0] + (cx << (level - 1)) * stride - origin.x) * invDirection.x;
+                float c2 = (vertex[0][0] + std::min((cx + 1) << (level - 1), squaresX) * stride - origin.x) * invDirection.x;
+                ex = std::min(c0, c2);
+            }
+            if (direction.y != 0)
+            {
+                float c1 = (vertex[0][1] + (cy << (level - 1)) * stride - origin.y) * invDirection.y;
+                float c3 = (vertex[0][1] + std::min((cy + 1) << (level - 1), squaresY) * stride - origin.y) * invDirection.y;
+                ey = std::min(c1, c3);
+            }
+            float e = std::max(ex, ey);
+
+            unsigned k = numChildren++;
+            while (k > 0 && entry[k - 1] > e)
+            {
+                entry[k] = entry[k - 1];
+                children[k][0] = children[k - 1][0];
+                children[k][1] = children[k - 1][1];
+                k--;
+            }
+            entry[k] = e;
+            children[k][0] = cx;
+            children[k][1] = cy;
+        }
+
+    for (unsigned k = 0; k < numChildren; k++)
+        if (raycastNode(level - 1, children[k][0], children[k][1], origin, direction, tMin, tMax, t))
+            return true;
+
+    return false;
+}
+
+bool terrainGenerator::raycastSquare(unsigned x, unsigned y, const glm::vec3 &origin, const glm::vec3 &direction, float tMin, float tMax, float &t) const
+{
+    size_t pos = getPos(x, y);
+    size_t triangles[2][3] = { { pos, pos + numVertexX + 1, pos + numVertexX },     // Same triangles as in computeIndices()
+                               { pos, pos + 1, pos + numVertexX + 1 } };
+    bool hit = false;
+
+    for (int i = 0; i < 2; i++)
+    {
+        // Möller-Trumbore
+        glm::vec3 A = getVertex(triangles[i][0]);
+        glm::vec3 edge1 = getVertex(triangles[i][1]) - A;
+        glm::vec3 edge2 = getVertex(triangles[i][2]) - A;
+
+        glm::vec3 p  = glm::cross(direction, edge2);
+        float det    = glm::dot(edge1, p);
+        if (std::fabs(det) < 1e-12f) continue;
+
+        float invDet = 1.f / det;
+        glm::vec3 s  = origin - A;
+        float u      = glm::dot(s, p) * invDet;
+        if (u < 0.f || u > 1.f) continue;
+
+        glm::vec3 q  = glm::cross(s, edge1);
+        float v      = glm::dot(direction, q) * invDet;
+        if (v < 0.f || u + v > 1.f) continue;
+
+        float tHit   = glm::dot(edge2, q) * invDet;
+        if (tHit < tMin || tHit > tMax) continue;
+
+        if (!hit || tHit < t) t = tHit;
+        hit = true;
+    }
+
+    return hit;
+}
+
+void terrainGenerator::computeOctaves(noiseSet &noise, float x0, float y0, float stride)
+{
+    unsigned numOctaves = noise.getNumOctaves();
+    if(numOctaves <= numOctavePlanes) return;
+
+    size_t planeSize = (numVertexX + 2) * (numVertexY + 2);
+
+    float *planes = new float[numOctaves * planeSize];
+    if(octaveNoise != nullptr)
+    {
+        std::memcpy(planes, octaveNoise, sizeof(float) * numOctavePlanes * planeSize);
+        delete[] octaveNoise;
+    }
+    octaveNoise = planes;
+
+    for (unsigned octave = numOctavePlanes; octave < numOctaves; octave++)
+    {
+        float *plane = &octaveNoise[octave * planeSize];
+
+        for (int y = -1; y <= (int)numVertexY; y++)
+            for (int x = -1; x <= (int)numVertexX; x++)
+                plane[getApronPos(x, y)] = noise.GetOctaveNoise(x0 + x * stride, y0 + y * stride, octave);
+    }
+
+    numOctavePlanes = numOctaves;
+}
+
+void terrainGenerator::combineOctaves(const noiseSet &noise)
+{
+    size_t planeSize = (numVertexX + 2) * (numVertexY + 2);
+    float amplitude  = 1;
+
+    // Same operations order as noiseSet::GetRawNoise()
+    for (size_t i = 0; i < planeSize; i++) rawNoise[i] = 0;
+
+    for (unsigned octave = 0; octave < noise.getNumOctaves(); octave++)
+    {
+        const float *plane = &octaveNoise[octave * planeSize];
+
+        for (size_t i = 0; i < planeSize; i++)
+            rawNoise[i] += plane[i] * amplitude;
+
+        amplitude *= noise.getPersistance();
+    }
+
+    for (size_t i = 0; i < planeSize; i++)
+        rawNoise[i] /= noise.getAmplitudeSum();
+}
+
+void terrainGenerator::dropOctaves()
+{
+    delete[] octaveNoise;
+    octaveNoise     = nullptr;
+    numOctavePlanes = 0;
+}
+
+size_t terrainGenerator::getOctaveBytes() const
+{
+    if(octaveNoise == nullptr) return 0;
+    return sizeof(float) * numOctavePlanes * (numVertexX + 2) * (numVertexY + 2);
+}
+
+void terrainGenerator::computeIndices()
+{
     size_t index = 0;
 
     for (size_t y = 0; y < numVertexY - 1; y++)
@@ -329,8 +864,9 @@ void terrainGenerator::computeTerrain(noiseSet &noise, float x0, float y0, float
         }
 }
 
-void terrainGenerator::computeGridNormals(float (*vertex)[8], unsigned numVertexX, unsigned numVertexY, float stride, noiseSet &noise)
+void terrainGenerator::computeGridNormals(float (*vertex)[8], unsigned numVertexX, unsigned numVertexY, float stride, const noiseSet &noise)
 {
+    PROFILE_ZONE("computeGridNormals");
     // Initialize normals to 0
     unsigned numVertex = numVertexX * numVertexY;
     glm::vec3* tempNormals = new glm::vec3[numVertex];
@@ -395,7 +931,7 @@ void terrainGenerator::computeGridNormals(float (*vertex)[8], unsigned numVertex
         center = getVertex(pos);
         up     = getVertex(getPos(0, y + 1));
         down   = getVertex(getPos(0, y - 1));
-        left   = glm::vec3( center.x - stride, center.y, noise.GetNoise(center.x - stride, center.y) );
+        left   = glm::vec3( center.x - stride, center.y, getApronHeight(-1, y, noise) );
 
         //     -Vector representing each side
         up   = up   - center;
@@ -411,7 +947,7 @@ void terrainGenerator::computeGridNormals(float (*vertex)[8], unsigned numVertex
         center = getVertex(pos);
         up     = getVertex(getPos(numVertexX-1, y + 1));
         down   = getVertex(getPos(numVertexX-1, y - 1));
-        right  = glm::vec3( center.x + stride, center.y, noise.GetNoise(center.x + stride, center.y) );
+        right  = glm::vec3( center.x + stride, center.y, getApronHeight(numVertexX, y, noise) );
 
         //     -Vector representing each side
         up    = up    - center;
@@ -433,7 +969,7 @@ void terrainGenerator::computeGridNormals(float (*vertex)[8], unsigned numVertex
         center = getVertex(pos);
         right  = getVertex(getPos(x + 1, 0));
         left   = getVertex(getPos(x - 1, 0));
-        down   = glm::vec3( center.x, center.y - stride, noise.GetNoise(center.x, center.y - stride) );
+        down   = glm::vec3( center.x, center.y - stride, getApronHeight(x, -1, noise) );
 
         //     -Vector representing each side
         right = right - center;
@@ -449,7 +985,7 @@ void terrainGenerator::computeGridNormals(float (*vertex)[8], unsigned numVertex
         center = getVertex(pos);
         right  = getVertex(getPos(x + 1, numVertexY - 1));
         left   = getVertex(getPos(x - 1, numVertexY - 1));
-        up     = glm::vec3( center.x, center.y + stride, noise.GetNoise(center.x, center.y + stride) );
+        up     = glm::vec3( center.x, center.y + stride, getApronHeight(x, numVertexY, noise) );
 
         //     -Vector representing each side
         right = right - center;
@@ -469,8 +1005,8 @@ void terrainGenerator::computeGridNormals(float (*vertex)[8], unsigned numVertex
     topLeft = getVertex(pos);
     right   = getVertex(getPos(1, numVertexY-1));
     down    = getVertex(getPos(0, numVertexY-2));
-    up      = glm::vec3(topLeft.x, topLeft.y + stride, noise.GetNoise(topLeft.x, topLeft.y + stride));
-    left    = glm::vec3(topLeft.x - stride, topLeft.y, noise.GetNoise(topLeft.x - stride, topLeft.y));
+    up      = glm::vec3(topLeft.x, topLeft.y + stride, getApronHeight(0, numVertexY, noise));
+    left    = glm::vec3(topLeft.x - stride, topLeft.y, getApronHeight(-1, numVertexY-1, noise));
 
     right = right - topLeft;
     left  = left  - topLeft;
@@ -483,8 +1019,8 @@ void terrainGenerator::computeGridNormals(float (*vertex)[8], unsigned numVertex
     topRight = getVertex(pos);
     down     = getVertex(getPos(numVertexX - 1, numVertexY-2));
     left     = getVertex(getPos(numVertexX - 2, numVertexY-1));
-    right    = glm::vec3(topRight.x + stride, topRight.y, noise.GetNoise(topRight.x + stride, topRight.y));
-    up       = glm::vec3(topRight.x, topRight.y + stride, noise.GetNoise(topRight.x, topRight.y + stride));
+    right    = glm::vec3(topRight.x + stride, topRight.y, getApronHeight(numVertexX, numVertexY-1, noise));
+    up       = glm::vec3(topRight.x, topRight.y + stride, getApronHeight(numVertexX-1, numVertexY, noise));
 
 
     right = right - topRight;
@@ -498,8 +1034,8 @@ void terrainGenerator::computeGridNormals(float (*vertex)[8], unsigned numVertex
     lowLeft  = getVertex(pos);
     right    = getVertex(getPos(1, 0));
     up       = getVertex(getPos(0, 1));
-    down     = glm::vec3(lowLeft.x, lowLeft.y - stride, noise.GetNoise(lowLeft.x, lowLeft.y - stride));
-    left     = glm::vec3(lowLeft.x - stride, lowLeft.y, noise.GetNoise(lowLeft.x - stride, lowLeft.y));
+    down     = glm::vec3(lowLeft.x, lowLeft.y - stride, getApronHeight(0, -1, noise));
+    left     = glm::vec3(lowLeft.x - stride, lowLeft.y, getApronHeight(-1, 0, noise));
 
     right = right - lowLeft;
     left  = left  - lowLeft;
@@ -510,9 +1046,9 @@ void terrainGenerator::computeGridNormals(float (*vertex)[8], unsigned numVertex
 
     pos      = getPos(numVertexX - 1, 0);
     lowRight = getVertex(pos);
-    right    = glm::vec3(lowRight.x + stride, lowRight.y, noise.GetNoise(lowRight.x + 1, lowRight.y));
+    right    = glm::vec3(lowRight.x + stride, lowRight.y, getApronHeight(numVertexX, 0, noise));
     up       = getVertex(getPos(numVertexX - 1, 1));
-    down     = glm::vec3(lowRight.x, lowRight.y - stride, noise.GetNoise(lowRight.x, lowRight.y - stride));
+    down     = glm::vec3(lowRight.x, lowRight.y - stride, getApronHeight(numVertexX-1, -1, noise));
     left     = getVertex(getPos(numVertexX - 2, 0));
 
     right = right - lowRight;
@@ -542,6 +1078,13 @@ unsigned terrainGenerator::getNumIndices() const { return numIndices; }
 
 size_t terrainGenerator::getPos(size_t x, size_t y) const { return y * numVertexX + x; }
 
+size_t terrainGenerator::getApronPos(int x, int y) const { return (y + 1) * (numVertexX + 2) + (x + 1); }
+
+float terrainGenerator::getApronHeight(int x, int y, const noiseSet &noise) const
+{
+    return noise.applyCurve(rawNoise[getApronPos(x, y)]);
+}
+
 glm::vec3 terrainGenerator::getVertex(size_t position) const
 {
     return glm::vec3( vertex[position][0], vertex[position][1], vertex[position][2] );
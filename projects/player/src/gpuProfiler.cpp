@@ -0,0 +1,177 @@
+#include <iostream>
+#include <fstream>
+
+#ifdef IMGUI_IMPL_OPENGL_LOADER_GLEW
+#include "GL/glew.h"
+#elif IMGUI_IMPL_OPENGL_LOADER_GLAD
+#include "glad/glad.h"
+#endif
+
+#include "gpuProfiler.hpp"
+
+// gpuProfiler -----------------------------------------------------------------
+
+gpuProfiler::gpuProfiler(unsigned numBuffers, size_t historySize)
+    : current(0), frameNumber(0), passOpen(false), supported(false), historySize(historySize), numDropped(0), lastFrameRead(-1)
+{
+    GLint bits = 0;
+    if(glBeginQuery && glGetQueryObjectui64v)
+        glGetQueryiv(GL_TIME_ELAPSED, GL_QUERY_COUNTER_BITS, &bits);
+    supported = (bits > 0);
+
+    if(!supported) std::cout << "GPU profiler: timer queries not available" << std::endl;
+
+    ring.resize(numBuffers < 2 ? 2 : numBuffers);
+    for(frameQueries &frame : ring) frame.frame = 0;
+}
+
+gpuProfiler::~gpuProfiler()
+{
+    for(frameQueries &frame : ring)
+        if(!frame.queries.empty())
+            glDeleteQueries(frame.queries.size(), frame.queries.data());
+}
+
+unsigned gpuProfiler::getPassIndex(const std::string &name)
+{
+    for(unsigned i = 0; i < passNames.size(); i++)
+        if(passNames[i] == name) return i;
+
+    passNames.push_back(name);
+    lastTimes.push_back(0);
+    averages.push_back(0);
+    return passNames.size() - 1;
+}
+
+void gpuProfiler::beginFrame()
+{
+    if(!supported) return;
+    if(passOpen) end();
+
+    current = (current + 1) % ring.size();      // Oldest frame in flight
+    frameQueries &frame = ring[current];
+
+    if(!frame.passes.empty()) readResults(frame);
+
+    frame.passes.clear();
+    frame.frame = frameNumber++;
+}
+
+void gpuProfiler::readResults(frameQueries &frame)
+{
+    // Queries finish in order: if the last one is available, all of them are
+    GLint available = 0;
+    glGetQueryObjectiv(frame.queries[frame.passes.size() - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if(!available)
+    {
+        numDropped++;       // Reading it now would stall
+        return;
+    }
+
+    std::vector<double> times(passNames.size(), 0);
+    for(size_t i = 0; i < frame.passes.size(); i++)
+    {
+        GLuint64 nanoseconds;
+        glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &nanoseconds);
+        times[frame.passes[i]] += nanoseconds / 1e6;
+    }
+
+    for(size_t i = 0; i < times.size(); i++)
+    {
+        lastTimes[i] = times[i];
+        averages[i]  = (averages[i] == 0 ? times[i] : averages[i] * 0.95 + times[i] * 0.05);
+    }
+
+    lastFrameRead = frame.frame;
+    history.push_back( { frame.frame, times } );
+    if(history.size() > historySize) history.pop_front();
+}
+
+void gpuProfiler::begin(const std::string &pass)
+{
+    if(!supported) return;
+    if(passOpen) end();
+
+    frameQueries &frame = ring[current];
+    size_t i = frame.passes.size();
+
+    if(i == frame.queries.size())
+    {
+        unsigned query;
+        glGenQueries(1, &query);
+        frame.queries.push_back(query);
+    }
+
+    frame.passes.push_back(getPassIndex(pass));
+    glBeginQuery(GL_TIME_ELAPSED, frame.queries[i]);
+    passOpen = true;
+}
+
+void gpuProfiler::end()
+{
+    if(!supported || !passOpen) return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    passOpen = false;
+}
+
+bool gpuProfiler::isSupported() const { return supported; }
+
+unsigned gpuProfiler::getNumPasses() const { return passNames.size(); }
+
+const std::string& gpuProfiler::getPassName(unsigned pass) const { return passNames[pass]; }
+
+double gpuProfiler::getTime(unsigned pass) const { return lastTimes[pass]; }
+
+double gpuProfiler::getAverage(unsigned pass) const { return averages[pass]; }
+
+double gpuProfiler::getTime(const std::string &pass) const
+{
+    for(unsigned i = 0; i < passNames.size(); i++)
+        if(passNames[i] == pass) return lastTimes[i];
+
+    return 0;
+}
+
+double gpuProfiler::getTotal() const
+{
+    double total = 0;
+    for(double time : lastTimes) total += time;
+    return total;
+}
+
+size_t gpuProfiler::getNumDropped() const { return numDropped; }
+
+size_t gpuProfiler::getFrameNumber() const { return frameNumber ? frameNumber - 1 : 0; }
+
+long gpuProfiler::getLastFrameRead() const { return lastFrameRead; }
+
+bool gpuProfiler::exportCSV(const std::string &file) const
+{
+    std::ofstream output(file);
+    if(!output.is_open())
+    {
+        std::cout << "GPU profiler: cannot write " << file << std::endl;
+        return false;
+    }
+
+    output << "frame";
+    for(const std::string &name : passNames) output << "," << name;
+    output << ",total\n";
+
+    for(const std::pair<size_t, std::vector<double>> &row : history)
+    {
+        double total = 0;
+        output << row.first;
+        for(size_t i = 0; i < passNames.size(); i++)
+        {
+            double time = (i < row.second.size() ? row.second[i] : 0);     // Passes added after this frame: 0
+            output << "," << time;
+            total += time;
+        }
+        output << "," << total << "\n";
+    }
+
+    std::cout << "GPU profiler: " << history.size() << " frames saved in " << file << std::endl;
+    return true;
+}
@@ -5,14 +5,18 @@
 
 // Macros -----------------------------------
 
-//#define SINGLE_VAO        // 0.000802952 sec
-#define MANY_VAO 1          // 0.000680759 sec
 //#define IMGUI_IMPL_OPENGL_LOADER_GLAD 1
 
 // Includes --------------------
 
 #include <iostream>
 #include <exception>
+#include <cstring>
+#include <cstdlib>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <algorithm>
 
 #ifdef IMGUI_IMPL_OPENGL_LOADER_GLEW
 #include "GL/glew.h"
@@ -33,6 +37,15 @@
 #include "global.hpp"
 #include "world.hpp"
 #include "timelib.hpp"
+#include "upload.hpp"
+#include "textureLoader.hpp"
+#include "gpuProfiler.hpp"
+#include "cpuProfiler.hpp"
+#include "replay.hpp"
+#include "terrainBackend.hpp"
+#include "simulation.hpp"
+#include "drawList.hpp"
+#include "occlusion.hpp"
 
 // Function declarations --------------------
 
@@ -40,14 +53,31 @@ void framebuffer_resize_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow *window, double xpos, double ypos);
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 void processInput(GLFWwindow *window);
 
-void updateTerrain(unsigned int VAO, std::map<BinaryKey, unsigned int> &VBO, std::map<BinaryKey, unsigned int> &EBO);
-void updateTerrain(std::map<BinaryKey, unsigned int> &VAO, std::map<BinaryKey, unsigned int> &VBO, std::map<BinaryKey, unsigned int> &EBO);
-void GUI_terrainConfig(std::map<BinaryKey, unsigned int> &VAO, std::map<BinaryKey, unsigned int> &VBO, std::map<BinaryKey, unsigned int> &EBO);
+void updateTerrain(terrainBackend &backend, uploadRing &uploader, drawListBuilder &builder, const frameSnapshot &snapshot, std::vector<chunkDrawCall> &drawList, std::chrono::steady_clock::time_point budgetStart);
+void switchTerrainBackend(terrainBackend *&backend, terrainBackendType type, uploadRing &uploader);
+void terrainStatsQuery(bool start);
+void GUI_gpuProfiler(gpuProfiler &profiler);
+void GUI_cpuProfiler();
+void GUI_frameTime();
+void GUI_terrainConfig(terrainBackend &backend, uploadRing &uploader, const drawListBuilder &builder, occlusionCuller &occlusion);
 void printOGLdata();
-
+bool parseArguments(int argc, char* argv[]);
+bool parseBackends(const std::string &list);      ///< Fill options.backends from a comma separated list of terrainBackendIds (or "all")
+void benchmarkPose(size_t frame);
+void recordPose();
+
+void updateUniformBlocks(unsigned cameraUBO, unsigned lightingUBO);
+std::vector<std::string> getTerrainDefines(const terrainBackend &backend);
+void startShadingBenchmark();
+void shadingBenchmarkPose();
+void shadingBenchmarkTimer(bool start);
+void setupTerrainProgram(Shader &program);
+void setupDepthProgram(Shader &program);
 void setUniformsTerrain(Shader &program);
+void setUniformsDepth(Shader &program);
 void setUniformsAxis(Shader& program);
 void setUniformsWater(Shader& program);
 void setUniformsSun(Shader& program, glm::vec3 direction, float sunFOV);
@@ -56,8 +86,10 @@ void setUniformsTest(Shader& program);
 
 // Function definitions --------------------
 
-int main()
+int main(int argc, char* argv[])
 {
+    if(!parseArguments(argc, argv)) return -1;
+
     // glfw: initialize and configure
     if (!glfwInit())
     {
@@ -72,6 +104,12 @@ int main()
 #ifdef __APPLE__
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);            // To make MacOS happy; should not be needed
 #endif
+    if(options.benchmark && !options.visible)
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);                   // Offscreen (the default framebuffer keeps the window size)
+    if(options.contextAPI == "egl")
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+    else if(options.contextAPI == "osmesa")
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);     // Software rendering (requires GLFW built with OSMesa)
 
     // ----- GLFW window creation
     GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Simulator", nullptr, nullptr);
@@ -88,6 +126,7 @@ int main()
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
     glfwSetMouseButtonCallback(window, mouse_button_callback);
+    glfwSetKeyCallback(window, key_callback);
 
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);  // DISABLED, HIDDEN, NORMAL
     glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);        // Sticky keys: Make sure that any pressed key is captured
@@ -142,39 +181,68 @@ int main()
     // ----- Set up vertex data, buffers, and configure vertex attributes
 
     // >>> Textures
-    grass.diffuseT       = createTexture2D((path_textures + "grass.png").c_str(), GL_RGB);              // 0
-    grass.specularT      = createTexture2D((path_textures + "grass_specular.png").c_str(), GL_RGB);     // 1
-    rock.diffuseT        = createTexture2D((path_textures + "rock.jpg").c_str(), GL_RGB);               // 2
-    rock.specularT       = createTexture2D((path_textures + "rock_specular.jpg").c_str(), GL_RGB);      // 3
-    sand.diffuseT        = createTexture2D((path_textures + "sand.jpg").c_str(), GL_RGB);               // 4
-    sand.specularT       = createTexture2D((path_textures + "sand_specular.jpg").c_str(), GL_RGB);      // 5
-    plainSand.diffuseT   = createTexture2D((path_textures + "plainSand.jpg").c_str(), GL_RGB);          // 6
-    plainSand.specularT  = createTexture2D((path_textures + "plainSand_specular.jpg").c_str(), GL_RGB); // 7
-    sun.diffuseT         = createTexture2D((path_textures + "sun.png").c_str(), GL_RGBA);               // 8
+    std::vector<std::string> materialFiles = {
+        path_textures + "grass.png",     path_textures + "grass_specular.png",          // Layers 0, 1
+        path_textures + "rock.jpg",      path_textures + "rock_specular.jpg",           // Layers 2, 3
+        path_textures + "sand.jpg",      path_textures + "sand_specular.jpg",           // Layers 4, 5
+        path_textures + "plainSand.jpg", path_textures + "plainSand_specular.jpg" };    // Layers 6, 7
+
+    textureLoader *textures = new textureLoader();     // Decodes in the background. Placeholders are used until textures->uploadFinished() uploads them.
+    textures->loadTextureArray(materialMaps, materialFiles, path_cache, materialMapsSize, isS3TCSupported());  // Unit 0
+    textures->loadTexture2D(sun.diffuseT, path_textures + "sun.png", GL_RGBA);                                  // Unit 8
+
+    // >>> Shaders
+    Shader::binaryCacheDirectory = path_cache;          // Linked programs are reused by the next runs (if the driver supports program binaries)
 
     // >>> Terrain
-    Shader terrProgram( (path_shaders + "terrain.vs").c_str(), (path_shaders + "terrain.fs").c_str() );
+    shaderVariants terrPrograms(path_shaders + "terrain.vs", path_shaders + "terrain.fs", setupTerrainProgram);     // Variants: see getTerrainDefines()
+    shaderVariants depthPrograms(path_shaders + "terrain.vs", path_shaders + "depth.fs", setupDepthProgram);        // Depth pre-pass (variants: see terrainBackend::getDefines())
 
-    worldChunks.updateVisibleChunks(cam.Position);
+    if(options.benchmark)
+    {
+        timer.setMaxFPS(0);
+        worldChunks.frameBudget = 0;        // Every chunk is generated in the frame it enters the view (frames don't depend on timing)
+        terrainDraw.backend = options.backends[0];
+        benchmark.beginRun(terrainBackendIds[terrainDraw.backend], 0);
+    }
+    else
+        worldChunks.openStore(path_cache);  // Not in benchmark mode: the first run would generate chunks and the next ones load them
 
-    #ifdef SINGLE_VAO
-        unsigned VAO = createVAO();
-    #elif MANY_VAO
-        std::map<BinaryKey, unsigned int> VAO;
-    #endif
+    sim.setFogRadius(fogEnabled ? fogMaxR : 0);
+    sim.tick(0);                            // First snapshot (chunks around the initial position)
+    if(!options.benchmark) sim.start();     // Benchmark: a tick per frame, so each frame shows the path pose of its frame
+
+    uploadRing *uploader = new uploadRing();    // Streams new chunks to the GPU (bounded bytes per frame)
+    gpuProfiler *profiler = new gpuProfiler();  // GPU time of each render pass
+    terrainBackend *terrain = createTerrainBackend(terrainDraw.backend, *uploader);    // Terrain buffers and draw calls (switchable at runtime)
+    drawListBuilder *drawLists = new drawListBuilder();     // Builds drawList with worker threads
+    occlusionCuller *occlusion = new occlusionCuller();     // Skips chunks hidden in the previous frame (if terrainDraw.occlusionCulling)
+    std::vector<chunkDrawCall> drawList;        // Chunks ready to be drawn this frame (front to back, if terrainDraw.sortFrontToBack)
 
-    std::map<BinaryKey, unsigned int> VBO;
-    std::map<BinaryKey, unsigned int> EBO;
+    terrPrograms.get(getTerrainDefines(*terrain));
+
+    if(options.benchmark)
+    {
+        // Measured frames must not include shader builds nor placeholder textures: build the variants of every backend
+        // compared (shading and depth pre-pass), and wait for the textures
+        for(terrainBackendType type : options.backends)
+        {
+            terrainBackend *other = createTerrainBackend(type, *uploader);
+            terrPrograms.get(getTerrainDefines(*other));
+            depthPrograms.get(other->getDefines());
+            delete other;
+        }
+
+        while(!textures->isDone())
+        {
+            textures->uploadFinished();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        textures->printTimings();
+        delete textures;
+        textures = nullptr;
+    }
 
-    terrProgram.UseProgram();
-    terrProgram.setInt("grass.diffuseT",      0);  // Tell OGL for each sampler to which texture unit it belongs to (only has to be done once)
-    terrProgram.setInt("grass.specularT",     1);
-    terrProgram.setInt("rock.diffuseT",       2);
-    terrProgram.setInt("rock.specularT",      3);
-    terrProgram.setInt("sand.diffuseT",       4);
-    terrProgram.setInt("sand.specularT",      5);
-    terrProgram.setInt("plainSand.diffuseT",  6);
-    terrProgram.setInt("plainSand.specularT", 7);
 
     // >>> Axis
 
@@ -219,6 +287,22 @@ int main()
     sunProg.UseProgram();
     sunProg.setInt("sunTexture",  8);
 
+    // >>> Chunk bounding boxes (occlusion queries)
+
+    Shader boxProg( (path_shaders + "box.vs").c_str(), (path_shaders + "depth.fs").c_str() );
+
+    // >>> Uniform blocks (camera and lighting data shared by all the programs)
+
+    unsigned cameraUBO   = createUBO(sizeof(cameraBlock),   CAMERA_BLOCK_BINDING);
+    unsigned lightingUBO = createUBO(sizeof(lightingBlock), LIGHTING_BLOCK_BINDING);
+
+    Shader* programs[4] = { &axisProg, &waterProg, &sunProg, &boxProg };    // Terrain variants bind them in setupTerrainProgram()
+    for(Shader* program : programs)
+    {
+        program->bindUniformBlock("Camera",   CAMERA_BLOCK_BINDING);
+        program->bindUniformBlock("Lighting", LIGHTING_BLOCK_BINDING);
+    }
+
     // >>> Icosahedron (light source)
     /*
     Icosahedron icos;
@@ -246,10 +330,43 @@ int main()
     // >>>>> RENDER LOOP <<<<<
     while (!glfwWindowShouldClose(window))
     {
+        PROFILE_FRAME();
         timer.computeDeltaTime();
         //timer.printTimeData();
         
-        processInput(window);
+        std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+        size_t frame = timer.getFrameCounter() - 1;
+        size_t runFrame = benchmark.getRunFrame(frame);
+        double submitTime = 0;              // Terrain draw calls (ms)
+        size_t chunksGenerated = sim.getSnapshot().chunksGenerated, chunksLoaded = sim.getSnapshot().chunksLoaded;   // Previous snapshot
+
+        {
+            PROFILE_ZONE("Input");
+            processInput(window);
+        }
+        if(shadingBench.running) shadingBenchmarkPose();
+        if(options.benchmark) benchmarkPose(runFrame);
+        sim.setFogRadius(fogEnabled ? fogMaxR : 0);     // Completely fogged chunks are not generated
+
+        std::chrono::steady_clock::duration tickTime(0);   // Chunk generation in this thread, which shares the frame budget with staging
+        if(!sim.isRunning())
+        {
+            std::chrono::steady_clock::time_point tickStart = std::chrono::steady_clock::now();
+            sim.tick(timer.getDeltaTime());
+            tickTime = std::chrono::steady_clock::now() - tickStart;
+        }
+        sim.acquireSnapshot();
+        const frameSnapshot &snapshot = sim.getSnapshot();      // Valid until the next acquireSnapshot()
+        cam = snapshot.camera;
+
+        if(!options.recordFile.empty()) recordPose();
+
+        if(textures && textures->uploadFinished() && textures->isDone())
+        {
+            textures->printTimings();
+            delete textures;
+            textures = nullptr;
+        }
 
         std::string title = "Simulator (fps: " + std::to_string(timer.getFPS()) + ")";
         glfwSetWindowTitle(window, title.c_str());
@@ -260,32 +377,95 @@ int main()
         glClearColor(skyColor.x, skyColor.y, skyColor.z, skyColor.a);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);           // GL_STENCIL_BUFFER_BIT
 
+        profiler->beginFrame();
+        if(options.benchmark && profiler->getLastFrameRead() >= 0)
+            benchmark.setGpuTime(profiler->getLastFrameRead(), profiler->getTotal(), profiler->getTime("Depth pre-pass") + profiler->getTime("Terrain") + profiler->getTime("Occlusion queries"));     // Profiler frames start with the render loop, like the benchmark frames
+
         // GUI
-        gui.implement_NewFrame();
-        //GUI_terrainConfig(VAO, VBO, EBO);
-        mouseOverGUI = gui.cursorOverGUI();
+        {
+            PROFILE_ZONE("GUI build");
+            gui.implement_NewFrame();
+            GUI_terrainConfig(*terrain, *uploader, *drawLists, *occlusion);
+            GUI_gpuProfiler(*profiler);
+            GUI_cpuProfiler();
+            GUI_frameTime();
+            mouseOverGUI = gui.cursorOverGUI();
+        }
 
-        // >>> Terrain
-        worldChunks.updateVisibleChunks(cam.Position);
+        updateUniformBlocks(cameraUBO, lightingUBO);
 
-        setUniformsTerrain(terrProgram);
+        // >>> Terrain
+        if(terrain->getType() != terrainDraw.backend)
+            switchTerrainBackend(terrain, terrainDraw.backend, *uploader);
+        {
+            PROFILE_ZONE("updateTerrain");
+            updateTerrain(*terrain, *uploader, *drawLists, snapshot, drawList, std::chrono::steady_clock::now() - tickTime);
+        }
+        if(terrainDraw.occlusionCulling) occlusion->beginFrame(snapshot, drawList);
+        else occlusion->clear();
 
         //terrainTime.computeDeltaTime();
-        updateTerrain(VAO, VBO, EBO);
+        if(shadingBench.running) shadingBenchmarkTimer(true);
+
+        PROFILE_ZONE("Render");                     // Until the end of the frame
+        if(terrainDraw.depthPrepass)
+        {
+            profiler->begin("Depth pre-pass");
+            setUniformsDepth(depthPrograms.get(terrain->getDefines()));
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            {
+                PROFILE_ZONE("Terrain draw");
+                std::chrono::steady_clock::time_point submitStart = std::chrono::steady_clock::now();
+                if(terrainDraw.occlusionCulling) occlusion->draw(*terrain, drawList);
+                else terrain->draw(drawList);
+                submitTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - submitStart).count();
+            }
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            glDepthFunc(GL_LEQUAL);
+        }
+        if(terrainDraw.showOverdraw) glBlendFunc(GL_ONE, GL_ONE);
+
+        profiler->begin("Terrain");
+        setUniformsTerrain(terrPrograms.get(getTerrainDefines(*terrain)));
+        terrainStatsQuery(true);
+        {
+            PROFILE_ZONE("Terrain draw");
+            std::chrono::steady_clock::time_point submitStart = std::chrono::steady_clock::now();
+            if(terrainDraw.occlusionCulling) occlusion->draw(*terrain, drawList);
+            else terrain->draw(drawList);
+            submitTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - submitStart).count();
+        }
+        terrainStatsQuery(false);
+        profiler->end();
+
+        glDepthFunc(GL_LESS);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+        if(shadingBench.running) shadingBenchmarkTimer(false);
+
+        if(terrainDraw.occlusionCulling)
+        {
+            profiler->begin("Occlusion queries");       // Against the terrain's depth (before water), for the next frame
+            occlusion->issueQueries(boxProg, snapshot, drawList);
+            profiler->end();
+        }
         //terrainTime.computeDeltaTime();
         //avg.addValue(terrainTime.getDeltaTime());
 
         // >>> Water
+        profiler->begin("Water");
         setUniformsWater(waterProg);
         glBindVertexArray(waterVAO);
         glDrawArrays(GL_TRIANGLES, 0, 6);
 
         // >>> Axis
+        profiler->begin("Axis");
         setUniformsAxis(axisProg);
         glBindVertexArray(axisVAO);
         glDrawArrays(GL_LINES, 0, 6);
 
         // >>> Sun
+        profiler->begin("Sun");
         setUniformsSun(sunProg, sunLight.direction, 0.2);
         glBindVertexArray(sunVAO);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sunEBO);
@@ -300,42 +480,82 @@ int main()
         // glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
         // GUI
-        gui.render();
+        profiler->begin("GUI");
+        {
+            PROFILE_ZONE("GUI render");
+            gui.render();
+        }
+        profiler->end();
 
         // ----------------------------------
         // ----------------------------------
 
-        glfwSwapBuffers(window);
+        {
+            PROFILE_ZONE("Swap buffers");
+            glfwSwapBuffers(window);
+        }
         glfwPollEvents();
+
+        if(options.benchmark)
+        {
+            benchmark.addFrame( { benchmark.getRun(),
+                                  runFrame,
+                                  benchmark.getTime(runFrame),
+                                  std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count(),
+                                  submitTime,
+                                  -1, -1,
+                                  snapshot.numChunks,
+                                  snapshot.chunksGenerated - chunksGenerated,
+                                  snapshot.chunksLoaded - chunksLoaded,
+                                  drawList.size(),
+                                  replayBenchmark::getResidentMemory(),
+                                  terrain->getGpuBytes() / 1024 } );
+
+            if(runFrame + 1 >= benchmark.getNumFrames())
+            {
+                size_t nextRun = benchmark.getRun() + 1;
+                if(nextRun < options.backends.size())
+                {
+                    // Next backend: same path, starting again with no chunks (the backend is switched before the next update)
+                    terrainDraw.backend = options.backends[nextRun];
+                    benchmark.beginRun(terrainBackendIds[terrainDraw.backend], frame + 1);
+                    std::lock_guard<std::mutex> lock(sim.worldMutex);
+                    worldChunks.updateTerrainParameters(worldChunks.noise, worldChunks.maxViewDist, worldChunks.chunkSize, worldChunks.vertexPerSide);
+                }
+                else
+                    glfwSetWindowShouldClose(window, true);
+            }
+        }
     }
     // Render loop End
+    sim.stop();
 
+    if(options.benchmark)
+    {
+        benchmark.writeCSV(options.output + ".csv");
+        benchmark.writeJSON(options.output + ".json", (const char*)glGetString(GL_RENDERER));
+        benchmark.printSummary();
+    }
+    if(!options.recordFile.empty())
+        recordedPath.save(options.recordFile);
 
-    // ----- De-allocate all resources
 
-    #ifdef SINGLE_VAO
-        glDeleteVertexArrays(1, &VAO);
-        for( std::map<BinaryKey, unsigned int>::const_iterator it = VBO.begin();
-             it != VBO.end();
-             ++it )
-        {
-            BinaryKey key = it->first;
-            glDeleteBuffers     (1, &VBO[key]);
-            glDeleteBuffers     (1, &EBO[key]);
-        }
-    #elif MANY_VAO
-        for( std::map<BinaryKey, unsigned int>::const_iterator it = VAO.begin();
-             it != VAO.end();
-             ++it )
-        {
-            BinaryKey key = it->first;
-            glDeleteVertexArrays(1, &VAO[key]);
-            glDeleteBuffers     (1, &VBO[key]);
-            glDeleteBuffers     (1, &EBO[key]);
-        }
-    #endif
+    // ----- De-allocate all resources
 
-    glDeleteProgram(terrProgram.ID);
+    delete terrain;
+    delete uploader;
+    delete profiler;
+    delete drawLists;
+    delete occlusion;
+    delete textures;
+    terrPrograms.deletePrograms();
+    if(shadingBench.queries[0]) glDeleteQueries(2, shadingBench.queries);
+    if(terrainDraw.queries[0]) glDeleteQueries(2, terrainDraw.queries);
+    depthPrograms.deletePrograms();
+
+    glDeleteTextures(1, &materialMaps);
+    glDeleteBuffers(1, &cameraUBO);
+    glDeleteBuffers(1, &lightingUBO);
 
     glDeleteVertexArrays(1, &axisVAO);
     glDeleteBuffers(1, &axisVBO);
@@ -371,9 +591,8 @@ void framebuffer_resize_callback(GLFWwindow* window, int width, int height)
     //glfwGetFramebufferSize(window, &width, &height);  // Get viewport size from GLFW
     glViewport(0, 0, width, height);                    // Tell OGL the viewport size
 
-    // projection adjustments
-    cam.width = width;
-    cam.height = height;
+    // projection adjustments (applied in the next simulation tick)
+    sim.setViewport(width, height);
 }
 
 // Process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
@@ -382,20 +601,13 @@ void processInput(GLFWwindow *window)
     if(glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
 
-    // Get cameraPos from keys
-    float cameraSpeed = 2.5 * timer.getDeltaTime();
-    if(glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-        cam.ProcessKeyboard(FORWARD, timer.getDeltaTime());
-    if(glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        cam.ProcessKeyboard(BACKWARD, timer.getDeltaTime());
-    if(glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-        cam.ProcessKeyboard(LEFT, timer.getDeltaTime());
-    if(glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-        cam.ProcessKeyboard(RIGHT, timer.getDeltaTime());
-    if(glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
-        cam.ProcessKeyboard(UP, timer.getDeltaTime());
-    if(glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
-        cam.ProcessKeyboard(DOWN, timer.getDeltaTime());
+    // Get cameraPos from keys (the camera moves in the simulation ticks while they are held)
+    sim.setKey(FORWARD,  glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS);
+    sim.setKey(BACKWARD, glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS);
+    sim.setKey(LEFT,     glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS);
+    sim.setKey(RIGHT,    glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS);
+    sim.setKey(UP,       glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS);
+    sim.setKey(DOWN,     glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS);
 }
 
 // Get cameraFront from the mouse
@@ -415,14 +627,14 @@ void mouse_callback(GLFWwindow *window, double xpos, double ypos)
         lastX = xpos;
         lastY = ypos;
 
-        cam.ProcessMouseMovement(xoffset, yoffset, 1);
+        sim.addMouseMovement(xoffset, yoffset);
     }
 }
 
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset)
 {
     if (!mouseOverGUI)
-        cam.ProcessMouseScroll(yoffset);
+        sim.addScroll(yoffset);
 }
 
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
@@ -443,8 +655,106 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
     }
 }
 
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    if (key == GLFW_KEY_F9 && action == GLFW_PRESS)
+        cpuProfiler::get().exportChromeTrace(path_cache + "cpuTrace.json");
+}
+
 // Others ----------------------------------------------------------------------------
 
+bool parseArguments(int argc, char* argv[])
+{
+    options.output = path_cache + "benchmark";
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+
+        if     (arg == "--benchmark" && hasValue) { options.benchmark = true; benchmark.pathFile = argv[++i]; }
+        else if(arg == "--output"    && hasValue) options.output     = argv[++i];
+        else if(arg == "--timestep"  && hasValue) benchmark.timeStep = std::max(1e-4, std::atof(argv[++i]));
+        else if(arg == "--record"    && hasValue) options.recordFile = argv[++i];
+        else if(arg == "--context"   && hasValue) options.contextAPI = argv[++i];
+        else if(arg == "--visible")               options.visible    = true;
+        else if(arg == "--backend"   && hasValue) { if(!parseBackends(argv[++i])) return false; }
+        else if(arg == "--occlusion")             options.occlusion  = true;
+        else
+        {
+            std::cout << "Usage: " << argv[0] << " [options]\n"
+                      << "    --benchmark <path file>   Replay a camera path (lines: time x y z yaw pitch), save the measures and exit\n"
+                      << "    --output <prefix>         Benchmark results: <prefix>.csv (per frame) and <prefix>.json (summary)\n"
+                      << "    --timestep <seconds>      Path time per benchmark frame (default: 1/60)\n"
+                      << "    --visible                 Show the window while benchmarking (hidden by default)\n"
+                      << "    --backend <id|all>        Terrain draw backend (chunk-vao, shared-vao, multi-draw, instanced). Several (comma\n"
+                      << "                              separated) or \"all\": the benchmark replays the path with each one\n"
+                      << "    --occlusion               Start with occlusion culling of terrain chunks enabled\n"
+                      << "    --context <egl|osmesa>    Context creation API (default: native)\n"
+                      << "    --record <path file>      Save the camera path of this session" << std::endl;
+            return false;
+        }
+    }
+
+    if(options.benchmark && !benchmark.path.load(benchmark.pathFile))
+        return false;
+
+    if(options.backends.empty()) options.backends.push_back(terrainDraw.backend);
+    terrainDraw.backend = options.backends[0];
+    terrainDraw.occlusionCulling = options.occlusion;
+
+    return true;
+}
+
+bool parseBackends(const std::string &list)
+{
+    options.backends.clear();
+
+    std::istringstream ids(list);
+    std::string id;
+    while(std::getline(ids, id, ','))
+    {
+        if(id == "all")
+        {
+            for(unsigned i = 0; i < numTerrainBackends; i++)
+                options.backends.push_back((terrainBackendType)i);
+            continue;
+        }
+
+        unsigned type = 0;
+        while(type < numTerrainBackends && id != terrainBackendIds[type]) type++;
+        if(type == numTerrainBackends)
+        {
+            std::cout << "Unknown terrain backend: " << id << std::endl;
+            return false;
+        }
+        options.backends.push_back((terrainBackendType)type);
+    }
+
+    return !options.backends.empty();
+}
+
+void benchmarkPose(size_t frame)
+{
+    glm::vec3 position;
+    float yaw, pitch;
+
+    if(benchmark.path.getPose(benchmark.getTime(frame), position, yaw, pitch))
+        sim.setPose(position, yaw, pitch);
+}
+
+void recordPose()
+{
+    static double startTime = -1, nextKey = 0;
+
+    double time = timer.getTime();
+    if(startTime < 0) startTime = nextKey = time;
+    if(time < nextKey) return;
+
+    recordedPath.addKey(time - startTime, cam.Position, cam.Yaw, cam.Pitch);
+    nextKey += options.recordInterval;
+}
+
 void printOGLdata()
 {
     int maxNumberAttributes;
@@ -460,26 +770,17 @@ void printOGLdata()
                  "-------------------- \n" << std::endl;
 }
 
-void cleanTerrainBuffers(std::map<BinaryKey, unsigned int> &VAO, std::map<BinaryKey, unsigned int> &VBO, std::map<BinaryKey, unsigned int> &EBO)
+void GUI_terrainConfig(terrainBackend &backend, uploadRing &uploader, const drawListBuilder &builder, occlusionCuller &occlusion)
 {
-    for(std::map<BinaryKey, unsigned int>::const_iterator it = VAO.begin();
-        it != VAO.end();
-        ++it)
+    // The widgets show copies of worldChunks' settings (only this thread writes them) and the snapshot's counters. worldMutex
+    // is only taken to apply an edit, so building the GUI never waits for a tick that is generating chunks.
+    const frameSnapshot &snapshot = sim.getSnapshot();
+    static size_t octaveCacheBytes = 0;     // Updated when the world is not locked by a tick
     {
-        BinaryKey key = it->first;
-
-        glDeleteVertexArrays(1, &VAO[key]);
-        glDeleteBuffers     (1, &VBO[key]);
-        glDeleteBuffers     (1, &EBO[key]);
+        std::unique_lock<std::mutex> lock(sim.worldMutex, std::try_to_lock);
+        if(lock.owns_lock()) octaveCacheBytes = worldChunks.getOctaveCacheBytes();
     }
 
-    VAO.clear();
-    VBO.clear();
-    EBO.clear();
-}
-
-void GUI_terrainConfig(std::map<BinaryKey, unsigned int> &VAO, std::map<BinaryKey, unsigned int> &VBO, std::map<BinaryKey, unsigned int> &EBO)
-{
     // Window
     ImGui::Begin("Noise configuration");
     //ImGui::Checkbox("Another Window", &show_another_window);
@@ -487,17 +788,44 @@ void GUI_terrainConfig(std::map<BinaryKey, unsigned int> &VAO, std::map<BinaryKe
     ImGui::Text("Terrain mapping:");
 
     bool updateTerrain = false;
-    if( ImGui::SliderFloat("Max. view distance", &worldChunks.maxViewDist, 1, 500) ) updateTerrain = true;
-    if( ImGui::SliderFloat("Chunk size", &worldChunks.chunkSize, 20, 100)          ) updateTerrain = true;
-    if( ImGui::SliderInt("VertexPerSide", &worldChunks.vertexPerSide, 5, 50)       ) updateTerrain = true;
+    float maxViewDist   = worldChunks.maxViewDist;
+    float chunkSize     = worldChunks.chunkSize;
+    int   vertexPerSide = worldChunks.vertexPerSide;
+    if( ImGui::SliderFloat("Max. view distance", &maxViewDist, 1, 500) ) updateTerrain = true;
+    if( ImGui::SliderFloat("Chunk size", &chunkSize, 20, 100)          ) updateTerrain = true;
+    if( ImGui::SliderInt("VertexPerSide", &vertexPerSide, 5, 50)       ) updateTerrain = true;
     if(updateTerrain)
     {
-        worldChunks.updateTerrainParameters(worldChunks.noise, worldChunks.maxViewDist, worldChunks.chunkSize, worldChunks.vertexPerSide);
-        cleanTerrainBuffers(VAO, VBO, EBO);
+        std::lock_guard<std::mutex> lock(sim.worldMutex);
+        worldChunks.updateTerrainParameters(worldChunks.noise, maxViewDist, chunkSize, vertexPerSide);
+        backend.clear();
+    }
+
+    ImGui::Text("Frame budget: ");
+    float frameBudget = worldChunks.frameBudget;
+    if(ImGui::SliderFloat("Terrain time (ms)", &frameBudget, 0, 20))     // 0: no limit
+    {
+        std::lock_guard<std::mutex> lock(sim.worldMutex);
+        worldChunks.frameBudget = frameBudget;
     }
+    ImGui::Text("Chunks pending generation: %d", (int)snapshot.pendingChunks);
+    ImGui::Text("Chunks pending upload: %d (%d KB in staging)", std::max(0, (int)snapshot.numChunks - (int)backend.getNumChunks()), (int)(uploader.pendingBytes() / 1024));
+    ImGui::Text("Chunks on disk: %d (%d being written)", (int)worldChunks.store.getNumStored(), (int)worldChunks.store.getNumQueued());
 
     ImGui::Text("Noise configuration: ");
 
+    bool cacheOctaves = worldChunks.cacheOctaves;
+    if( ImGui::Checkbox("Cache octaves", &cacheOctaves) )      // Faster octaves/persistance edits, more memory
+    {
+        std::lock_guard<std::mutex> lock(sim.worldMutex);
+        worldChunks.cacheOctaves = cacheOctaves;
+        if(!cacheOctaves)
+            for(std::map<BinaryKey, terrainGenerator>::iterator it = worldChunks.chunkDict.begin(); it != worldChunks.chunkDict.end(); ++it)
+                it->second.dropOctaves();
+    }
+    ImGui::SameLine();
+    ImGui::Text("(%d KB)", (int)(octaveCacheBytes / 1024));
+
     const char* noiseTypeString[6] = { "OpenSimplex2", "OpenSimplex2S", "Cellular", "Perlin", "ValueCubic", "Value" };
     int noiseType     = noise.getNoiseType();
     ImGui::Combo      ("Noise type", &noiseType, noiseTypeString, IM_ARRAYSIZE(noiseTypeString));
@@ -526,17 +854,52 @@ void GUI_terrainConfig(std::map<BinaryKey, unsigned int> &VAO, std::map<BinaryKe
     noiseSet newNoise((unsigned)numOctaves, lacunarity, persistance, scale, multiplier, curveDegree, offsetX, offsetY, (FastNoiseLite::NoiseType)noiseType, true, (unsigned)seed);
     if( noise != newNoise)
     {
+        std::lock_guard<std::mutex> lock(sim.worldMutex);
         noise = newNoise;
-        worldChunks.setNoise(noise);
-        worldChunks.chunkDict.clear();
-        cleanTerrainBuffers(VAO, VBO, EBO);
+        if(!worldChunks.reshapeNoise(noise))        // Multiplier and curve degree edits (and octaves/persistance, if cached) reuse the chunks' noise
+        {
+            worldChunks.setNoise(noise);
+            worldChunks.chunkDict.clear();
+            worldChunks.placeholders.clear();
+            backend.clear();
+        }
     }
 
+    ImGui::Text("Shading: ");
+    ImGui::Checkbox("Fog", &fogEnabled);
+    ImGui::SameLine();
+    ImGui::Text("(biome: %s)", getBiome(worldChunks.noise) == biomeDesert ? "desert" : "grass & rock");
+    if(shadingBench.running)
+        ImGui::Text("Shading benchmark: %s, frame %d/%d", shadingBench.warmup ? "warm-up" : (shadingBench.pass ? "pass 2/2" : "pass 1/2"), shadingBench.frame, shadingBench.framesPerPass);
+    else if(ImGui::Button("Shading benchmark"))     // Lighting per material vs. blended materials (results in the console)
+        startShadingBenchmark();
+    ImGui::Checkbox("Front to back", &terrainDraw.sortFrontToBack);
+    ImGui::SameLine();
+    ImGui::Checkbox("Frustum culling", &terrainDraw.frustumCulling);
+    ImGui::SameLine();
+    ImGui::Text("(%d culled, %d threads)", (int)builder.getNumCulled(), (int)builder.getNumThreads());
+    ImGui::Checkbox("Occlusion culling", &terrainDraw.occlusionCulling);
+    if(terrainDraw.occlusionCulling)
+    {
+        ImGui::SameLine();
+        ImGui::Text("(%d of %d tested chunks occluded)", (int)occlusion.getNumOccluded(), (int)occlusion.getNumTested());
+    }
+    ImGui::Checkbox("Depth pre-pass", &terrainDraw.depthPrepass);
+    ImGui::SameLine();
+    ImGui::Checkbox("Show overdraw", &terrainDraw.showOverdraw);
+    int backendType = terrainDraw.backend;
+    if(ImGui::Combo("Draw backend", &backendType, terrainBackendNames, numTerrainBackends))
+        terrainDraw.backend = (terrainBackendType)backendType;      // Switched before the next update (see switchTerrainBackend())
+    ImGui::SameLine();
+    ImGui::Text("(%d KB)", (int)(backend.getGpuBytes() / 1024));
+    ImGui::Text("Terrain: %.2f fragments shaded per pixel", terrainDraw.fragmentsPerPixel);
+
     ImGui::Text("Water: ");
     ImGui::SliderFloat("Sea level", &seaLevel, -1, 100);
 
     ImGui::Text("Camera: ");
-    ImGui::SliderFloat("Speed", &cam.MovementSpeed, 0, 200);
+    float speed = cam.MovementSpeed;
+    if(ImGui::SliderFloat("Speed", &speed, 0, 200)) sim.setMovementSpeed(speed);
 
     //ImGui::ColorEdit3("clear color", (float*)&clear_color);
     //if (ImGui::Button("Button")) counter++;  ImGui::SameLine();  ImGui::Text("counter = %d", counter);
@@ -559,151 +922,205 @@ void GUI_terrainConfig(std::map<BinaryKey, unsigned int> &VAO, std::map<BinaryKe
 */
 }
 
-void setUniformsTerrain(Shader &program)
+void updateUniformBlocks(unsigned cameraUBO, unsigned lightingUBO)
 {
-    program.UseProgram();
+    cameraBlock camera;
+    camera.view       = cam.GetViewMatrix();
+    camera.projection = cam.GetProjectionMatrix();
+    camera.camPos     = glm::vec4(cam.Position, 1.f);
+    updateUBO(cameraUBO, sizeof(camera), &camera);
+
+    lightingBlock lighting;
+    std::memset(&lighting, 0, sizeof(lighting));
+
+    lighting.sun.lightType   = sunLight.lightType;
+    lighting.sun.position    = sunLight.position;
+    lighting.sun.direction   = sunLight.direction;
+    lighting.sun.ambient     = sunLight.ambient;
+    lighting.sun.diffuse     = sunLight.diffuse;
+    lighting.sun.specular    = sunLight.specular;
+    lighting.sun.constant    = sunLight.constant;
+    lighting.sun.linear      = sunLight.linear;
+    lighting.sun.quadratic   = sunLight.quadratic;
+    lighting.sun.cutOff      = sunLight.cutOff;
+    lighting.sun.outerCutOff = sunLight.outerCutOff;
+
+    const material* source[6]      = { &grass, &rock, &snow, &sand, &plainSand, &water };
+    materialBlock*  destination[6] = { &lighting.grass, &lighting.rock, &lighting.snow, &lighting.sand, &lighting.plainSand, &lighting.water };
+    for(unsigned i = 0; i < 6; i++)
+    {
+        destination[i]->diffuse   = source[i]->diffuse;
+        destination[i]->specular  = source[i]->specular;
+        destination[i]->shininess = source[i]->shininess;
+    }
 
-    // >>> Vertex shader uniforms
-    glm::mat4 projection = cam.GetProjectionMatrix();
-    program.setMat4("projection", projection);
+    updateUBO(lightingUBO, sizeof(lighting), &lighting);
+}
 
-    glm::mat4 view = cam.GetViewMatrix();
-    program.setMat4("view", view);
+std::vector<std::string> getTerrainDefines(const terrainBackend &backend)
+{
+    std::vector<std::string> defines;
 
-    glm::mat4 model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
-    model = glm::rotate(model, 0.0f, glm::vec3(0.0f, 0.0f, 1.0f));
-    model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));
-    program.setMat4("model", model);
+    if     (sunLight.lightType == directional) defines.push_back("LIGHT_DIRECTIONAL");
+    else if(sunLight.lightType == point)       defines.push_back("LIGHT_POINT");
+    else if(sunLight.lightType == spot)        defines.push_back("LIGHT_SPOT");
 
-    glm::mat3 normalMatrix = glm::mat3( glm::transpose(glm::inverse(model)) );      // Used when the model matrix applies non-uniform scaling (normals won't be scaled correctly). Otherwise, use glm::vec3(model)
-    program.setMat3("normalMatrix", normalMatrix);
+    defines.push_back(getBiome(worldChunks.noise) == biomeDesert ? "BIOME_DESERT" : "BIOME_GRASSROCK");
 
-    // >>> Fragment shader uniforms
-    program.setInt  ("sun.lightType",       sunLight.lightType);
-    program.setVec3 ("sun.position",        sunLight.position);
-    program.setVec3 ("sun.direction",       sunLight.direction);
-    program.setVec3 ("sun.ambient",         sunLight.ambient);
-    program.setVec3 ("sun.diffuse",         sunLight.diffuse);
-    program.setVec3 ("sun.specular",        sunLight.specular);
-    program.setFloat("sun.constant",        sunLight.constant);
-    program.setFloat("sun.linear",          sunLight.linear);
-    program.setFloat("sun.quadratic",       sunLight.quadratic);
-    program.setFloat("sun.cutOff",          sunLight.cutOff);
-    program.setFloat("sun.outerCutOff",     sunLight.outerCutOff);
-
-    program.setVec3 ("grass.diffuse",       grass.diffuse);
-    program.setVec3 ("grass.specular",      grass.specular);
-    program.setFloat("grass.shininess",     grass.shininess);
-
-    program.setVec3 ("rock.diffuse",        rock.diffuse);
-    program.setVec3 ("rock.specular",       rock.specular);
-    program.setFloat("rock.shininess",      rock.shininess);
-
-    program.setVec3 ("snow.diffuse",        snow.diffuse);
-    program.setVec3 ("snow.specular",       snow.specular);
-    program.setFloat("snow.shininess",      snow.shininess);
-
-    //program.setVec3 ("sand.diffuse",       sand.diffuse);
-    //program.setVec3 ("sand.specular",      sand.specular);
-    program.setFloat("sand.shininess",      sand.shininess);
-
-    //program.setVec3 ("plainSand.diffuse",   sand.diffuse);
-    //program.setVec3 ("plainSand.specular",  sand.specular);
-    program.setFloat("plainSand.shininess", sand.shininess);
+    if(fogEnabled) defines.push_back("FOG");
 
-    program.setVec4 ("skyColor",            skyColor);
-    program.setFloat("fogMaxSquareRadius",  fogMaxR * fogMaxR);
-    program.setFloat("fogMinSquareRadius",  fogMinR * fogMinR);
+    if(shadingBench.running && shadingBench.pass == 0) defines.push_back("LIGHT_PER_MATERIAL");
+    if(terrainDraw.showOverdraw) defines.push_back("OVERDRAW");
 
-    program.setVec3 ("camPos",              cam.Position);
+    std::vector<std::string> backendDefines = backend.getDefines();
+    defines.insert(defines.end(), backendDefines.begin(), backendDefines.end());
 
-    // Textures uniforms
-    glActiveTexture(GL_TEXTURE0);               // Bind textures on corresponding texture unit
-    glBindTexture(GL_TEXTURE_2D, grass.diffuseT);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, grass.specularT);
+    return defines;
+}
 
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, rock.diffuseT);
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, rock.specularT);
+void startShadingBenchmark()
+{
+    shadingBench.running       = true;
+    shadingBench.warmup        = true;
+    shadingBench.pass          = 0;
+    shadingBench.frame         = 0;
+    shadingBench.gpuTime[0]    = shadingBench.gpuTime[1]  = 0;
+    shadingBench.wallTime[0]   = shadingBench.wallTime[1] = 0;
+    shadingBench.savedPosition = cam.Position;
+    shadingBench.savedYaw      = cam.Yaw;
+    shadingBench.savedPitch    = cam.Pitch;
+
+    if(!shadingBench.queries[0]) glGenQueries(2, shadingBench.queries);
+}
 
-    glActiveTexture(GL_TEXTURE4);
-    glBindTexture(GL_TEXTURE_2D, sand.diffuseT);
-    glActiveTexture(GL_TEXTURE5);
-    glBindTexture(GL_TEXTURE_2D, sand.specularT);
+void shadingBenchmarkPose()
+{
+    // Circle around the origin, looking at its center (same path in both passes)
+    float angle  = 2 * 3.14159265359f * shadingBench.frame / shadingBench.framesPerPass;
+    float radius = 200;
 
-    glActiveTexture(GL_TEXTURE6);
-    glBindTexture(GL_TEXTURE_2D, plainSand.diffuseT);
-    glActiveTexture(GL_TEXTURE7);
-    glBindTexture(GL_TEXTURE_2D, plainSand.specularT);
+    sim.setPose(glm::vec3(radius * std::cos(angle), radius * std::sin(angle), 120), glm::degrees(angle) + 180, -20);
 }
 
-void setUniformsWater(Shader& program)
+void shadingBenchmarkTimer(bool start)
+{
+    if(shadingBench.warmup)
+    {
+        if(!start && ++shadingBench.frame == shadingBench.framesPerPass)
+        {
+            shadingBench.warmup = false;
+            shadingBench.frame  = 0;
+        }
+        return;
+    }
+
+    glFinish();         // Only the terrain draws are measured (the pipeline is drained before and after them)
+
+    if(start)
+    {
+        shadingBench.start = std::chrono::steady_clock::now();
+        glQueryCounter(shadingBench.queries[0], GL_TIMESTAMP);
+        return;
+    }
+
+    glQueryCounter(shadingBench.queries[1], GL_TIMESTAMP);
+    shadingBench.wallTime[shadingBench.pass] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - shadingBench.start).count();
+
+    GLuint64 begin, end;
+    glGetQueryObjectui64v(shadingBench.queries[0], GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(shadingBench.queries[1], GL_QUERY_RESULT, &end);
+    shadingBench.gpuTime[shadingBench.pass] += (end - begin) / 1e6;
+
+    if(++shadingBench.frame < shadingBench.framesPerPass) return;
+    shadingBench.frame = 0;
+    if(++shadingBench.pass < 2) return;
+
+    // Finished
+    const char* names[2] = { "Lighting per material:", "Blended materials:    " };
+    std::cout << "Shading benchmark (terrain time per frame, " << shadingBench.framesPerPass << " frames per pass):" << std::endl;
+    for(unsigned i = 0; i < 2; i++)
+        std::cout << "    " << names[i] << "  GPU " << shadingBench.gpuTime[i] / shadingBench.framesPerPass << " ms"
+                  << "  wall " << shadingBench.wallTime[i] / shadingBench.framesPerPass << " ms" << std::endl;
+
+    shadingBench.running = false;
+    sim.setPose(shadingBench.savedPosition, shadingBench.savedYaw, shadingBench.savedPitch);
+}
+
+void setupTerrainProgram(Shader &program)
 {
     program.UseProgram();
+    program.setInt("materialMaps", 0);      // Tell OGL for each sampler to which texture unit it belongs to (only has to be done once)
+    program.setInt("vertexData", 9);        // INSTANCED (see instancedBackend)
+    program.setInt("splatData", 10);
 
-    // Vertex shader uniforms
-    glm::mat4 projection = cam.GetProjectionMatrix();
-    program.setMat4("projection", projection);
+    program.bindUniformBlock("Camera",   CAMERA_BLOCK_BINDING);
+    program.bindUniformBlock("Lighting", LIGHTING_BLOCK_BINDING);
+}
 
-    glm::mat4 view = cam.GetViewMatrix();
-    program.setMat4("view", view);
+void setupDepthProgram(Shader &program)
+{
+    program.UseProgram();
+    program.setInt("vertexData", 9);        // INSTANCED (see instancedBackend)
+    program.setInt("splatData", 10);
 
+    program.bindUniformBlock("Camera", CAMERA_BLOCK_BINDING);
+}
+
+void setUniformsTerrain(Shader &program)
+{
+    program.UseProgram();
+
+    // >>> Vertex shader uniforms (view and projection are in the Camera block)
     glm::mat4 model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
-    model = glm::rotate(model, 0.0f, glm::vec3(0.0f, 0.0f, 1.0f));
-    model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));
+    model[2][2] = worldChunks.verticalScale;
     program.setMat4("model", model);
 
-    glm::mat3 normalMatrix = glm::mat3( glm::transpose(glm::inverse(model)) );      // Used when the model matrix applies non-uniform scaling (normal won't be scaled correctly). Otherwise, use glm::vec3(model)
+    glm::mat3 normalMatrix = glm::mat3(1.0f);      // transpose(inverse(model)) for a vertical scaling
+    normalMatrix[2][2] = 1.f / worldChunks.verticalScale;
     program.setMat3("normalMatrix", normalMatrix);
 
-    // Fragment shader uniforms
-    program.setInt("sun.lightType",  sunLight.lightType);
-    program.setVec3("sun.position",  sunLight.position);
-    program.setVec3("sun.direction", sunLight.direction);
-    program.setVec3("sun.ambient",   sunLight.ambient);
-    program.setVec3("sun.diffuse",   sunLight.diffuse);
-    program.setVec3("sun.specular",  sunLight.specular);
-
-    program.setVec3("water.diffuse", water.diffuse);
-    program.setVec3("water.specular", water.specular);
-    program.setFloat("water.shininess", water.shininess);
+    // >>> Fragment shader uniforms (light and materials are in the Lighting block)
+    program.setVec4 ("skyColor",            skyColor);
+    program.setFloat("fogMaxSquareRadius",  fogMaxR * fogMaxR);
+    program.setFloat("fogMinSquareRadius",  fogMinR * fogMinR);
 
-    program.setVec3("viewPos", cam.Position);
+    // Textures uniforms
+    bindTextureArray(0, materialMaps);          // A single bind for all the terrain materials
 }
 
-void setUniformsAxis(Shader& program)
+void setUniformsDepth(Shader &program)
 {
     program.UseProgram();
 
-    // Vertex shader uniforms
-    glm::mat4 projection = cam.GetProjectionMatrix();
-    program.setMat4("projection", projection);
-
-    glm::mat4 view = cam.GetViewMatrix();
-    program.setMat4("view", view);
-
+    // Vertex shader uniforms (same as the terrain's, see setUniformsTerrain())
     glm::mat4 model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
-    model = glm::rotate(model, 0.0f, glm::vec3(0.0f, 0.0f, 1.0f));
-    model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));
+    model[2][2] = worldChunks.verticalScale;
     program.setMat4("model", model);
+    program.setMat3("normalMatrix", glm::mat3(1.0f));
 }
 
-void setUniformsSun(Shader& program, glm::vec3 direction, float sunFOV)
+void setUniformsWater(Shader& program)
 {
     program.UseProgram();
 
-    // Vertex shader uniforms
-    glm::mat4 projection = cam.GetProjectionMatrix();
-    program.setMat4("projection", projection);
+    // Vertex shader uniforms (view and projection are in the Camera block)
+    program.setMat4("model", glm::mat4(1.0f));
+    program.setMat3("normalMatrix", glm::mat3(1.0f));
+}
 
-    glm::mat4 view = cam.GetViewMatrix();
-    program.setMat4("view", view);
+void setUniformsAxis(Shader& program)
+{
+    program.UseProgram();
+
+    // Vertex shader uniforms (view and projection are in the Camera block)
+    program.setMat4("model", glm::mat4(1.0f));
+}
+
+void setUniformsSun(Shader& program, glm::vec3 direction, float sunFOV)
+{
+    program.UseProgram();
 
+    // Vertex shader uniforms (view and projection are in the Camera block)
     float angleZ   = std::atan(direction.x / direction.y);
     float angleX   = std:: atan(direction.z / std::sqrt(direction.x * direction.x + direction.y * direction.y)) + 3.14159265359/2;
     float distance = worldChunks.maxViewDist * 1.5;
@@ -719,8 +1136,7 @@ void setUniformsSun(Shader& program, glm::vec3 direction, float sunFOV)
     program.setMat4("model", model);
 
     // Textures uniforms
-    glActiveTexture(GL_TEXTURE8);
-    glBindTexture(GL_TEXTURE_2D, sun.diffuseT);
+    bindTexture2D(8, sun.diffuseT);
 }
 
 void setUniformsLightSource(Shader& program)
@@ -807,138 +1223,165 @@ void updateTerrain_X(std::map<BinaryKey, unsigned int> &VAO, std::map<BinaryKey,
     }
 }
 
-void updateTerrain(unsigned VAO, std::map<BinaryKey, unsigned int> &VBO, std::map<BinaryKey, unsigned int> &EBO)
+void updateTerrain(terrainBackend &backend, uploadRing &uploader, drawListBuilder &builder, const frameSnapshot &snapshot, std::vector<chunkDrawCall> &drawList, std::chrono::steady_clock::time_point budgetStart)
 {
-    glBindVertexArray(VAO);
-    int sizesAttribs[3] = {3, 2, 3};
-
-    // Delete OGL buffers (VAO, VBO, EBO) not existing in chunks dictionary
-    std::vector<BinaryKey> delet;
-
-    for(std::map<BinaryKey, unsigned int>::const_iterator it = VBO.begin();
-        it != VBO.end();
-        ++it)
     {
-        BinaryKey key = it->first;
-
-        if(worldChunks.chunkDict.find(key) == worldChunks.chunkDict.end())
-        {
-            //glDeleteVertexArrays(1, &VAO[key]);
-            glDeleteBuffers     (1, &VBO[key]);
-            glDeleteBuffers     (1, &EBO[key]);
-
-            delet.push_back(key);
-        }
+        std::unique_lock<std::mutex> lock(sim.worldMutex, std::try_to_lock);
+        if(lock.owns_lock())
+            backend.update(worldChunks, budgetStart);     // Delete the buffers of old chunks and stream new chunks (within the frame budget). If a tick is changing the chunks, it's done next frame.
     }
 
-    // Delete fields from all the std::maps, including the dictionary of chunks
-    for(size_t i = 0; i < delet.size(); i++)
     {
-        worldChunks.chunkDict.erase(delet[i]);
-        //VAO.erase(delet[i]);
-        VBO.erase(delet[i]);
-        EBO.erase(delet[i]);
+        PROFILE_ZONE("Upload flush");
+        uploader.flush();
     }
 
-    // Draw elements from the std::maps (VAO, VBO, EBO)
-    for(std::map<BinaryKey, terrainGenerator>::const_iterator it = worldChunks.chunkDict.begin();
-        it != worldChunks.chunkDict.end();
-        it++)
-    {
-        BinaryKey key = it->first;
-
-        // TODO: Creating new VAO requires (for some unknown reason) specifying "glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO)" before subsequent "glDrawElements()". Otherwise, segmentation fault happens.
-        // If key doesn't exist, create new field in VAO
-        if(VBO.find(key) == VBO.end())
-        {
-            //VAO[key] = createVAO();//ans2
+    // Chunks to draw (see terrainBackend::draw())
+    builder.build(snapshot, backend, terrainDraw.frustumCulling, terrainDraw.sortFrontToBack, drawList);
+}
 
-            VBO[key] = createVBO( sizeof(float) * worldChunks.getNumVertex() * 8,
-                                  worldChunks.chunkDict[key].vertex,
-                                  GL_STATIC_DRAW );
+void switchTerrainBackend(terrainBackend *&backend, terrainBackendType type, uploadRing &uploader)
+{
+    delete backend;             // Chunks are uploaded again by the new backend in the next frames
+    backend = createTerrainBackend(type, uploader);
+    std::cout << "Terrain backend: " << backend->getName() << std::endl;
+}
 
-            EBO[key] = createEBO(sizeof(unsigned) * worldChunks.getNumIndices(),
-                                 worldChunks.chunkDict[key].indices,
-                                 GL_STATIC_DRAW );
+void terrainStatsQuery(bool start)
+{
+    unsigned &query = terrainDraw.queries[terrainDraw.frame % 2];
 
-            //int sizesAttribs[3] = {3, 2, 3};
-            //configVAO( VAO, VBO[key], EBO[key], sizesAttribs, 3 );
+    if(start)
+    {
+        if(!query) glGenQueries(1, &query);
+        else
+        {
+            // Result of the frame before the previous one (if it is not available yet, it is dropped)
+            GLint available;
+            glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if(available)
+            {
+                GLuint64 samples;
+                glGetQueryObjectui64v(query, GL_QUERY_RESULT, &samples);
+                terrainDraw.fragmentsPerPixel = (double)samples / std::max(1, cam.width * cam.height);
+            }
         }
 
-        //Draw elements from the std::maps
-        //setUniformsTest(testProg);           // Set uniforms
-
-        configVAO(VAO, VBO[key], EBO[key], sizesAttribs, 3, false);
-        //glBindVertexArray(VAO);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO[key]);
-        glDrawElements(GL_TRIANGLES, 2 * 3, GL_UNSIGNED_INT, nullptr);
-        glDrawElements(GL_TRIANGLES, worldChunks.getNumIndices(), GL_UNSIGNED_INT, nullptr);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        glBeginQuery(GL_SAMPLES_PASSED, query);
+        return;
     }
+
+    glEndQuery(GL_SAMPLES_PASSED);
+    terrainDraw.frame++;
 }
 
-void updateTerrain(std::map<BinaryKey, unsigned int> &VAO, std::map<BinaryKey, unsigned int> &VBO, std::map<BinaryKey, unsigned int> &EBO)
+void GUI_gpuProfiler(gpuProfiler &profiler)
 {
-    // Delete OGL buffers (VAO, VBO, EBO) not existing in chunks dictionary
-    std::vector<BinaryKey> delet;
+    ImGui::Begin("GPU time");
 
-    for(std::map<BinaryKey, unsigned int>::const_iterator it = VAO.begin();
-        it != VAO.end();
-        ++it)
+    if(!profiler.isSupported())
+        ImGui::Text("Timer queries not available");
+    else
     {
-        BinaryKey key = it->first;
-
-        if(worldChunks.chunkDict.find(key) == worldChunks.chunkDict.end())
+        double total = profiler.getTotal();
+        for(unsigned i = 0; i < profiler.getNumPasses(); i++)
         {
-            glDeleteVertexArrays(1, &VAO[key]);
-            glDeleteBuffers     (1, &VBO[key]);
-            glDeleteBuffers     (1, &EBO[key]);
-
-            delet.push_back(key);
+            ImGui::ProgressBar(total > 0 ? profiler.getTime(i) / total : 0, ImVec2(100, 0), "");
+            ImGui::SameLine();
+            ImGui::Text("%-15s %6.2f ms (avg. %6.2f)", profiler.getPassName(i).c_str(), profiler.getTime(i), profiler.getAverage(i));
         }
-    }
+        ImGui::Text("Total: %.2f ms (%zu frames dropped)", total, profiler.getNumDropped());
 
-    // Delete fields from all the std::maps, including the dictionary of chunks
-    for(size_t i = 0; i < delet.size(); i++)
-    {
-        worldChunks.chunkDict.erase(delet[i]);
-        VAO.erase(delet[i]);
-        VBO.erase(delet[i]);
-        EBO.erase(delet[i]);
+        if(ImGui::Button("Export CSV"))
+            profiler.exportCSV(path_cache + "gpuProfile.csv");
     }
 
-    // Draw elements from the std::maps (VAO, VBO, EBO)
-    for(std::map<BinaryKey, terrainGenerator>::const_iterator it = worldChunks.chunkDict.begin();
-        it != worldChunks.chunkDict.end();
-        it++)
-    {
-        BinaryKey key = it->first;
+    ImGui::End();
+}
 
-        // TODO: Creating new VAO requires (for some unknown reason) specifying "glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO)" before subsequent "glDrawElements()". Otherwise, segmentation fault happens.
-        // If key doesn't exist, create new field in VAO
-        if(VAO.find(key) == VAO.end())
-        {
-            VAO[key] = createVAO();
+void GUI_frameTime()
+{
+    ImGui::Begin("Frame time");
 
-            VBO[key] = createVBO( sizeof(float) * worldChunks.getNumVertex() * 8,
-                                  worldChunks.chunkDict[key].vertex,
-                                  GL_STATIC_DRAW );
+    const frameTimeStats &stats = timer.getStats();
+    ImGui::Text("FPS: %d (1%% low: %.1f)", timer.getFPS(), stats.low1FPS);
+    ImGui::Text("Mean: %.2f ms   p50: %.2f   p95: %.2f   p99: %.2f   max: %.2f", stats.mean, stats.p50, stats.p95, stats.p99, stats.max);
+    ImGui::Text("Hitches: %zu in %zu frames   Work: %.2f ms", stats.hitches, stats.numFrames, (double)timer.getWorkTime() * 1000);
 
-            EBO[key] = createEBO(sizeof(unsigned) * worldChunks.getNumIndices(),
-                                 worldChunks.chunkDict[key].indices,
-                                 GL_STATIC_DRAW );
+    int maxFPS = timer.getMaxFPS();
+    if(ImGui::SliderInt("Max. FPS", &maxFPS, 0, 240)) timer.setMaxFPS(maxFPS);      // 0: no limit
 
-            int sizesAttribs[3] = {3, 2, 3};
-            configVAO( VAO[key], VBO[key], EBO[key], sizesAttribs, 3 );
-        }
+    static std::vector<float> values;
+    timer.getFrameTimes(values);
+    float scaleMax = std::max(2 * (float)stats.p99, 1.f);
+    ImGui::PlotLines("Frame times", values.data(), values.size(), 0, nullptr, 0, scaleMax, ImVec2(0, 60));
 
-        //Draw elements from the std::maps
-        glBindVertexArray(VAO[key]);    // TODO: Use a single VAO for all terrain chunks, if possible
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO[key]);
-        glDrawElements(GL_TRIANGLES, worldChunks.getNumIndices(), GL_UNSIGNED_INT, nullptr);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    timer.getHistogram(values, scaleMax / 50, scaleMax);
+    ImGui::PlotHistogram("Histogram", values.data(), values.size(), 0, "0 - 2 x p99", 0, FLT_MAX, ImVec2(0, 60));
+
+    ImGui::End();
+}
+
+void GUI_cpuProfiler()
+{
+    ImGui::Begin("CPU time");
+
+#ifndef CPU_PROFILER_ENABLED
+    ImGui::Text("Profiling zones not compiled (release build without CPU_PROFILER)");
+#else
+    static bool paused = false;
+    static std::vector<cpuZoneEvent> zones;
+    static int64_t frameStart = 0, frameEnd = 1;
+
+    if(!paused) cpuProfiler::get().getLastFrame(zones, frameStart, frameEnd);
+
+    ImGui::Checkbox("Pause", &paused);
+    ImGui::SameLine();
+    if(ImGui::Button("Export trace (F9)"))
+        cpuProfiler::get().exportChromeTrace(path_cache + "cpuTrace.json");
+    ImGui::Text("Frame: %.2f ms", (frameEnd - frameStart) / 1e6);
+
+    // Flame view: one row per thread and depth, bars scaled to the frame duration
+    const float rowHeight = ImGui::GetTextLineHeightWithSpacing();
+    const float width     = std::max(ImGui::GetContentRegionAvail().x, 100.f);
+    const double scale    = width / double(std::max<int64_t>(frameEnd - frameStart, 1));
+    ImVec2 origin         = ImGui::GetCursorScreenPos();
+    ImDrawList* draw      = ImGui::GetWindowDrawList();
+
+    std::map<uint32_t, uint32_t> threadDepths;             // Max. depth of each thread (rows)
+    for(const cpuZoneEvent &zone : zones)
+        threadDepths[zone.thread] = std::max(threadDepths[zone.thread], zone.depth + 1);
+
+    std::map<uint32_t, float> threadRows;                  // First row of each thread
+    float numRows = 0;
+    for(const std::pair<const uint32_t, uint32_t> &thread : threadDepths)
+    {
+        threadRows[thread.first] = numRows;
+        numRows += thread.second;
+    }
+
+    for(const cpuZoneEvent &zone : zones)
+    {
+        float x0 = origin.x + std::max(zone.start - frameStart, int64_t(0)) * scale;
+        float x1 = origin.x + std::min(zone.end - frameStart, frameEnd - frameStart) * scale;
+        float y0 = origin.y + (threadRows[zone.thread] + zone.depth) * rowHeight;
+        if(x1 - x0 < 1) x1 = x0 + 1;
+
+        ImVec2 min(x0, y0), max(x1, y0 + rowHeight - 1);
+        ImU32 color = ImColor::HSV((zone.thread * 0.25f + zone.depth * 0.08f) - int(zone.thread * 0.25f + zone.depth * 0.08f), 0.6f, 0.7f);
+        draw->AddRectFilled(min, max, color);
+        draw->PushClipRect(min, max, true);
+        draw->AddText(ImVec2(x0 + 2, y0), IM_COL32_WHITE, zone.name);
+        draw->PopClipRect();
+
+        if(ImGui::IsMouseHoveringRect(min, max))
+            ImGui::SetTooltip("%s\n%.3f ms (thread %u)", zone.name, (zone.end - zone.start) / 1e6, zone.thread);
     }
+
+    ImGui::Dummy(ImVec2(width, std::max(numRows, 1.f) * rowHeight));
+#endif
+
+    ImGui::End();
 }
 
 void setUniformsTest(Shader &program)
@@ -0,0 +1,166 @@
+#include "occlusion.hpp"
+#include "canvas.hpp"
+#include "cpuProfiler.hpp"
+
+// occlusionCuller -----------------------------------------------------------------
+
+const float occlusionCuller::nearMargin = 1;
+
+occlusionCuller::occlusionCuller()
+    : frame(0), numTested(0), numOccluded(0)
+{
+    float    vertex[8][3]  = { {0,0,0}, {1,0,0}, {1,1,0}, {0,1,0}, {0,0,1}, {1,0,1}, {1,1,1}, {0,1,1} };
+    unsigned indices[12][3] = { {0,2,1}, {0,3,2},       // Bottom
+                                {4,5,6}, {4,6,7},       // Top
+                                {0,1,5}, {0,5,4},       // Front (y = 0)
+                                {2,3,7}, {2,7,6},       // Back (y = 1)
+                                {1,2,6}, {1,6,5},       // Right (x = 1)
+                                {3,0,4}, {3,4,7} };     // Left (x = 0)
+
+    VAO = createVAO();
+    VBO = createVBO(sizeof(vertex), vertex, GL_STATIC_DRAW);
+    EBO = createEBO(sizeof(indices), indices, GL_STATIC_DRAW);
+
+    int sizesAtribs[1] = { 3 };
+    configVAO(VAO, VBO, EBO, sizesAtribs, 1);
+}
+
+occlusionCuller::~occlusionCuller()
+{
+    clear();
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &VBO);
+    glDeleteBuffers(1, &EBO);
+}
+
+void occlusionCuller::beginFrame(const frameSnapshot &snapshot, const std::vector<chunkDrawCall> &drawList)
+{
+    PROFILE_ZONE("Occlusion results");
+
+    frame++;
+    numTested = numOccluded = 0;
+    conditions.assign(drawList.size(), 0);
+    const glm::vec3 &camPos = snapshot.camera.Position;
+
+    for(size_t i = 0; i < drawList.size(); i++)
+    {
+        const visibleChunk &chunk = snapshot.chunks[drawList[i].chunk];
+
+        std::map<BinaryKey, chunkQuery>::iterator it = queries.find(chunk.key);
+        if(it == queries.end())
+        {
+            chunkQuery query = { 0, frame, false };
+            if(freeQueries.empty()) glGenQueries(1, &query.query);
+            else
+            {
+                query.query = freeQueries.back();
+                freeQueries.pop_back();
+            }
+            queries.insert(std::pair<BinaryKey, chunkQuery>(chunk.key, query));
+            continue;                       // No result yet
+        }
+
+        chunkQuery &query = it->second;
+        query.frame = frame;
+        if(!query.issued) continue;
+
+        if(glm::all(glm::greaterThan(camPos, chunk.boxMin - nearMargin)) && glm::all(glm::lessThan(camPos, chunk.boxMax + nearMargin)))
+            continue;                       // The box may be clipped by the near plane
+
+        conditions[i] = query.query;
+        numTested++;
+
+        GLuint available, samplesPassed;
+        glGetQueryObjectuiv(query.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available) continue;            // Drawn (GL_QUERY_NO_WAIT), unless the result arrives before the draw call runs
+        glGetQueryObjectuiv(query.query, GL_QUERY_RESULT, &samplesPassed);
+        if(!samplesPassed) numOccluded++;
+    }
+
+    // Release the queries of the chunks no longer drawn (their results would be stale when they come back)
+    for(std::map<BinaryKey, chunkQuery>::iterator it = queries.begin(); it != queries.end(); )
+        if(it->second.frame != frame)
+        {
+            freeQueries.push_back(it->second.query);
+            it = queries.erase(it);
+        }
+        else ++it;
+}
+
+void occlusionCuller::draw(terrainBackend &backend, const std::vector<chunkDrawCall> &drawList)
+{
+    if(conditions.size() != drawList.size())
+    {
+        backend.draw(drawList);             // beginFrame() wasn't called with this list
+        return;
+    }
+
+    // Runs of unconditional chunks are drawn together, so the draw order is kept
+    run.clear();
+    for(size_t i = 0; i < drawList.size(); i++)
+    {
+        if(!conditions[i])
+        {
+            run.push_back(drawList[i]);
+            continue;
+        }
+
+        if(!run.empty()) backend.draw(run);
+        run.assign(1, drawList[i]);
+
+        glBeginConditionalRender(conditions[i], GL_QUERY_NO_WAIT);
+        backend.draw(run);
+        glEndConditionalRender();
+        run.clear();
+    }
+
+    if(!run.empty()) backend.draw(run);
+}
+
+void occlusionCuller::issueQueries(Shader &program, const frameSnapshot &snapshot, const std::vector<chunkDrawCall> &drawList)
+{
+    if(drawList.empty()) return;
+
+    program.UseProgram();
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glDepthFunc(GL_LEQUAL);                 // Box faces on the chunk's own surface count as visible
+    glBindVertexArray(VAO);
+
+    for(const chunkDrawCall &drawCall : drawList)
+    {
+        const visibleChunk &chunk = snapshot.chunks[drawCall.chunk];
+        std::map<BinaryKey, chunkQuery>::iterator it = queries.find(chunk.key);
+        if(it == queries.end()) continue;   // beginFrame() wasn't called with this list
+
+        program.setVec3("boxMin",  chunk.boxMin);
+        program.setVec3("boxSize", chunk.boxMax - chunk.boxMin);
+
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, it->second.query);
+        glDrawElements(GL_TRIANGLES, 12 * 3, GL_UNSIGNED_INT, nullptr);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        it->second.issued = true;
+    }
+
+    glBindVertexArray(0);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+void occlusionCuller::clear()
+{
+    for(const std::pair<const BinaryKey, chunkQuery> &query : queries)
+        freeQueries.push_back(query.second.query);
+
+    if(!freeQueries.empty()) glDeleteQueries(freeQueries.size(), freeQueries.data());
+
+    queries.clear();
+    freeQueries.clear();
+    conditions.clear();
+    numTested = numOccluded = 0;
+}
+
+size_t occlusionCuller::getNumTested() const { return numTested; }
+
+size_t occlusionCuller::getNumOccluded() const { return numOccluded; }
@@ -0,0 +1,252 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include "replay.hpp"
+
+// cameraPath -----------------------------------------------------------------
+
+bool cameraPath::load(const std::string &file)
+{
+    std::ifstream input(file);
+    if(!input.is_open())
+    {
+        std::cout << "Camera path: cannot read " << file << std::endl;
+        return false;
+    }
+
+    keys.clear();
+    std::string line;
+    while(std::getline(input, line))
+    {
+        if(line.empty() || line[0] == '#') continue;
+
+        std::istringstream values(line);
+        key newKey;
+        if(values >> newKey.time >> newKey.position.x >> newKey.position.y >> newKey.position.z >> newKey.yaw >> newKey.pitch)
+            keys.push_back(newKey);
+    }
+
+    std::stable_sort(keys.begin(), keys.end(), [](const key &a, const key &b) { return a.time < b.time; });
+
+    if(keys.empty()) std::cout << "Camera path: no keys in " << file << std::endl;
+    return !keys.empty();
+}
+
+bool cameraPath::save(const std::string &file) const
+{
+    std::ofstream output(file);
+    if(!output.is_open())
+    {
+        std::cout << "Camera path: cannot write " << file << std::endl;
+        return false;
+    }
+
+    output << "# time x y z yaw pitch\n";
+    for(const key &k : keys)
+        output << k.time << " " << k.position.x << " " << k.position.y << " " << k.position.z << " " << k.yaw << " " << k.pitch << "\n";
+
+    std::cout << "Camera path: " << keys.size() << " keys saved in " << file << std::endl;
+    return true;
+}
+
+void cameraPath::addKey(double time, glm::vec3 position, float yaw, float pitch) { keys.push_back( { time, position, yaw, pitch } ); }
+
+void cameraPath::clear() { keys.clear(); }
+
+size_t cameraPath::size() const { return keys.size(); }
+
+double cameraPath::getDuration() const { return keys.empty() ? 0 : keys.back().time; }
+
+bool cameraPath::getPose(double time, glm::vec3 &position, float &yaw, float &pitch) const
+{
+    if(keys.empty()) return false;
+
+    std::vector<key>::const_iterator next = std::upper_bound(keys.begin(), keys.end(), time, [](double t, const key &k) { return t < k.time; });
+
+    if(next == keys.begin() || next == keys.end())      // Before the first key or after the last one
+    {
+        const key &k = (next == keys.begin() ? keys.front() : keys.back());
+        position = k.position;
+        yaw      = k.yaw;
+        pitch    = k.pitch;
+        return true;
+    }
+
+    const key &a = *(next - 1), &b = *next;
+    float t  = (b.time > a.time ? (time - a.time) / (b.time - a.time) : 1);
+    position = a.position + (b.position - a.position) * t;
+    yaw      = a.yaw   + (b.yaw   - a.yaw)   * t;      // Yaw isn't wrapped, so recorded turns are replayed as they were
+    pitch    = a.pitch + (b.pitch - a.pitch) * t;
+    return true;
+}
+
+// replayBenchmark -----------------------------------------------------------------
+
+size_t replayBenchmark::getNumFrames() const { return std::floor(path.getDuration() / timeStep) + 1; }
+
+double replayBenchmark::getTime(size_t frame) const { return frame * timeStep; }
+
+void replayBenchmark::beginRun(const std::string &name, size_t firstFrame) { runs.push_back( { name, firstFrame } ); }
+
+size_t replayBenchmark::getRun() const { return runs.empty() ? 0 : runs.size() - 1; }
+
+size_t replayBenchmark::getRunFrame(size_t frame) const { return runs.empty() ? frame : frame - runs.back().firstFrame; }
+
+void replayBenchmark::addFrame(const benchmarkFrame &frame) { frames.push_back(frame); }
+
+void replayBenchmark::setGpuTime(size_t frame, double gpuTime, double terrainGpuTime)
+{
+    if(frame < frames.size())
+    {
+        frames[frame].gpuTime        = gpuTime;
+        frames[frame].terrainGpuTime = terrainGpuTime;
+    }
+}
+
+replayBenchmark::runSummary replayBenchmark::summarize(size_t firstFrame, size_t endFrame) const
+{
+    // The first frame includes the initial chunk generation; it's kept (it's part of the run), and shows up as max
+    runSummary summary = { };
+    std::vector<double> times;
+    double sum = 0, submitSum = 0, gpuSum = 0, terrainSum = 0;
+    size_t gpuFrames = 0;
+
+    for(size_t i = firstFrame; i < endFrame && i < frames.size(); i++)
+    {
+        const benchmarkFrame &f = frames[i];
+        times.push_back(f.frameTime);
+        sum       += f.frameTime;
+        submitSum += f.submitTime;
+        if(f.gpuTime >= 0) { gpuSum += f.gpuTime; terrainSum += f.terrainGpuTime; gpuFrames++; }
+        summary.generated   += f.chunksGenerated;
+        summary.loaded      += f.chunksLoaded;
+        summary.peakMemoryKB = std::max(summary.peakMemoryKB, f.memoryKB);
+        summary.peakGpuKB    = std::max(summary.peakGpuKB, f.gpuKB);
+    }
+    std::sort(times.begin(), times.end());
+
+    auto percentile = [&times](double p) { return times.empty() ? 0 : times[std::max(0, (int)std::ceil(p * times.size()) - 1)]; };
+
+    summary.numFrames      = times.size();
+    summary.mean           = times.empty() ? 0 : sum / times.size();
+    summary.p50            = percentile(0.5);
+    summary.p95            = percentile(0.95);
+    summary.p99            = percentile(0.99);
+    summary.max            = times.empty() ? 0 : times.back();
+    summary.submitMean     = times.empty() ? 0 : submitSum / times.size();
+    summary.gpuMean        = gpuFrames ? gpuSum / gpuFrames : -1;
+    summary.terrainGpuMean = gpuFrames ? terrainSum / gpuFrames : -1;
+    return summary;
+}
+
+bool replayBenchmark::writeCSV(const std::string &file) const
+{
+    std::ofstream output(file);
+    if(!output.is_open())
+    {
+        std::cout << "Benchmark: cannot write " << file << std::endl;
+        return false;
+    }
+
+    output << "run,frame,time,frame_ms,submit_ms,gpu_ms,terrain_gpu_ms,chunks,chunks_generated,chunks_loaded,chunks_drawn,memory_kb,gpu_kb\n";
+    for(const benchmarkFrame &f : frames)
+        output << (f.run < runs.size() ? runs[f.run].name : "") << "," << f.frame << "," << f.time << "," << f.frameTime << "," << f.submitTime << ","
+               << f.gpuTime << "," << f.terrainGpuTime << "," << f.chunks << "," << f.chunksGenerated << "," << f.chunksLoaded << ","
+               << f.chunksDrawn << "," << f.memoryKB << "," << f.gpuKB << "\n";
+
+    std::cout << "Benchmark: " << frames.size() << " frames saved in " << file << std::endl;
+    return true;
+}
+
+bool replayBenchmark::writeJSON(const std::string &file, const std::string &renderer) const
+{
+    std::ofstream output(file);
+    if(!output.is_open())
+    {
+        std::cout << "Benchmark: cannot write " << file << std::endl;
+        return false;
+    }
+
+    auto escape = [](const std::string &text)
+    {
+        std::string escaped;
+        for(char c : text)
+        {
+            if(c == '"' || c == '\\') escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    };
+
+    auto writeSummary = [&output](const runSummary &s, const std::string &indent)
+    {
+        output << indent << "\"frames\": " << s.numFrames << ",\n"
+               << indent << "\"frame_ms\": { \"mean\": " << s.mean << ", \"p50\": " << s.p50 << ", \"p95\": " << s.p95
+               << ", \"p99\": " << s.p99 << ", \"max\": " << s.max << " },\n"
+               << indent << "\"submit_ms_mean\": " << s.submitMean << ",\n"
+               << indent << "\"gpu_ms_mean\": " << s.gpuMean << ",\n"
+               << indent << "\"terrain_gpu_ms_mean\": " << s.terrainGpuMean << ",\n"
+               << indent << "\"chunks_generated\": " << s.generated << ",\n"
+               << indent << "\"chunks_loaded\": " << s.loaded << ",\n"
+               << indent << "\"peak_memory_kb\": " << s.peakMemoryKB << ",\n"
+               << indent << "\"peak_gpu_kb\": " << s.peakGpuKB;
+    };
+
+    output << "{\n"
+           << "  \"path\": \"" << escape(pathFile) << "\",\n"
+           << "  \"renderer\": \"" << escape(renderer) << "\",\n"
+           << "  \"time_step\": " << timeStep << ",\n";
+    writeSummary(summarize(0, frames.size()), "  ");
+
+    output << ",\n  \"runs\": [";
+    for(size_t i = 0; i < runs.size(); i++)
+    {
+        output << (i ? ",\n" : "\n") << "    {\n      \"name\": \"" << escape(runs[i].name) << "\",\n";
+        writeSummary(summarize(runs[i].firstFrame, i + 1 < runs.size() ? runs[i + 1].firstFrame : frames.size()), "      ");
+        output << "\n    }";
+    }
+    output << (runs.empty() ? "]\n" : "\n  ]\n") << "}\n";
+
+    std::cout << "Benchmark: summary saved in " << file << std::endl;
+    return true;
+}
+
+void replayBenchmark::printSummary() const
+{
+    if(runs.empty()) return;
+
+    std::cout << "Benchmark (ms; GPU memory in KB):\n"
+              << std::left << std::setw(14) << "run" << std::right
+              << std::setw(10) << "frame" << std::setw(10) << "p99" << std::setw(10) << "submit" << std::setw(10) << "gpu"
+              << std::setw(10) << "terrain" << std::setw(10) << "gpu KB" << "\n"
+              << std::fixed << std::setprecision(3);
+
+    for(size_t i = 0; i < runs.size(); i++)
+    {
+        runSummary s = summarize(runs[i].firstFrame, i + 1 < runs.size() ? runs[i + 1].firstFrame : frames.size());
+        std::cout << std::left << std::setw(14) << runs[i].name << std::right
+                  << std::setw(10) << s.mean << std::setw(10) << s.p99 << std::setw(10) << s.submitMean << std::setw(10) << s.gpuMean
+                  << std::setw(10) << s.terrainGpuMean << std::setw(10) << s.peakGpuKB << "\n";
+    }
+
+    std::cout << std::defaultfloat << std::flush;
+}
+
+size_t replayBenchmark::getResidentMemory()
+{
+#ifdef __linux__
+    std::ifstream statm("/proc/self/statm");
+    size_t size = 0, resident = 0;
+    if(statm >> size >> resident)
+        return resident * (sysconf(_SC_PAGESIZE) / 1024);
+#endif
+    return 0;
+}
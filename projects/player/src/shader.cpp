@@ -1,5 +1,29 @@
+#include <vector>
+#include <chrono>
+#include <iomanip>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/stat.h>
+#elif defined(_WIN32)
+#include <direct.h>
+#endif
+
 #include "shader.hpp"
 
+#define PROGRAM_BINARY_VERSION 1
+
+struct programBinaryHeader
+{
+    char     magic[8];          ///< "PROGRBIN"
+    uint32_t version;
+    uint32_t format;            ///< Binary format returned by glGetProgramBinary
+    uint64_t key;               ///< Shader::binaryKey()
+    uint64_t length;            ///< Bytes of binary data after the header
+};
+
+std::string Shader::binaryCacheDirectory;
+
 void Shader::checkCompileErrors(unsigned int shaderID, std::string type)
 {
     int success;
@@ -27,7 +51,7 @@ void Shader::checkCompileErrors(unsigned int shaderID, std::string type)
     }
 }
 
-Shader::Shader(const char *vertexPath, const char *fragmentPath)
+Shader::Shader(const char *vertexPath, const char *fragmentPath, const std::vector<std::string> &defines)
 {
     // 1) Retrieve the shaders source code the paths
 
@@ -60,10 +84,55 @@ Shader::Shader(const char *vertexPath, const char *fragmentPath)
         std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
     }
 
+    // Insert the defines after the #version line
+    if(defines.size())
+    {
+        std::string defineLines;
+        for(const std::string &define : defines) defineLines += "#define " + define + "\n";
+
+        for(std::string *source : { &vertexString, &fragmentString })
+        {
+            size_t version = source->find("#version");
+            size_t lineEnd = (version == std::string::npos ? std::string::npos : source->find('\n', version));
+            if(lineEnd == std::string::npos) source->insert(0, defineLines);
+            else source->insert(lineEnd + 1, defineLines);
+        }
+    }
+
     const char *vertexCode = vertexString.c_str();
     const char *fragmentCode = fragmentString.c_str();
 
-    // 2) Compile the shaders and the program
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ID = glCreateProgram();
+    fromBinaryCache = false;
+
+    // 2) Try the binary cache (glGetProgramBinary is loaded only if GL >= 4.1 or ARB_get_program_binary)
+
+    int numBinaryFormats = 0;
+    bool useCache = !binaryCacheDirectory.empty() && glGetProgramBinary && glProgramBinary;
+    if(useCache) glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numBinaryFormats);
+    useCache = useCache && numBinaryFormats > 0;
+
+    uint64_t key = 0;
+    std::ostringstream binaryFile;
+    if(useCache)
+    {
+        key = binaryKey(vertexString, fragmentString);
+        binaryFile << binaryCacheDirectory << "program_" << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+        fromBinaryCache = loadBinary(binaryFile.str(), key);
+    }
+
+    const char *vertexName   = std::strrchr(vertexPath, '/')   ? std::strrchr(vertexPath, '/') + 1   : vertexPath;
+    const char *fragmentName = std::strrchr(fragmentPath, '/') ? std::strrchr(fragmentPath, '/') + 1 : fragmentPath;
+
+    if(fromBinaryCache)
+    {
+        buildTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Shader " << vertexName << " + " << fragmentName << ": loaded from binary cache in " << buildTime << " ms" << std::endl;
+        return;
+    }
+
+    // 3) Compile the shaders and the program
 
     unsigned int vertexID, fragmentID;
 
@@ -77,14 +146,97 @@ Shader::Shader(const char *vertexPath, const char *fragmentPath)
     glCompileShader(fragmentID);
     checkCompileErrors(fragmentID, "FRAGMENT");
 
-    ID = glCreateProgram();
     glAttachShader(ID, vertexID);
     glAttachShader(ID, fragmentID);
+    if(useCache) glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(ID);
     checkCompileErrors(ID, "PROGRAM");
 
+    glDetachShader(ID, vertexID);
+    glDetachShader(ID, fragmentID);
     glDeleteShader(vertexID);
     glDeleteShader(fragmentID);
+
+    buildTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Shader " << vertexName << " + " << fragmentName << ": compiled and linked in " << buildTime << " ms" << std::endl;
+
+    if(useCache) saveBinary(binaryFile.str(), key);
+}
+
+uint64_t Shader::binaryKey(const std::string &vertexCode, const std::string &fragmentCode) const
+{
+    // FNV-1a hash
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](const char* data)
+    {
+        for(size_t i = 0; data && data[i]; i++)
+        {
+            hash ^= (unsigned char)data[i];
+            hash *= 1099511628211ull;
+        }
+        hash ^= 0xFF;                       // Separator
+        hash *= 1099511628211ull;
+    };
+
+    add(vertexCode.c_str());
+    add(fragmentCode.c_str());
+    add((const char*)glGetString(GL_VENDOR));
+    add((const char*)glGetString(GL_RENDERER));
+    add((const char*)glGetString(GL_VERSION));
+
+    return hash;
+}
+
+bool Shader::loadBinary(const std::string &fileName, uint64_t key)
+{
+    std::ifstream file(fileName, std::ios::binary);
+    if(!file.is_open()) return false;
+
+    programBinaryHeader header;
+    if(!file.read((char*)&header, sizeof(header))) return false;
+    if(std::memcmp(header.magic, "PROGRBIN", 8) || header.version != PROGRAM_BINARY_VERSION || header.key != key) return false;
+
+    std::vector<char> binary(header.length);
+    if(!file.read(binary.data(), binary.size())) return false;
+
+    glProgramBinary(ID, header.format, binary.data(), binary.size());
+
+    int success;
+    glGetProgramiv(ID, GL_LINK_STATUS, &success);       // The driver may reject the binary (e.g. after an update)
+    if(!success) std::cout << "Shader: binary " << fileName << " rejected by the driver. Compiling the sources." << std::endl;
+    return success;
+}
+
+void Shader::saveBinary(const std::string &fileName, uint64_t key)
+{
+    int success, length = 0;
+    glGetProgramiv(ID, GL_LINK_STATUS, &success);
+    glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(!success || length <= 0) return;
+
+    std::vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(ID, length, &length, &format, binary.data());
+
+#if defined(__unix__) || defined(__APPLE__)
+    mkdir(binaryCacheDirectory.c_str(), 0755);
+#elif defined(_WIN32)
+    _mkdir(binaryCacheDirectory.c_str());
+#endif
+
+    std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+    if(!file.is_open()) return;
+
+    programBinaryHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "PROGRBIN", 8);
+    header.version = PROGRAM_BINARY_VERSION;
+    header.format  = format;
+    header.key     = key;
+    header.length  = length;
+
+    file.write((const char*)&header, sizeof(header));
+    file.write(binary.data(), length);
 }
 
 void Shader::UseProgram()
@@ -94,60 +246,116 @@ void Shader::UseProgram()
 
 // Uniforms setting ---------------
 
+int Shader::getUniformLocation(const std::string &name) const
+{
+    std::unordered_map<std::string, int>::const_iterator it = uniformLocations.find(name);
+    if(it != uniformLocations.end()) return it->second;
+
+    int location = glGetUniformLocation(ID, name.c_str());
+    uniformLocations[name] = location;
+    return location;
+}
+
+void Shader::bindUniformBlock(const std::string &blockName, unsigned bindingPoint)
+{
+    unsigned index = glGetUniformBlockIndex(ID, blockName.c_str());
+    if(index != GL_INVALID_INDEX)
+        glUniformBlockBinding(ID, index, bindingPoint);
+}
+
 void Shader::setBool(const std::string &name, bool value) const
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    glUniform1i(getUniformLocation(name), (int)value);
 }
 
 void Shader::setInt(const std::string &name, int value) const
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1i(getUniformLocation(name), value);
 }
 
 void Shader::setFloat(const std::string &name, float value) const
 {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1f(getUniformLocation(name), value);
 }
 
 void Shader::setVec2(const std::string &name, const glm::vec2 &value) const
 {
-    glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    glUniform2fv(getUniformLocation(name), 1, &value[0]);
 }
 void Shader::setVec2(const std::string &name, float x, float y) const
 {
-    glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+    glUniform2f(getUniformLocation(name), x, y);
 }
 
 void Shader::setVec3(const std::string &name, const glm::vec3 &value) const
 {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    glUniform3fv(getUniformLocation(name), 1, &value[0]);
 }
 void Shader::setVec3(const std::string &name, float x, float y, float z) const
 {
-    glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+    glUniform3f(getUniformLocation(name), x, y, z);
 }
 
 void Shader::setVec4(const std::string &name, const glm::vec4 &value) const
 {
-    glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    glUniform4fv(getUniformLocation(name), 1, &value[0]);
 }
 
 void Shader::setVec4(const std::string &name, float x, float y, float z, float w) const
 {
-    glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+    glUniform4f(getUniformLocation(name), x, y, z, w);
 }
 
 void Shader::setMat2(const std::string &name, const glm::mat2 &mat) const
 {
-    glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+    glUniformMatrix2fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
 }
 
 void Shader::setMat3(const std::string &name, const glm::mat3 &mat) const
 {
-    glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+    glUniformMatrix3fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
 }
 
 void Shader::setMat4(const std::string &name, const glm::mat4 &mat) const
 {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+    glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
+}
+
+// shaderVariants -----------------------------------------------------------------
+
+shaderVariants::shaderVariants(const std::string &vertexPath, const std::string &fragmentPath, std::function<void(Shader&)> setup)
+    : vertexPath(vertexPath), fragmentPath(fragmentPath), setup(setup) { }
+
+shaderVariants::~shaderVariants()
+{
+    for(std::map<std::string, Shader*>::iterator it = variants.begin(); it != variants.end(); ++it)
+        delete it->second;
+}
+
+Shader& shaderVariants::get(const std::vector<std::string> &defines)
+{
+    std::string key;
+    for(const std::string &define : defines) key += define + ' ';
+
+    std::map<std::string, Shader*>::iterator it = variants.find(key);
+    if(it != variants.end()) return *it->second;
+
+    std::cout << "Shader variant: " << (key.empty() ? "(no defines)" : key) << std::endl;
+    Shader *program = new Shader(vertexPath.c_str(), fragmentPath.c_str(), defines);
+    if(setup) setup(*program);
+
+    variants[key] = program;
+    return *program;
 }
+
+void shaderVariants::deletePrograms()
+{
+    for(std::map<std::string, Shader*>::iterator it = variants.begin(); it != variants.end(); ++it)
+    {
+        glDeleteProgram(it->second->ID);
+        delete it->second;
+    }
+    variants.clear();
+}
+
+size_t shaderVariants::size() const { return variants.size(); }
@@ -0,0 +1,168 @@
+#include <algorithm>
+
+#include "simulation.hpp"
+#include "cpuProfiler.hpp"
+
+// simulation -----------------------------------------------------------------
+
+simulation::simulation(const Camera &camera, terrainChunks &world, double tickRate)
+    : camera(camera), world(world), tickRate(tickRate), ticks(0), time(0), running(false)
+{
+    input.width         = camera.width;
+    input.height        = camera.height;
+    input.movementSpeed = camera.MovementSpeed;
+}
+
+simulation::~simulation() { stop(); }
+
+void simulation::start()
+{
+    if(running) return;
+
+    running = true;
+    thread  = std::thread(&simulation::run, this);
+}
+
+void simulation::stop()
+{
+    running = false;
+    if(thread.joinable()) thread.join();
+}
+
+bool simulation::isRunning() const { return running; }
+
+double simulation::getTickRate() const { return tickRate; }
+
+void simulation::run()
+{
+    clock::duration period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1. / tickRate));
+    clock::time_point next = clock::now();
+
+    while(running)
+    {
+        tick(1. / tickRate);
+
+        next += period;
+        clock::time_point now = clock::now();
+        if(now > next + 4 * period) next = now;     // Too far behind (long tick): drop the missed ticks instead of running them in a burst
+        std::this_thread::sleep_until(next);
+    }
+}
+
+void simulation::tick(double deltaTime)
+{
+    PROFILE_ZONE("Simulation tick");
+
+    // Input
+    inputState in;
+    {
+        std::lock_guard<std::mutex> lock(inputMutex);
+        in = input;
+        input.mouseX = input.mouseY = input.scroll = 0;
+        input.poseRequested = false;
+    }
+
+    camera.width         = in.width;
+    camera.height        = in.height;
+    camera.MovementSpeed = in.movementSpeed;
+    if(in.poseRequested) camera.SetPose(in.position, in.yaw, in.pitch);
+
+    for(unsigned key = FORWARD; key <= DOWN; key++)
+        if(in.keys[key]) camera.ProcessKeyboard((Camera_Movement)key, deltaTime);
+    if(in.mouseX || in.mouseY) camera.ProcessMouseMovement(in.mouseX, in.mouseY, true);
+    if(in.scroll) camera.ProcessMouseScroll(in.scroll);
+
+    ticks++;
+    time += deltaTime;
+
+    // Chunks in range, and snapshot
+    frameSnapshot &snapshot = snapshots.getBack();
+    snapshot.chunks.clear();                // Keeps its capacity (the buffer is reused every 3 ticks)
+
+    {
+        std::lock_guard<std::mutex> lock(worldMutex);
+
+        world.fogRadius = in.fogRadius;     // Completely fogged chunks are not generated
+        world.updateVisibleChunks(camera.Position);
+
+        for(std::map<BinaryKey, terrainGenerator>::const_iterator it = world.chunkDict.begin(); it != world.chunkDict.end(); ++it)
+        {
+            const BinaryKey &key = it->first;
+            glm::vec2 heights = it->second.getHeightRange() * world.verticalScale;
+            glm::vec3 boxMin(key.x * world.chunkSize, key.y * world.chunkSize, heights.x);
+            glm::vec3 boxMax = boxMin + glm::vec3(world.chunkSize, world.chunkSize, heights.y - heights.x);
+
+            glm::vec3 toNearest = glm::clamp(camera.Position, boxMin, boxMax) - camera.Position;
+            if(in.fogRadius > 0 && glm::dot(toNearest, toNearest) > in.fogRadius * in.fogRadius)
+                continue;                   // Completely fogged
+
+            glm::vec3 toCenter = (boxMin + boxMax) / 2.f - camera.Position;
+            snapshot.chunks.push_back( { key, boxMin, boxMax, glm::dot(toCenter, toCenter) } );
+        }
+
+        snapshot.numChunks       = world.chunkDict.size();
+        snapshot.pendingChunks   = world.pendingChunks.size();
+        snapshot.chunksGenerated = world.chunksGenerated;
+        snapshot.chunksLoaded    = world.chunksLoaded;
+    }
+
+    snapshot.tick       = ticks;
+    snapshot.time       = time;
+    snapshot.camera     = camera;
+    snapshot.view       = camera.GetViewMatrix();
+    snapshot.projection = camera.GetProjectionMatrix();
+    snapshots.publish();
+}
+
+bool simulation::acquireSnapshot() { return snapshots.acquire(); }
+
+const frameSnapshot& simulation::getSnapshot() const { return snapshots.getFront(); }
+
+void simulation::setKey(Camera_Movement key, bool pressed)
+{
+    std::lock_guard<std::mutex> lock(inputMutex);
+    input.keys[key] = pressed;
+}
+
+void simulation::addMouseMovement(float xoffset, float yoffset)
+{
+    std::lock_guard<std::mutex> lock(inputMutex);
+    input.mouseX += xoffset;
+    input.mouseY += yoffset;
+}
+
+void simulation::addScroll(float yoffset)
+{
+    std::lock_guard<std::mutex> lock(inputMutex);
+    input.scroll += yoffset;
+}
+
+void simulation::setViewport(int width, int height)
+{
+    if(width <= 0 || height <= 0) return;   // Minimized window
+
+    std::lock_guard<std::mutex> lock(inputMutex);
+    input.width  = width;
+    input.height = height;
+}
+
+void simulation::setMovementSpeed(float speed)
+{
+    std::lock_guard<std::mutex> lock(inputMutex);
+    input.movementSpeed = speed;
+}
+
+void simulation::setFogRadius(float radius)
+{
+    std::lock_guard<std::mutex> lock(inputMutex);
+    input.fogRadius = radius;
+}
+
+void simulation::setPose(glm::vec3 position, float yaw, float pitch)
+{
+    std::lock_guard<std::mutex> lock(inputMutex);
+    input.poseRequested = true;
+    input.position      = position;
+    input.yaw           = yaw;
+    input.pitch         = pitch;
+}
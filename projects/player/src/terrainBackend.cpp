@@ -0,0 +1,520 @@
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include "terrainBackend.hpp"
+#include "canvas.hpp"
+#include "cpuProfiler.hpp"
+
+const char* terrainBackendNames[numTerrainBackends] = { "Per-chunk VAO", "Shared VAO", "Multi-draw", "Instanced" };
+const char* terrainBackendIds[numTerrainBackends]   = { "chunk-vao", "shared-vao", "multi-draw", "instanced" };
+
+terrainBackend* createTerrainBackend(terrainBackendType type, uploadRing &uploader)
+{
+    switch(type)
+    {
+        case backendSharedVAO: return new sharedVAOBackend(uploader);
+        case backendMultiDraw: return new multiDrawBackend(uploader);
+        case backendInstanced: return new instancedBackend(uploader);
+        default:               return new chunkVAOBackend(uploader);
+    }
+}
+
+// terrainBackend -----------------------------------------------------------------
+
+terrainBackend::terrainBackend(uploadRing &uploader) : uploader(uploader), gpuBytes(0), vertexPerSide(0) { }
+
+terrainBackend::~terrainBackend() { }
+
+const char* terrainBackend::getName() const { return terrainBackendNames[getType()]; }
+
+std::vector<std::string> terrainBackend::getDefines() const { return std::vector<std::string>(); }
+
+size_t terrainBackend::getGpuBytes() const { return gpuBytes; }
+
+size_t terrainBackend::getNumChunks() const { return keys.size(); }
+
+size_t terrainBackend::vertexBytes(const terrainGenerator &chunk) { return sizeof(float) * chunk.getNumVertex() * 8; }
+
+size_t terrainBackend::splatBytes(const terrainGenerator &chunk) { return 4 * chunk.getNumVertex(); }
+
+size_t terrainBackend::indexBytes(const terrainGenerator &chunk) { return sizeof(unsigned) * chunk.getNumIndices(); }
+
+bool terrainBackend::stageChunk(const terrainGenerator &chunk, uploadTicket &ticket)
+{
+    size_t vertex = vertexBytes(chunk), splat = splatBytes(chunk), index = indexBytes(chunk);
+
+    if(!uploader.allocate(vertex + splat + index, ticket))
+        return false;
+
+    std::memcpy(ticket.data, chunk.vertex, vertex);
+    std::memcpy((char*)ticket.data + vertex, chunk.splat, splat);
+    std::memcpy((char*)ticket.data + vertex + splat, chunk.indices, index);
+    return true;
+}
+
+void terrainBackend::update(terrainChunks &world, std::chrono::steady_clock::time_point startTime)
+{
+    vertexPerSide = world.vertexPerSide;
+    glBindVertexArray(0);               // Creating element buffers binds them to the current VAO
+
+    // Delete the GPU data of chunks not existing in the chunks dictionary, or whose data changed (placeholders replaced by full chunks)
+    std::vector<BinaryKey> removed;
+
+    for(const BinaryKey &key : keys)
+        if(world.chunkDict.find(key) == world.chunkDict.end())
+            removed.push_back(key);
+
+    removed.insert(removed.end(), world.refreshedChunks.begin(), world.refreshedChunks.end());
+    world.refreshedChunks.clear();
+
+    for(const BinaryKey &key : removed)
+        if(keys.erase(key)) removeChunk(key);
+
+    // Create the GPU data of new chunks (within what is left of the frame budget). Their data is streamed through the upload ring.
+    PROFILE_ZONE("Upload staging");
+    bool firstChunk = true;
+
+    for(std::map<BinaryKey, terrainGenerator>::const_iterator it = world.chunkDict.begin(); it != world.chunkDict.end(); it++)
+    {
+        if(keys.find(it->first) != keys.end()) continue;
+
+        if(!firstChunk && world.budgetUsed(startTime))
+            break;                  // Frame budget used up. Remaining chunks are uploaded in the next frames.
+
+        if(!addChunk(it->first, it->second))
+            break;                  // No staging memory (or buffer space) left. Remaining chunks are uploaded in the next frames.
+
+        keys.insert(it->first);
+        firstChunk = false;
+    }
+}
+
+// chunkVAOBackend -----------------------------------------------------------------
+
+chunkVAOBackend::chunkVAOBackend(uploadRing &uploader) : terrainBackend(uploader) { }
+
+chunkVAOBackend::~chunkVAOBackend() { clear(); }
+
+terrainBackendType chunkVAOBackend::getType() const { return backendChunkVAO; }
+
+bool chunkVAOBackend::addChunk(const BinaryKey &key, const terrainGenerator &chunk)
+{
+    uploadTicket ticket;
+    if(!stageChunk(chunk, ticket)) return false;
+
+    size_t vertex = vertexBytes(chunk), splat = splatBytes(chunk), index = indexBytes(chunk);
+    chunkBuffers &chunkBuf = buffers[key];
+
+    chunkBuf.VBO   = createVBO(vertex + splat, nullptr, GL_STATIC_DRAW);    // Only storage. Data is copied from the staging buffer.
+    chunkBuf.EBO   = createEBO(index, nullptr, GL_STATIC_DRAW);
+    chunkBuf.VAO   = createVAO();
+    chunkBuf.numVertex  = chunk.getNumVertex();
+    chunkBuf.numIndices = chunk.getNumIndices();
+    chunkBuf.bytes = vertex + splat + index;
+    gpuBytes      += chunkBuf.bytes;
+
+    uploader.submit(ticket, 0,              vertex + splat, chunkBuf.VBO);
+    uploader.submit(ticket, vertex + splat, index,          chunkBuf.EBO);
+
+    int sizesAttribs[3] = {3, 2, 3};
+    configVAO( chunkBuf.VAO, chunkBuf.VBO, chunkBuf.EBO, sizesAttribs, 3 );
+    configByteAttrib( chunkBuf.VAO, chunkBuf.VBO, 3, vertex );
+    return true;
+}
+
+void chunkVAOBackend::removeChunk(const BinaryKey &key)
+{
+    std::map<BinaryKey, chunkBuffers>::iterator it = buffers.find(key);
+    if(it == buffers.end()) return;
+
+    uploader.discard(it->second.VBO);
+    uploader.discard(it->second.EBO);
+    glDeleteVertexArrays(1, &it->second.VAO);
+    glDeleteBuffers     (1, &it->second.VBO);
+    glDeleteBuffers     (1, &it->second.EBO);
+
+    gpuBytes -= it->second.bytes;
+    buffers.erase(it);
+}
+
+bool chunkVAOBackend::getDrawCall(const BinaryKey &key, chunkDrawCall &drawCall) const
+{
+    std::map<BinaryKey, chunkBuffers>::const_iterator it = buffers.find(key);
+    if(it == buffers.end() || uploader.isPending(it->second.VBO) || uploader.isPending(it->second.EBO))
+        return false;               // Data not in GPU yet
+
+    const chunkBuffers &b = it->second;
+    drawCall = { b.VAO, b.VBO, b.EBO, b.numIndices, sizeof(float) * 8 * b.numVertex, 0, 0, b.numVertex, 0, 0 };
+    return true;
+}
+
+void chunkVAOBackend::draw(const std::vector<chunkDrawCall> &drawList)
+{
+    for(const chunkDrawCall &chunk : drawList)
+    {
+        glBindVertexArray(chunk.VAO);       // The VAO keeps the EBO
+        glDrawElements(GL_TRIANGLES, chunk.numIndices, GL_UNSIGNED_INT, nullptr);
+    }
+    glBindVertexArray(0);
+}
+
+void chunkVAOBackend::clear()
+{
+    while(!buffers.empty()) removeChunk(buffers.begin()->first);
+    keys.clear();
+}
+
+// sharedVAOBackend -----------------------------------------------------------------
+
+sharedVAOBackend::sharedVAOBackend(uploadRing &uploader) : terrainBackend(uploader), VAO(createVAO()) { }
+
+sharedVAOBackend::~sharedVAOBackend()
+{
+    clear();
+    glDeleteVertexArrays(1, &VAO);
+}
+
+terrainBackendType sharedVAOBackend::getType() const { return backendSharedVAO; }
+
+bool sharedVAOBackend::addChunk(const BinaryKey &key, const terrainGenerator &chunk)
+{
+    uploadTicket ticket;
+    if(!stageChunk(chunk, ticket)) return false;
+
+    size_t vertex = vertexBytes(chunk), splat = splatBytes(chunk), index = indexBytes(chunk);
+    chunkBuffers &chunkBuf = buffers[key];
+
+    chunkBuf.VBO   = createVBO(vertex + splat, nullptr, GL_STATIC_DRAW);
+    chunkBuf.EBO   = createEBO(index, nullptr, GL_STATIC_DRAW);
+    chunkBuf.numVertex  = chunk.getNumVertex();
+    chunkBuf.numIndices = chunk.getNumIndices();
+    chunkBuf.bytes = vertex + splat + index;
+    gpuBytes      += chunkBuf.bytes;
+
+    uploader.submit(ticket, 0,              vertex + splat, chunkBuf.VBO);
+    uploader.submit(ticket, vertex + splat, index,          chunkBuf.EBO);
+    return true;
+}
+
+void sharedVAOBackend::removeChunk(const BinaryKey &key)
+{
+    std::map<BinaryKey, chunkBuffers>::iterator it = buffers.find(key);
+    if(it == buffers.end()) return;
+
+    uploader.discard(it->second.VBO);
+    uploader.discard(it->second.EBO);
+    glDeleteBuffers(1, &it->second.VBO);
+    glDeleteBuffers(1, &it->second.EBO);
+
+    gpuBytes -= it->second.bytes;
+    buffers.erase(it);
+}
+
+bool sharedVAOBackend::getDrawCall(const BinaryKey &key, chunkDrawCall &drawCall) const
+{
+    std::map<BinaryKey, chunkBuffers>::const_iterator it = buffers.find(key);
+    if(it == buffers.end() || uploader.isPending(it->second.VBO) || uploader.isPending(it->second.EBO))
+        return false;
+
+    const chunkBuffers &b = it->second;
+    drawCall = { VAO, b.VBO, b.EBO, b.numIndices, sizeof(float) * 8 * b.numVertex, 0, 0, b.numVertex, 0, 0 };
+    return true;
+}
+
+void sharedVAOBackend::draw(const std::vector<chunkDrawCall> &drawList)
+{
+    int sizesAttribs[3] = {3, 2, 3};
+    glBindVertexArray(VAO);
+
+    for(const chunkDrawCall &chunk : drawList)
+    {
+        configVAO(VAO, chunk.VBO, chunk.EBO, sizesAttribs, 3, false);
+        configByteAttrib(VAO, chunk.VBO, 3, chunk.splatOffset, false);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, chunk.EBO);       // configVAO() unbinds it
+        glDrawElements(GL_TRIANGLES, chunk.numIndices, GL_UNSIGNED_INT, nullptr);
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+void sharedVAOBackend::clear()
+{
+    while(!buffers.empty()) removeChunk(buffers.begin()->first);
+    keys.clear();
+}
+
+// multiDrawBackend -----------------------------------------------------------------
+
+multiDrawBackend::multiDrawBackend(uploadRing &uploader)
+    : terrainBackend(uploader), capacity(0), usedSlots(0), slotVertex(0), slotIndices(0), VAO(createVAO()), vertexBuffer(0), splatBuffer(0), indexBuffer(0), storeIndices(true) { }
+
+multiDrawBackend::~multiDrawBackend()
+{
+    multiDrawBackend::clear();
+    glDeleteVertexArrays(1, &VAO);
+}
+
+terrainBackendType multiDrawBackend::getType() const { return backendMultiDraw; }
+
+unsigned multiDrawBackend::maxSlots() const { return 1 << 16; }
+
+bool multiDrawBackend::addChunk(const BinaryKey &key, const terrainGenerator &chunk)
+{
+    unsigned numVertex = chunk.getNumVertex(), numIndices = chunk.getNumIndices();
+
+    if(!slotVertex)                     // Slots fit a full resolution chunk (placeholders are smaller)
+    {
+        unsigned side = std::max<unsigned>(vertexPerSide, std::lround(std::sqrt((double)numVertex)));
+        slotVertex  = side * side;
+        slotIndices = (side - 1) * (side - 1) * 6;
+    }
+    if(numVertex > slotVertex || numIndices > slotIndices)
+    {
+        std::cout << "Terrain backend: chunk bigger than a slot (call clear() after changing the chunk resolution)" << std::endl;
+        return false;
+    }
+
+    if(freeSlots.empty() && usedSlots == capacity && !grow(std::max(16u, capacity * 2)))
+        return false;
+
+    uploadTicket ticket;
+    if(!stageChunk(chunk, ticket)) return false;
+
+    unsigned slot;
+    if(!freeSlots.empty()) { slot = freeSlots.back(); freeSlots.pop_back(); }
+    else slot = usedSlots++;
+
+    // Copies still pending for a chunk previously in this slot are issued before these ones (in order)
+    size_t vertex = vertexBytes(chunk), splat = splatBytes(chunk), index = indexBytes(chunk);
+    uploader.submit(ticket, 0,              vertex, vertexBuffer, (size_t)slot * slotVertex * 8 * sizeof(float));
+    uploader.submit(ticket, vertex,         splat,  splatBuffer,  (size_t)slot * slotVertex * 4);
+    if(storeIndices)
+        uploader.submit(ticket, vertex + splat, index, indexBuffer, (size_t)slot * slotIndices * sizeof(unsigned));
+
+    slots[key] = { slot, numVertex, numIndices };
+    return true;
+}
+
+void multiDrawBackend::removeChunk(const BinaryKey &key)
+{
+    std::map<BinaryKey, chunkSlot>::iterator it = slots.find(key);
+    if(it == slots.end()) return;
+
+    freeSlots.push_back(it->second.slot);
+    slots.erase(it);
+}
+
+bool multiDrawBackend::grow(unsigned newCapacity)
+{
+    newCapacity = std::min(newCapacity, maxSlots());
+    if(newCapacity <= capacity) return false;
+
+    if(uploader.isPending(vertexBuffer) || uploader.isPending(splatBuffer) || uploader.isPending(indexBuffer))
+        return false;                   // Pending copies would be lost (try again when they have been issued)
+
+    size_t slotBytes[3] = { slotVertex * 8 * sizeof(float), slotVertex * 4, storeIndices ? slotIndices * sizeof(unsigned) : 0 };
+    unsigned* oldBuffers[3] = { &vertexBuffer, &splatBuffer, &indexBuffer };
+
+    for(unsigned i = 0; i < 3; i++)
+    {
+        unsigned newBuffer = createVBO(newCapacity * slotBytes[i], nullptr, GL_STATIC_DRAW);
+
+        if(*oldBuffers[i])
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER,  *oldBuffers[i]);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, capacity * slotBytes[i]);
+            glDeleteBuffers(1, oldBuffers[i]);
+        }
+        *oldBuffers[i] = newBuffer;
+    }
+
+    gpuBytes += (newCapacity - capacity) * (slotBytes[0] + slotBytes[1] + slotBytes[2]);
+    capacity  = newCapacity;
+    buffersChanged();
+    return true;
+}
+
+void multiDrawBackend::buffersChanged()
+{
+    int sizesAttribs[3] = {3, 2, 3};
+    configVAO( VAO, vertexBuffer, indexBuffer, sizesAttribs, 3 );
+    configByteAttrib( VAO, splatBuffer, 3, 0 );
+}
+
+bool multiDrawBackend::getDrawCall(const BinaryKey &key, chunkDrawCall &drawCall) const
+{
+    std::map<BinaryKey, chunkSlot>::const_iterator it = slots.find(key);
+    if(it == slots.end()) return false;
+
+    const chunkSlot &s = it->second;
+    size_t vertexOffset = (size_t)s.slot * slotVertex * 8 * sizeof(float), splatOffset = (size_t)s.slot * slotVertex * 4, indexOffset = (size_t)s.slot * slotIndices * sizeof(unsigned);
+
+    if(uploader.isPending(vertexBuffer, vertexOffset, s.numVertex * 8 * sizeof(float)) ||
+       uploader.isPending(splatBuffer,  splatOffset,  s.numVertex * 4) ||
+       (storeIndices && uploader.isPending(indexBuffer, indexOffset, s.numIndices * sizeof(unsigned))))
+        return false;
+
+    drawCall = { VAO, vertexBuffer, indexBuffer, s.numIndices, splatOffset, (int)(s.slot * slotVertex), indexOffset, s.numVertex, 0, 0 };
+    return true;
+}
+
+void multiDrawBackend::draw(const std::vector<chunkDrawCall> &drawList)
+{
+    if(drawList.empty()) return;
+
+    counts.clear();
+    offsets.clear();
+    baseVertices.clear();
+
+    for(const chunkDrawCall &chunk : drawList)
+    {
+        counts.push_back(chunk.numIndices);
+        offsets.push_back((const void*)chunk.indexOffset);
+        baseVertices.push_back(chunk.baseVertex);
+    }
+
+    glBindVertexArray(VAO);
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), GL_UNSIGNED_INT, offsets.data(), drawList.size(), baseVertices.data());
+    glBindVertexArray(0);
+}
+
+void multiDrawBackend::clear()
+{
+    slots.clear();
+    freeSlots.clear();
+    keys.clear();
+
+    if(vertexBuffer)
+    {
+        uploader.discard(vertexBuffer);
+        uploader.discard(splatBuffer);
+        uploader.discard(indexBuffer);
+        glDeleteBuffers(1, &vertexBuffer);
+        glDeleteBuffers(1, &splatBuffer);
+        glDeleteBuffers(1, &indexBuffer);
+    }
+
+    vertexBuffer = splatBuffer = indexBuffer = 0;
+    capacity = usedSlots = 0;
+    slotVertex = slotIndices = 0;       // Set again with the next chunk (the chunk resolution may have changed)
+    gpuBytes = 0;
+}
+
+// instancedBackend -----------------------------------------------------------------
+
+instancedBackend::instancedBackend(uploadRing &uploader)
+    : multiDrawBackend(uploader), instanceVAO(createVAO()), instanceBuffer(0), instanceBufferSize(0)
+{
+    storeIndices = false;           // Index buffers are shared by the chunks of each grid (see grids)
+    glGenTextures(1, &vertexTexture);
+    glGenTextures(1, &splatTexture);
+}
+
+instancedBackend::~instancedBackend()
+{
+    instancedBackend::clear();
+    glDeleteTextures(1, &vertexTexture);
+    glDeleteTextures(1, &splatTexture);
+    glDeleteVertexArrays(1, &instanceVAO);
+}
+
+terrainBackendType instancedBackend::getType() const { return backendInstanced; }
+
+std::vector<std::string> instancedBackend::getDefines() const { return std::vector<std::string>{ "INSTANCED" }; }
+
+unsigned instancedBackend::maxSlots() const
+{
+    GLint maxTexels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    return slotVertex ? maxTexels / (2 * slotVertex) : 0;      // 2 texels per vertex (the splat texture needs 1)
+}
+
+bool instancedBackend::addChunk(const BinaryKey &key, const terrainGenerator &chunk)
+{
+    if(!multiDrawBackend::addChunk(key, chunk)) return false;
+
+    // Chunks with the same number of vertex have the same indices (the vertex grid is the same)
+    if(grids.find(chunk.getNumVertex()) == grids.end())
+    {
+        grids[chunk.getNumVertex()] = { createEBO(indexBytes(chunk), chunk.indices, GL_STATIC_DRAW), chunk.getNumIndices() };
+        gpuBytes += indexBytes(chunk);
+    }
+    return true;
+}
+
+void instancedBackend::buffersChanged()
+{
+    glBindTexture(GL_TEXTURE_BUFFER, vertexTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, vertexBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, splatTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA8, splatBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void instancedBackend::draw(const std::vector<chunkDrawCall> &drawList)
+{
+    if(drawList.empty()) return;
+
+    // First vertex of each instance, grouped by grid (biggest first: full resolution chunks are usually the nearest). Order inside each group is kept.
+    firstVertices.clear();
+    std::vector<std::pair<const gridIndices*, size_t>> groups;      // Grid and number of instances
+
+    for(std::map<unsigned, gridIndices>::const_reverse_iterator grid = grids.rbegin(); grid != grids.rend(); ++grid)
+    {
+        size_t first = firstVertices.size();
+        for(const chunkDrawCall &chunk : drawList)
+            if(chunk.numVertex == grid->first) firstVertices.push_back(chunk.baseVertex);
+
+        if(firstVertices.size() > first) groups.push_back( { &grid->second, firstVertices.size() - first } );
+    }
+
+    if(!instanceBuffer) glGenBuffers(1, &instanceBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, firstVertices.size() * sizeof(GLint), firstVertices.data(), GL_STREAM_DRAW);     // Orphaned every frame
+    if(firstVertices.size() * sizeof(GLint) > instanceBufferSize)
+    {
+        gpuBytes += firstVertices.size() * sizeof(GLint) - instanceBufferSize;
+        instanceBufferSize = firstVertices.size() * sizeof(GLint);
+    }
+
+    glActiveTexture(GL_TEXTURE9);
+    glBindTexture(GL_TEXTURE_BUFFER, vertexTexture);
+    glActiveTexture(GL_TEXTURE10);
+    glBindTexture(GL_TEXTURE_BUFFER, splatTexture);
+    glActiveTexture(GL_TEXTURE0);
+    resetTextureBinds();            // The active unit changed behind the tracker (see bindTexture2D())
+
+    glBindVertexArray(instanceVAO);
+    glEnableVertexAttribArray(4);
+    glVertexAttribDivisor(4, 1);
+
+    size_t first = 0;
+    for(const std::pair<const gridIndices*, size_t> &group : groups)
+    {
+        glVertexAttribIPointer(4, 1, GL_INT, 0, (void*)(first * sizeof(GLint)));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, group.first->EBO);
+        glDrawElementsInstanced(GL_TRIANGLES, group.first->numIndices, GL_UNSIGNED_INT, nullptr, group.second);
+        first += group.second;
+    }
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void instancedBackend::clear()
+{
+    multiDrawBackend::clear();
+
+    for(std::pair<const unsigned, gridIndices> &grid : grids)
+        glDeleteBuffers(1, &grid.second.EBO);
+    grids.clear();
+
+    if(instanceBuffer) glDeleteBuffers(1, &instanceBuffer);
+    instanceBuffer     = 0;
+    instanceBufferSize = 0;
+}
@@ -0,0 +1,340 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <cmath>
+#include <thread>
+#include <chrono>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/stat.h>
+#elif defined(_WIN32)
+#include <direct.h>
+#endif
+
+#include "stb_image.h"
+
+#include "textureCook.hpp"
+
+#define COOKED_VERSION 1
+
+struct cookedHeader
+{
+    char     magic[8];          ///< "TEXARRAY"
+    uint32_t version;
+    uint32_t size;
+    uint32_t numLayers;
+    uint32_t numLevels;
+    uint32_t compressed;
+    uint32_t padding;
+    uint64_t sourceHash;
+};
+
+// Auxiliar functions ---------------
+
+/// FNV-1a hash of the source files' content and the cooking parameters
+static bool hashSources(const std::vector<std::string> &files, unsigned size, bool compress, uint64_t &hash)
+{
+    hash = 14695981039346656037ull;
+    auto add = [&hash](const void* data, size_t bytes)
+    {
+        for(size_t i = 0; i < bytes; i++)
+        {
+            hash ^= ((const unsigned char*)data)[i];
+            hash *= 1099511628211ull;
+        }
+    };
+
+    uint32_t params[3] = { COOKED_VERSION, size, (uint32_t)compress };
+    add(params, sizeof(params));
+
+    std::vector<char> buffer(1 << 16);
+    for(const std::string &file : files)
+    {
+        std::ifstream in(file, std::ios::binary);
+        if(!in.is_open()) return false;
+
+        while(in.read(buffer.data(), buffer.size()) || in.gcount() > 0)
+            add(buffer.data(), (size_t)in.gcount());
+    }
+
+    return true;
+}
+
+/// Decode an image and resample it (bilinear, wrapping around the borders, since the textures are tiled) to size x size RGB8
+static bool loadLayer(const std::string &file, unsigned size, unsigned char *layer)
+{
+    int width, height, numberChannels;
+    stbi_set_flip_vertically_on_load_thread(true);     // Per thread: the global flag would race with other decoders (textureLoader)
+    unsigned char *image = stbi_load(file.c_str(), &width, &height, &numberChannels, 3);
+    if(!image) return false;
+
+    for(unsigned y = 0; y < size; y++)
+        for(unsigned x = 0; x < size; x++)
+        {
+            float u = (x + 0.5f) * width  / size - 0.5f;
+            float v = (y + 0.5f) * height / size - 0.5f;
+            int   x0 = (int)std::floor(u), y0 = (int)std::floor(v);
+            float fx = u - x0, fy = v - y0;
+            int   x1 = (x0 + 1) % width, y1 = (y0 + 1) % height;
+            x0 = (x0 + width) % width;
+            y0 = (y0 + height) % height;
+
+            for(unsigned c = 0; c < 3; c++)
+            {
+                float top    = image[(y0 * width + x0) * 3 + c] * (1 - fx) + image[(y0 * width + x1) * 3 + c] * fx;
+                float bottom = image[(y1 * width + x0) * 3 + c] * (1 - fx) + image[(y1 * width + x1) * 3 + c] * fx;
+                layer[(y * size + x) * 3 + c] = (unsigned char)(top * (1 - fy) + bottom * fy + 0.5f);
+            }
+        }
+
+    stbi_image_free(image);
+    return true;
+}
+
+/// 2x2 box filter of a RGB8 layer
+static void downsample(const unsigned char *source, unsigned sourceSize, unsigned char *target)
+{
+    unsigned size = sourceSize / 2;
+    for(unsigned y = 0; y < size; y++)
+        for(unsigned x = 0; x < size; x++)
+            for(unsigned c = 0; c < 3; c++)
+            {
+                const unsigned char *pos = &source[((2 * y) * sourceSize + 2 * x) * 3 + c];
+                target[(y * size + x) * 3 + c] = (unsigned char)((pos[0] + pos[3] + pos[sourceSize * 3] + pos[sourceSize * 3 + 3] + 2) / 4);
+            }
+}
+
+static uint16_t toRGB565(const int color[3])
+{
+    return (uint16_t)(((color[0] * 31 + 127) / 255) << 11 | ((color[1] * 63 + 127) / 255) << 5 | ((color[2] * 31 + 127) / 255));
+}
+
+static void fromRGB565(uint16_t value, int color[3])
+{
+    color[0] = ((value >> 11) & 31) * 255 / 31;
+    color[1] = ((value >> 5)  & 63) * 255 / 63;
+    color[2] = ( value        & 31) * 255 / 31;
+}
+
+/// Compress a 4x4 block (16 RGB8 pixels) to DXT1. Endpoints are the corners of the block's bounding box (along the diagonal that follows the colors' correlation).
+static void compressBlock(const unsigned char block[16][3], unsigned char *output)
+{
+    int minColor[3] = { 255, 255, 255 }, maxColor[3] = { 0, 0, 0 }, mean[3] = { 0, 0, 0 };
+    for(unsigned i = 0; i < 16; i++)
+        for(unsigned c = 0; c < 3; c++)
+        {
+            minColor[c] = std::min(minColor[c], (int)block[i][c]);
+            maxColor[c] = std::max(maxColor[c], (int)block[i][c]);
+            mean[c]    += block[i][c];
+        }
+
+    // Swap the green and blue ends if they are anti-correlated with red
+    int covariance[3] = { 0, 0, 0 };
+    for(unsigned i = 0; i < 16; i++)
+        for(unsigned c = 1; c < 3; c++)
+            covariance[c] += (block[i][0] * 16 - mean[0]) * (block[i][c] * 16 - mean[c]);
+    for(unsigned c = 1; c < 3; c++)
+        if(covariance[c] < 0) std::swap(minColor[c], maxColor[c]);
+
+    // Inset the bounding box (reduces the error of the ends)
+    for(unsigned c = 0; c < 3; c++)
+    {
+        int inset = (maxColor[c] - minColor[c]) / 16;
+        maxColor[c] -= inset;
+        minColor[c] += inset;
+    }
+
+    uint16_t color0 = toRGB565(maxColor), color1 = toRGB565(minColor);
+    if(color0 < color1) std::swap(color0, color1);      // color0 > color1 selects the 4 colors mode
+
+    int palette[4][3];
+    fromRGB565(color0, palette[0]);
+    fromRGB565(color1, palette[1]);
+    for(unsigned c = 0; c < 3; c++)
+    {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    uint32_t indices = 0;
+    if(color0 != color1)
+        for(unsigned i = 0; i < 16; i++)
+        {
+            unsigned best = 0;
+            int bestDistance = 1 << 30;
+            for(unsigned p = 0; p < 4; p++)
+            {
+                int distance = 0;
+                for(unsigned c = 0; c < 3; c++)
+                    distance += (block[i][c] - palette[p][c]) * (block[i][c] - palette[p][c]);
+                if(distance < bestDistance) { bestDistance = distance; best = p; }
+            }
+            indices |= best << (2 * i);
+        }
+
+    output[0] = color0 & 0xFF;
+    output[1] = color0 >> 8;
+    output[2] = color1 & 0xFF;
+    output[3] = color1 >> 8;
+    for(unsigned i = 0; i < 4; i++) output[4 + i] = (indices >> (8 * i)) & 0xFF;
+}
+
+/// Compress a RGB8 layer to DXT1 (layers smaller than 4x4 are padded by repeating the border pixels)
+static void compressLayer(const unsigned char *source, unsigned size, unsigned char *target)
+{
+    unsigned blocks = (size + 3) / 4;
+    unsigned char block[16][3];
+
+    for(unsigned by = 0; by < blocks; by++)
+        for(unsigned bx = 0; bx < blocks; bx++)
+        {
+            for(unsigned i = 0; i < 16; i++)
+            {
+                unsigned x = std::min(bx * 4 + i % 4, size - 1);
+                unsigned y = std::min(by * 4 + i / 4, size - 1);
+                std::memcpy(block[i], &source[(y * size + x) * 3], 3);
+            }
+            compressBlock(block, &target[(by * blocks + bx) * 8]);
+        }
+}
+
+static std::string cachedFileName(const std::string &cacheDirectory, uint64_t hash)
+{
+    std::ostringstream fileName;
+    fileName << cacheDirectory << "textures_" << std::hex << std::setw(16) << std::setfill('0') << hash << ".texarray";
+    return fileName.str();
+}
+
+static bool loadCooked(const std::string &fileName, uint64_t hash, cookedTextures &result)
+{
+    std::ifstream in(fileName, std::ios::binary);
+    if(!in.is_open()) return false;
+
+    cookedHeader header;
+    if(!in.read((char*)&header, sizeof(header))) return false;
+    if(std::memcmp(header.magic, "TEXARRAY", 8) || header.version != COOKED_VERSION || header.sourceHash != hash) return false;
+
+    result.size       = header.size;
+    result.numLayers  = header.numLayers;
+    result.numLevels  = header.numLevels;
+    result.compressed = header.compressed;
+    result.levels.resize(result.numLevels);
+
+    for(unsigned level = 0; level < result.numLevels; level++)
+    {
+        result.levels[level].resize(result.layerBytes(level) * result.numLayers);
+        if(!in.read((char*)result.levels[level].data(), result.levels[level].size())) return false;
+    }
+
+    return true;
+}
+
+static void saveCooked(const std::string &cacheDirectory, const std::string &fileName, uint64_t hash, const cookedTextures &cooked)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    mkdir(cacheDirectory.c_str(), 0755);
+#elif defined(_WIN32)
+    _mkdir(cacheDirectory.c_str());
+#endif
+
+    std::ofstream out(fileName, std::ios::binary | std::ios::trunc);
+    if(!out.is_open())
+    {
+        std::cout << "Texture cook: cannot write " << fileName << std::endl;
+        return;
+    }
+
+    cookedHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "TEXARRAY", 8);
+    header.version    = COOKED_VERSION;
+    header.size       = cooked.size;
+    header.numLayers  = cooked.numLayers;
+    header.numLevels  = cooked.numLevels;
+    header.compressed = cooked.compressed;
+    header.sourceHash = hash;
+
+    out.write((const char*)&header, sizeof(header));
+    for(const std::vector<unsigned char> &level : cooked.levels)
+        out.write((const char*)level.data(), level.size());
+}
+
+// cookedTextures ---------------
+
+size_t cookedTextures::layerBytes(unsigned level) const
+{
+    unsigned side = std::max(1u, size >> level);
+    if(compressed) return (size_t)((side + 3) / 4) * ((side + 3) / 4) * 8;
+    return (size_t)side * side * 3;
+}
+
+bool cookTextureArray(const std::vector<std::string> &files, const std::string &cacheDirectory, unsigned size, bool compress, cookedTextures &result)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    uint64_t hash;
+    if(!hashSources(files, size, compress, hash))
+    {
+        std::cout << "Texture cook: cannot read the source images" << std::endl;
+        return false;
+    }
+
+    std::string fileName = cachedFileName(cacheDirectory, hash);
+    if(loadCooked(fileName, hash, result))
+    {
+        std::cout << "Texture cook: " << files.size() << " layers loaded from cache in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+        return true;
+    }
+
+    result.size       = size;
+    result.numLayers  = files.size();
+    result.numLevels  = (unsigned)std::log2(size) + 1;
+    result.compressed = compress;
+    result.levels.assign(result.numLevels, std::vector<unsigned char>());
+    for(unsigned level = 0; level < result.numLevels; level++)
+        result.levels[level].resize(result.layerBytes(level) * result.numLayers);
+
+    // Each layer is cooked in its own thread
+    std::vector<char> loaded(files.size(), false);
+    std::vector<std::thread> workers;
+
+    for(unsigned layer = 0; layer < files.size(); layer++)
+        workers.push_back(std::thread([&, layer]()
+        {
+            std::vector<unsigned char> current((size_t)size * size * 3), next;
+            if(!loadLayer(files[layer], size, current.data())) return;
+
+            unsigned side = size;
+            for(unsigned level = 0; level < result.numLevels; level++)
+            {
+                unsigned char *target = &result.levels[level][result.layerBytes(level) * layer];
+                if(compress) compressLayer(current.data(), side, target);
+                else std::memcpy(target, current.data(), current.size());
+
+                if(side == 1) break;
+                next.resize((size_t)(side / 2) * (side / 2) * 3);
+                downsample(current.data(), side, next.data());
+                current.swap(next);
+                side /= 2;
+            }
+            loaded[layer] = true;
+        }));
+
+    for(std::thread &worker : workers) worker.join();
+
+    for(unsigned layer = 0; layer < files.size(); layer++)
+        if(!loaded[layer])
+        {
+            std::cout << "Texture cook: failed to load " << files[layer] << std::endl;
+            return false;
+        }
+
+    saveCooked(cacheDirectory, fileName, hash, result);
+
+    std::cout << "Texture cook: " << files.size() << " layers cooked in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+    return true;
+}
@@ -0,0 +1,174 @@
+#include <iostream>
+#include <iomanip>
+
+#ifdef IMGUI_IMPL_OPENGL_LOADER_GLEW
+#include "GL/glew.h"
+#elif IMGUI_IMPL_OPENGL_LOADER_GLAD
+#include "glad/glad.h"
+#endif
+#include "stb_image.h"
+
+#include "textureLoader.hpp"
+#include "canvas.hpp"
+#include "cpuProfiler.hpp"
+
+// textureLoader -----------------------------------------------------------------
+
+textureLoader::textureLoader(unsigned numThreads)
+    : stopWorkers(false), numRequested(0), numUploaded(0), start(std::chrono::steady_clock::now())
+{
+    stbi_set_flip_vertically_on_load(true);     // Global flag in stb_image: set it before the workers start decoding
+
+    if(numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    for(unsigned i = 0; i < numThreads; i++)
+        workers.push_back(std::thread(&textureLoader::workerLoop, this));
+}
+
+textureLoader::~textureLoader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        stopWorkers = true;
+    }
+    cond.notify_all();
+    for(std::thread &worker : workers) worker.join();
+
+    for(loadJob *job : pendingJobs) delete job;
+    for(loadJob *job : finishedJobs)
+    {
+        if(job->pixels) stbi_image_free(job->pixels);
+        delete job;
+    }
+}
+
+void textureLoader::workerLoop()
+{
+    while(true)
+    {
+        loadJob *job;
+        {
+            std::unique_lock<std::mutex> lock(mut);
+            cond.wait(lock, [this]() { return stopWorkers || !pendingJobs.empty(); });
+            if(stopWorkers) return;
+            job = pendingJobs.front();
+            pendingJobs.pop_front();
+        }
+
+        PROFILE_ZONE("Texture decode");
+        std::chrono::steady_clock::time_point jobStart = std::chrono::steady_clock::now();
+
+        if(job->isArray)
+            job->ok = cookTextureArray(job->files, job->cacheDirectory, job->size, job->compress, job->cooked);
+        else
+        {
+            job->pixels = stbi_load(job->files[0].c_str(), &job->width, &job->height, &job->numberChannels, 0);
+            job->ok     = (job->pixels != nullptr);
+        }
+
+        job->decodeTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - jobStart).count();
+
+        std::lock_guard<std::mutex> lock(mut);
+        finishedJobs.push_back(job);
+    }
+}
+
+void textureLoader::request(loadJob *job)
+{
+    job->ok         = false;
+    job->pixels     = nullptr;
+    job->decodeTime = 0;
+    ++numRequested;
+
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        pendingJobs.push_back(job);
+    }
+    cond.notify_one();
+}
+
+void textureLoader::loadTexture2D(unsigned &texture, const std::string &fileAddress, int internalFormat)
+{
+    unsigned char placeholder[4] = { 128, 128, 128, 0 };
+    texture = createTexture2D(placeholder, 1, 1, (internalFormat == GL_RGBA ? 4 : 3), internalFormat);
+
+    loadJob *job        = new loadJob;
+    job->texture        = &texture;
+    job->name           = fileAddress.substr(fileAddress.find_last_of("/\\") + 1);
+    job->isArray        = false;
+    job->files          = { fileAddress };
+    job->internalFormat = internalFormat;
+    request(job);
+}
+
+void textureLoader::loadTextureArray(unsigned &texture, const std::vector<std::string> &files, const std::string &cacheDirectory, unsigned size, bool compress)
+{
+    cookedTextures placeholder;
+    placeholder.size       = 1;
+    placeholder.numLayers  = files.size();
+    placeholder.numLevels  = 1;
+    placeholder.compressed = false;
+    placeholder.levels.assign(1, std::vector<unsigned char>(3 * files.size(), 128));
+    texture = createTextureArray(placeholder);
+
+    loadJob *job        = new loadJob;
+    job->texture        = &texture;
+    job->name           = "texture array (" + std::to_string(files.size()) + " layers)";
+    job->isArray        = true;
+    job->files          = files;
+    job->cacheDirectory = cacheDirectory;
+    job->size           = size;
+    job->compress       = compress;
+    request(job);
+}
+
+unsigned textureLoader::uploadFinished()
+{
+    std::deque<loadJob*> ready;
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        if(finishedJobs.empty()) return 0;
+        ready.swap(finishedJobs);
+    }
+
+    for(loadJob *job : ready)
+    {
+        std::chrono::steady_clock::time_point uploadStart = std::chrono::steady_clock::now();
+
+        if(job->ok)
+        {
+            unsigned texture;
+            if(job->isArray) texture = createTextureArray(job->cooked);
+            else             texture = createTexture2D(job->pixels, job->width, job->height, job->numberChannels, job->internalFormat);
+
+            glDeleteTextures(1, job->texture);          // Placeholder
+            *job->texture = texture;
+        }
+        else std::cout << "Texture loader: failed to load " << job->name << std::endl;
+
+        if(job->pixels) stbi_image_free(job->pixels);
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        timings.push_back({ job->name,
+                            job->decodeTime,
+                            std::chrono::duration<double, std::milli>(now - uploadStart).count(),
+                            std::chrono::duration<double, std::milli>(now - start).count(),
+                            job->ok });
+        delete job;
+    }
+
+    numUploaded += ready.size();
+    return ready.size();
+}
+
+bool textureLoader::isDone() { return numUploaded == numRequested; }
+
+void textureLoader::printTimings() const
+{
+    std::cout << "Texture loader:" << std::fixed << std::setprecision(2) << std::endl;
+    for(const timing &t : timings)
+        std::cout << "    " << std::left << std::setw(32) << t.name << std::right
+                  << "  decode " << std::setw(8) << t.decodeTime << " ms"
+                  << "  upload " << std::setw(8) << t.uploadTime << " ms"
+                  << "  ready at " << std::setw(8) << t.readyTime << " ms" << (t.ok ? "" : "  (failed)") << std::endl;
+    std::cout.unsetf(std::ios::fixed);
+}
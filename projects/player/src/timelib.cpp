@@ -4,6 +4,7 @@
 #include <thread>
 #include <chrono>
 #include <cmath>
+#include <algorithm>
 
 // ----- clockDate ------------------
 
@@ -11,53 +12,114 @@
 
 // ----- timerSet ---------------
 
-timerSet::timerSet(int maximumFPS)
-    : lastTime(std::chrono::system_clock::duration::zero()), maxFPS(maximumFPS)
+timerSet::timerSet(int maximumFPS, size_t windowSize)
+    : maxFPS(maximumFPS), spinMargin(std::chrono::microseconds(1500)), hitchFactor(2), frameTimes(windowSize < 1 ? 1 : windowSize, 0)
 {
     startTime();
 
     lastTimeSeconds = 0;
     deltaTime = 0;
+    workTime = 0;
     FPS = 0;
     frameCounter = 0;
+    windowPos = 0;
+    windowCount = 0;
+    statsDirty = false;
 }
 
 void timerSet::startTime()
 {
-    timeZero = std::chrono::high_resolution_clock::now();
+    timeZero = clock::now();
     lastTime = timeZero;
+    fpsStart = timeZero;
+    fpsFrames = 0;
     std::this_thread::sleep_for(std::chrono::microseconds(1000));   // Avoids deltaTime == 0 (i.e. currentTime == lastTime)
 }
 
+void timerSet::waitUntil(clock::time_point deadline)
+{
+    clock::time_point timeNow = clock::now();
+
+    if(deadline - timeNow > spinMargin)
+        std::this_thread::sleep_until(deadline - spinMargin);
+
+    while(clock::now() < deadline)
+        std::this_thread::yield();
+}
+
 void timerSet::computeDeltaTime()
 {
     // Get deltaTime (adjust by FPS if flagged)
-    std::chrono::high_resolution_clock::time_point timeNow  = std::chrono::high_resolution_clock::now();;
-    deltaTime = std::chrono::duration_cast<std::chrono::microseconds>(timeNow - lastTime).count();
+    clock::time_point timeNow = clock::now();
+    workTime = std::chrono::duration<long double>(timeNow - lastTime).count();
 
     if(maxFPS > 0)
     {
-        int waitTime = 1000000/maxFPS - deltaTime;
-        if(waitTime > 0)
+        clock::time_point deadline = lastTime + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1. / maxFPS));
+        if(timeNow < deadline)
         {
-            std::this_thread::sleep_for(std::chrono::microseconds(waitTime));
-            timeNow = std::chrono::high_resolution_clock::now();
-            deltaTime = std::chrono::duration_cast<std::chrono::microseconds>(timeNow - lastTime).count();
+            waitUntil(deadline);
+            timeNow = clock::now();
         }
     }
 
+    deltaTime = std::chrono::duration<long double>(timeNow - lastTime).count();
     lastTime = timeNow;
 
-    // Get FPS
-    FPS = std::round(1000000.f / deltaTime);
+    // Get FPS (frames counted over ~0.5 s, instead of the reciprocal of a single frame)
+    fpsFrames++;
+    long double fpsElapsed = std::chrono::duration<long double>(timeNow - fpsStart).count();
+    if(fpsElapsed >= 0.5l)
+    {
+        FPS = std::round(fpsFrames / fpsElapsed);
+        fpsFrames = 0;
+        fpsStart = timeNow;
+    }
 
     // Get currentTimeSeconds
-    lastTimeSeconds = std::chrono::duration_cast<std::chrono::microseconds>(timeNow - timeZero).count() / 1000000.l;
+    lastTimeSeconds = std::chrono::duration<long double>(timeNow - timeZero).count();
+
+    // Frame time window
+    frameTimes[windowPos] = deltaTime * 1000;
+    windowPos = (windowPos + 1) % frameTimes.size();
+    if(windowCount < frameTimes.size()) windowCount++;
+    statsDirty = true;
 
     // Increment the frame count
     ++frameCounter;
 }
 
+void timerSet::computeStats()
+{
+    stats = frameTimeStats();
+    stats.numFrames = windowCount;
+    statsDirty = false;
+    if(!windowCount) return;
+
+    std::vector<float> sorted(frameTimes.begin(), frameTimes.begin() + windowCount);
+    std::sort(sorted.begin(), sorted.end());
+
+    double sum = 0;
+    for(float time : sorted) sum += time;
+
+    // Nearest-rank percentiles
+    auto percentile = [&sorted](double p) { return sorted[std::max(0, (int)std::ceil(p * sorted.size()) - 1)]; };
+
+    stats.mean = sum / sorted.size();
+    stats.p50  = percentile(0.50);
+    stats.p95  = percentile(0.95);
+    stats.p99  = percentile(0.99);
+    stats.max  = sorted.back();
+
+    size_t numSlowest = std::max<size_t>(1, sorted.size() / 100);
+    double slowestSum = 0;
+    for(size_t i = sorted.size() - numSlowest; i < sorted.size(); i++) slowestSum += sorted[i];
+    stats.low1FPS = (slowestSum > 0 ? 1000. * numSlowest / slowestSum : 0);
+
+    double hitchTime = hitchFactor * stats.p50;
+    stats.hitches = sorted.end() - std::upper_bound(sorted.begin(), sorted.end(), hitchTime);
+}
+
 void timerSet::printTimeData()
 {
     std::cout << "Time: " << deltaTime << std::endl;
@@ -65,21 +127,51 @@ void timerSet::printTimeData()
     //std::cout << frameCounter << " | fps: " << FPS << " | " << lastTimeSeconds << std::endl;
 }
 
-long double timerSet::getDeltaTime() { return deltaTime / 1000000.l; }
+long double timerSet::getDeltaTime() { return deltaTime; }
 
-long double timerSet::getTime()
-{
-    return std::chrono::duration_cast<std::chrono::microseconds>(lastTime - timeZero).count() / 1000000.l;
-}
+long double timerSet::getWorkTime() { return workTime; }
+
+long double timerSet::getTime() { return lastTimeSeconds; }
 
 long double timerSet::getTimeNow()
 {
-    std::chrono::high_resolution_clock::time_point timeNow = std::chrono::high_resolution_clock::now();
-    return std::chrono::duration_cast<std::chrono::microseconds>(timeNow - timeZero).count() / 1000000.l;
+    return std::chrono::duration<long double>(clock::now() - timeZero).count();
 }
 
 int timerSet::getFPS() { return FPS; }
 
+int timerSet::getMaxFPS() { return maxFPS; }
+
 void timerSet::setMaxFPS(int newFPS) { maxFPS = newFPS; }
 
+void timerSet::setSpinMargin(double milliseconds)
+{
+    spinMargin = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double, std::milli>(milliseconds));
+}
+
+void timerSet::setHitchFactor(float factor) { hitchFactor = factor; statsDirty = true; }
+
 size_t timerSet::getFrameCounter() { return frameCounter; }
+
+const frameTimeStats& timerSet::getStats()
+{
+    if(statsDirty) computeStats();
+    return stats;
+}
+
+void timerSet::getFrameTimes(std::vector<float> &times) const
+{
+    times.clear();
+    size_t first = (windowPos + frameTimes.size() - windowCount) % frameTimes.size();
+    for(size_t i = 0; i < windowCount; i++)
+        times.push_back(frameTimes[(first + i) % frameTimes.size()]);
+}
+
+void timerSet::getHistogram(std::vector<float> &counts, float binWidth, float maxTime) const
+{
+    size_t numBins = std::max(1, (int)std::ceil(maxTime / binWidth));
+    counts.assign(numBins, 0);
+
+    for(size_t i = 0; i < windowCount; i++)
+        counts[std::min(numBins - 1, (size_t)(frameTimes[i] / binWidth))]++;
+}
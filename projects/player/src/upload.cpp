@@ -0,0 +1,218 @@
+#include <cstring>
+
+#include "upload.hpp"
+
+// uploadRing -----------------------------------------------------------------
+
+uploadRing::uploadRing(size_t bufferSize, unsigned numBuffers, size_t frameBudget)
+    : current(0), bufferSize(bufferSize), frameBudget(frameBudget)
+{
+    persistent = (glBufferStorage != nullptr);     // Loaded only if GL >= 4.4 (ARB_buffer_storage in core)
+
+    if(numBuffers == 0) numBuffers = 1;
+    ring.resize(numBuffers);
+
+    for(stagingBuffer &sb : ring)
+    {
+        glGenBuffers(1, &sb.buffer);
+        glBindBuffer(GL_COPY_READ_BUFFER, sb.buffer);
+
+        if(persistent)
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_COPY_READ_BUFFER, bufferSize, nullptr, flags);
+            sb.mapped = (char*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, bufferSize, flags);
+        }
+        else
+        {
+            glBufferData(GL_COPY_READ_BUFFER, bufferSize, nullptr, GL_STREAM_COPY);
+            sb.mapped = nullptr;
+        }
+
+        sb.head     = 0;
+        sb.inFlight = 0;
+        sb.fence    = nullptr;
+        sb.state    = stagingFree;
+    }
+
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+uploadRing::~uploadRing()
+{
+    for(stagingBuffer &sb : ring)
+    {
+        if(sb.mapped)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, sb.buffer);
+            glUnmapBuffer(GL_COPY_READ_BUFFER);
+        }
+        if(sb.fence) glDeleteSync(sb.fence);
+        glDeleteBuffers(1, &sb.buffer);
+    }
+
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+bool uploadRing::acquire(stagingBuffer &sb)
+{
+    if(sb.state == stagingFilling) return true;
+    if(sb.inFlight) return false;                   // Retired, but its copies have not been issued yet
+
+    if(sb.fence)
+    {
+        GLenum status = glClientWaitSync(sb.fence, 0, 0);
+        if(status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED) return false;     // GPU still reading it. Don't stall.
+        glDeleteSync(sb.fence);
+        sb.fence = nullptr;
+    }
+
+    if(!persistent)
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, sb.buffer);
+        sb.mapped = (char*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, bufferSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);   // Orphan + map
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        if(!sb.mapped) return false;
+    }
+
+    sb.head  = 0;
+    sb.state = stagingFilling;
+    return true;
+}
+
+void uploadRing::retire(stagingBuffer &sb)
+{
+    if(!persistent) unmap(sb);
+
+    sb.state = stagingRetired;
+    if(sb.inFlight == 0)
+    {
+        sb.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        sb.state = stagingFree;
+    }
+}
+
+void uploadRing::unmap(stagingBuffer &sb)
+{
+    if(!sb.mapped) return;
+
+    glBindBuffer(GL_COPY_READ_BUFFER, sb.buffer);
+    glUnmapBuffer(GL_COPY_READ_BUFFER);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    sb.mapped = nullptr;
+}
+
+bool uploadRing::allocate(size_t size, uploadTicket &ticket)
+{
+    if(size == 0 || size > bufferSize) return false;
+
+    if(!acquire(ring[current])) return false;
+
+    size_t offset = (ring[current].head + 15) & ~size_t(15);    // 16 bytes alignment
+    if(offset + size > bufferSize)
+    {
+        retire(ring[current]);
+        current = (current + 1) % ring.size();
+        if(!acquire(ring[current])) return false;
+        offset = 0;
+    }
+
+    stagingBuffer &sb = ring[current];
+    sb.head = offset + size;
+
+    ticket.staging = current;
+    ticket.offset  = offset;
+    ticket.size    = size;
+    ticket.data    = sb.mapped + offset;
+    return true;
+}
+
+void uploadRing::submit(const uploadTicket &ticket, size_t srcOffset, size_t size, unsigned dstBuffer, size_t dstOffset)
+{
+    pending.push_back( { ticket.staging, ticket.offset + srcOffset, dstBuffer, dstOffset, size } );
+    ++ring[ticket.staging].inFlight;
+}
+
+bool uploadRing::upload(unsigned dstBuffer, const void* data, size_t size, size_t dstOffset)
+{
+    uploadTicket ticket;
+    if(!allocate(size, ticket)) return false;
+
+    std::memcpy(ticket.data, data, size);
+    submit(ticket, 0, size, dstBuffer, dstOffset);
+    return true;
+}
+
+void uploadRing::flush()
+{
+    // Without persistent mapping, a buffer must be unmapped before copying from it
+    if(!persistent && ring[current].state == stagingFilling && ring[current].inFlight)
+    {
+        retire(ring[current]);
+        current = (current + 1) % ring.size();
+    }
+
+    size_t bytes = 0;
+    while(!pending.empty())
+    {
+        const pendingCopy &copy = pending.front();
+        if(bytes && bytes + copy.size > frameBudget) break;
+
+        stagingBuffer &sb = ring[copy.staging];
+
+        glBindBuffer(GL_COPY_READ_BUFFER, sb.buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, copy.dstBuffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, copy.srcOffset, copy.dstOffset, copy.size);
+
+        bytes += copy.size;
+        pending.pop_front();
+
+        if(--sb.inFlight == 0 && sb.state == stagingRetired)
+            retire(sb);
+    }
+
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void uploadRing::discard(unsigned dstBuffer)
+{
+    for(std::deque<pendingCopy>::iterator it = pending.begin(); it != pending.end(); )
+    {
+        if(it->dstBuffer != dstBuffer) { ++it; continue; }
+
+        stagingBuffer &sb = ring[it->staging];
+        it = pending.erase(it);
+
+        if(--sb.inFlight == 0 && sb.state == stagingRetired)
+            retire(sb);
+    }
+}
+
+bool uploadRing::isPending(unsigned dstBuffer) const
+{
+    for(const pendingCopy &copy : pending)
+        if(copy.dstBuffer == dstBuffer) return true;
+
+    return false;
+}
+
+bool uploadRing::isPending(unsigned dstBuffer, size_t dstOffset, size_t size) const
+{
+    for(const pendingCopy &copy : pending)
+        if(copy.dstBuffer == dstBuffer && copy.dstOffset < dstOffset + size && dstOffset < copy.dstOffset + copy.size)
+            return true;
+
+    return false;
+}
+
+size_t uploadRing::pendingBytes() const
+{
+    size_t bytes = 0;
+    for(const pendingCopy &copy : pending) bytes += copy.size;
+    return bytes;
+}
+
+size_t uploadRing::pendingCopies() const { return pending.size(); }
+
+bool uploadRing::isPersistent() const { return persistent; }
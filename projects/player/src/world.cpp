@@ -1,5 +1,12 @@
 
+#include <chrono>
+#include <algorithm>
+#include <climits>
+
 #include "world.hpp"
+#include "cpuProfiler.hpp"
+
+#define PLACEHOLDER_VERTEX_PER_SIDE 5     // Resolution of the chunks shown until the full resolution chunk is generated
 
 // BinaryKey --------------------------------------------
 
@@ -28,7 +35,19 @@ int terrainChunks::getNumVertex()   { return vertexPerSide * vertexPerSide; }
 int terrainChunks::getNumIndices()  { return (vertexPerSide-1) * (vertexPerSide-1) * 2 * 3; }
 int terrainChunks::getMaxViewDist() { return maxViewDist; }
 
-terrainChunks::terrainChunks(noiseSet noise, float maxViewDist, float chunkSize, unsigned vertexPerSide)
+float terrainChunks::getGenerationRadius() const { return fogRadius > 0 ? std::min(maxViewDist, fogRadius) : maxViewDist; }
+
+float terrainChunks::getSquareDistance(const BinaryKey &key, glm::vec2 point) const
+{
+    glm::vec2 chunkMin(key.x * chunkSize, key.y * chunkSize);
+    glm::vec2 nearest = glm::clamp(point, chunkMin, chunkMin + chunkSize);
+    glm::vec2 offset  = nearest - point;
+
+    return glm::dot(offset, offset);
+}
+
+terrainChunks::terrainChunks(noiseSet noise, float maxViewDist, float chunkSize, unsigned vertexPerSide, float frameBudget)
+    : fogRadius(0), frameBudget(frameBudget), verticalScale(1), cacheOctaves(false), chunksGenerated(0), chunksLoaded(0)
 {
     updateTerrainParameters(noise, maxViewDist, chunkSize, vertexPerSide);
 }
@@ -37,11 +56,17 @@ terrainChunks::~terrainChunks() { }
 
 void terrainChunks::updateVisibleChunks(glm::vec3 viewerPos)
 {
+    PROFILE_ZONE("updateVisibleChunks");
     // Viewer coordinates in chunk coordinates (origin at chunk (0, 0))
     int viewerChunkCoord_X = std::round(viewerPos.x / chunkSize);
     int viewerChunkCoord_Y = std::round(viewerPos.y / chunkSize);
     int viewerChunkCoord_Z = std::round(viewerPos.z / chunkSize);
 
+    // Range: chunks whose nearest point is within the generation radius (the fog hides everything beyond it)
+    glm::vec2 viewer(viewerPos.x, viewerPos.y);
+    float radius     = getGenerationRadius();
+    float keepRadius = radius + chunkSize / 2;      // Chunks slightly out of range are kept, so moving back and forth doesn't generate them again
+
     // Delete chunks out of range    
     typedef std::map<BinaryKey, terrainGenerator> dictionary;
 
@@ -52,10 +77,7 @@ void terrainChunks::updateVisibleChunks(glm::vec3 viewerPos)
         BinaryKey key = it->first;
 
         // Circular area
-        float sqrtDistInChunks = (key.x-viewerChunkCoord_X)*(key.x-viewerChunkCoord_X) + (key.y-viewerChunkCoord_Y)*(key.y-viewerChunkCoord_Y);
-        float maxSqrtDistInChunks = (chunksVisible + 0.5) * (chunksVisible + 0.5);
-
-        if(sqrtDistInChunks > maxSqrtDistInChunks)
+        if(getSquareDistance(key, viewer) > keepRadius * keepRadius)
             toErase.push_back(it);
 
         // Square area
@@ -65,49 +87,345 @@ void terrainChunks::updateVisibleChunks(glm::vec3 viewerPos)
     }
 
     for(size_t i = 0; i < toErase.size(); ++i)
+    {
+        placeholders.erase(toErase[i]->first);
         chunkDict.erase(toErase[i]);
+    }
 
     // Save chunks in range
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
     terrainGenerator generator;
+    pendingChunks.clear();
+
+    int minX = std::floor((viewer.x - radius) / chunkSize), maxX = std::floor((viewer.x + radius) / chunkSize);
+    int minY = std::floor((viewer.y - radius) / chunkSize), maxY = std::floor((viewer.y + radius) / chunkSize);
 
-    for(int yOffset = viewerChunkCoord_Y - chunksVisible; yOffset <= viewerChunkCoord_Y + chunksVisible; yOffset++)
-        for(int xOffset = viewerChunkCoord_X - chunksVisible; xOffset <= viewerChunkCoord_X + chunksVisible; xOffset++)
+    for(int yOffset = minY; yOffset <= maxY; yOffset++)
+        for(int xOffset = minX; xOffset <= maxX; xOffset++)
         {
-            float sqrtDistInChunks = (xOffset-viewerChunkCoord_X)*(xOffset-viewerChunkCoord_X) + (yOffset-viewerChunkCoord_Y)*(yOffset-viewerChunkCoord_Y);
-            float maxSqrtDistInChunks = (chunksVisible + 0.5) * (chunksVisible + 0.5);
-            if(sqrtDistInChunks > maxSqrtDistInChunks)
+            BinaryKey chunkCoord(xOffset, yOffset);             // chunk name (key)
+            if(getSquareDistance(chunkCoord, viewer) > radius * radius)
                 continue;                                       // if out of range, skip iteration
 
-            BinaryKey chunkCoord(xOffset, yOffset);             // chunk name (key)
+            std::map<BinaryKey, terrainGenerator>::iterator it = chunkDict.find(chunkCoord);
 
-            if(chunkDict.find(chunkCoord) == chunkDict.end())   // if(chunk doesn't exist in chunkDict) add new chunk
+            if(it == chunkDict.end())                           // if(chunk doesn't exist in chunkDict) add new chunk
             {
-                generator.computeTerrain( noise,
-                                          xOffset * chunkSize,
-                                          yOffset * chunkSize,
-                                          chunkSize/(vertexPerSide-1),
-                                          vertexPerSide,
-                                          vertexPerSide  );
+                if(loadChunk(chunkCoord, generator))            // Stored chunks are used directly
+                    placeholders.erase(chunkCoord);
+                else if(frameBudget > 0)                        // Placeholder now, full chunk later
+                {
+                    generator.computeTerrain( noise,
+                                              xOffset * chunkSize,
+                                              yOffset * chunkSize,
+                                              chunkSize/(PLACEHOLDER_VERTEX_PER_SIDE-1),
+                                              PLACEHOLDER_VERTEX_PER_SIDE,
+                                              PLACEHOLDER_VERTEX_PER_SIDE,
+                                              1.f,
+                                              cacheOctaves );
+                    generator.computeSplat(getBiome(noise), verticalScale);
+
+                    pendingChunks.push_back(chunkCoord);
+                    placeholders.insert(chunkCoord);
+                }
+                else
+                {
+                    generateChunk(chunkCoord, generator);
+                    placeholders.erase(chunkCoord);
+                }
 
                 //chunkDict.insert( {chunkCoord, generator} );  // Doesn't require default constructor. If element already exists, insert does nothing
                 chunkDict[chunkCoord] = generator;              // Requires default constructor
             }
+            else if(placeholders.count(chunkCoord))
+                pendingChunks.push_back(chunkCoord);
         }
 
+    // Generate pending chunks (nearest first) until the frame budget is used up
+    std::sort(pendingChunks.begin(), pendingChunks.end(), [viewerChunkCoord_X, viewerChunkCoord_Y](const BinaryKey &a, const BinaryKey &b)
+    {
+        return (a.x-viewerChunkCoord_X)*(a.x-viewerChunkCoord_X) + (a.y-viewerChunkCoord_Y)*(a.y-viewerChunkCoord_Y) <
+               (b.x-viewerChunkCoord_X)*(b.x-viewerChunkCoord_X) + (b.y-viewerChunkCoord_Y)*(b.y-viewerChunkCoord_Y);
+    });
+
+    size_t numGenerated = 0;
+    while(numGenerated < pendingChunks.size())
+    {
+        if(numGenerated && budgetUsed(startTime)) break;        // At least one chunk per frame
+
+        BinaryKey chunkCoord = pendingChunks[numGenerated++];
+
+        if(!loadChunk(chunkCoord, generator))
+            generateChunk(chunkCoord, generator);
+
+        chunkDict[chunkCoord] = generator;
+        placeholders.erase(chunkCoord);
+        refreshedChunks.push_back(chunkCoord);
+    }
+
+    pendingChunks.erase(pendingChunks.begin(), pendingChunks.begin() + numGenerated);
+}
+
+bool terrainChunks::loadChunk(const BinaryKey &key, terrainGenerator &generator)
+{
+    const float *data = store.find(key);
+    if(!data) return false;
+
+    generator.setTerrain(data, vertexPerSide, vertexPerSide);
+    generator.computeSplat(getBiome(noise), verticalScale);
+    chunksLoaded++;
+    return true;
+}
+
+void terrainChunks::generateChunk(const BinaryKey &key, terrainGenerator &generator)
+{
+    generator.computeTerrain( noise,
+                              key.x * chunkSize,
+                              key.y * chunkSize,
+                              chunkSize/(vertexPerSide-1),
+                              vertexPerSide,
+                              vertexPerSide,
+                              1.f,
+                              cacheOctaves  );
+    generator.computeSplat(getBiome(noise), verticalScale);
+    chunksGenerated++;
+
+    store.save(key, generator.vertex);
+}
+
+bool terrainChunks::budgetUsed(std::chrono::steady_clock::time_point startTime) const
+{
+    if(frameBudget <= 0) return false;
+
+    std::chrono::duration<float, std::milli> elapsed = std::chrono::steady_clock::now() - startTime;
+    return elapsed.count() >= frameBudget;
 }
 
 void terrainChunks::updateTerrainParameters(noiseSet noise, float maxViewDist, float chunkSize, unsigned vertexPerSide)
 {
     chunkDict.clear();
+    pendingChunks.clear();
+    placeholders.clear();
+    refreshedChunks.clear();
 
     this->noise         = noise;
     this->maxViewDist   = maxViewDist;
     this->chunkSize     = chunkSize;
     this->chunksVisible = std::round(maxViewDist/chunkSize);
     this->vertexPerSide = vertexPerSide;
+
+    reopenStore();
 }
 
 void terrainChunks::setNoise(noiseSet newNoise)
 {
-    this->noise = newNoise;
+    this->noise   = newNoise;
+    verticalScale = 1;
+
+    reopenStore();
+}
+
+bool terrainChunks::reshapeNoise(noiseSet newNoise)
+{
+    bool sameRaw = noise.sameRawNoise(newNoise);
+    if(!sameRaw && !(cacheOctaves && noise.sameOctaves(newNoise))) return false;
+
+    // Pure vertical scaling: done in the model matrix (only the splat weights, which depend on slopes and heights, are recomputed)
+    if(sameRaw && newNoise.getCurveDegree() == noise.getCurveDegree() && noise.getMultiplier() > 0)
+    {
+        verticalScale = newNoise.getMultiplier() / noise.getMultiplier();
+
+        for(std::map<BinaryKey, terrainGenerator>::iterator it = chunkDict.begin(); it != chunkDict.end(); ++it)
+        {
+            it->second.computeSplat(getBiome(noise), verticalScale);
+            refreshedChunks.push_back(it->first);
+        }
+        return true;
+    }
+
+    // Recompute heights from the raw noise (curve degree) or from the octaves (number of octaves, persistance)
+    std::vector<BinaryKey> toErase;
+
+    for(std::map<BinaryKey, terrainGenerator>::iterator it = chunkDict.begin(); it != chunkDict.end(); ++it)
+    {
+        if(!it->second.reshape(noise, newNoise))
+            toErase.push_back(it->first);       // No octave cache (loaded from the store, or created before enabling cacheOctaves)
+
+        refreshedChunks.push_back(it->first);
+    }
+
+    for(size_t i = 0; i < toErase.size(); i++)
+    {
+        chunkDict.erase(toErase[i]);
+        placeholders.erase(toErase[i]);
+    }
+
+    setNoise(newNoise);
+
+    for(std::map<BinaryKey, terrainGenerator>::iterator it = chunkDict.begin(); it != chunkDict.end(); ++it)
+    {
+        it->second.computeSplat(getBiome(noise), verticalScale);
+        if(!placeholders.count(it->first))
+            store.save(it->first, it->second.vertex);
+    }
+
+    return true;
+}
+
+size_t terrainChunks::getOctaveCacheBytes() const
+{
+    size_t bytes = 0;
+    for(std::map<BinaryKey, terrainGenerator>::const_iterator it = chunkDict.begin(); it != chunkDict.end(); ++it)
+        bytes += it->second.getOctaveBytes();
+
+    return bytes;
+}
+
+BinaryKey terrainChunks::getChunkKey(float x, float y) const
+{
+    return BinaryKey(std::floor(x / chunkSize), std::floor(y / chunkSize));    // Chunk (x, y) covers [x * chunkSize, (x + 1) * chunkSize]
+}
+
+void terrainChunks::queryHeights(const glm::vec2* pts, size_t n, float* out)
+{
+    if(n == 0) return;
+
+    // Chunk of each query, and bounding box (in chunks) of all the queries
+    std::vector<BinaryKey> keys;
+    keys.reserve(n);
+
+    int minX = INT_MAX, minY = INT_MAX, maxX = INT_MIN, maxY = INT_MIN;
+    for(size_t i = 0; i < n; i++)
+    {
+        keys.push_back(getChunkKey(pts[i].x, pts[i].y));
+        minX = std::min(minX, keys[i].x);
+        minY = std::min(minY, keys[i].y);
+        maxX = std::max(maxX, keys[i].x);
+        maxY = std::max(maxY, keys[i].y);
+    }
+
+    // Sort queries by chunk: counting sort over the bounding box if it is small, comparison sort otherwise
+    std::vector<size_t> order(n);
+    uint64_t width = (uint64_t)maxX - minX + 1;
+    uint64_t cells = width * ((uint64_t)maxY - minY + 1);
+
+    if(cells <= 2 * n + 1024)
+    {
+        std::vector<size_t> start(cells + 1, 0);
+        for(size_t i = 0; i < n; i++) ++start[(keys[i].y - minY) * width + (keys[i].x - minX) + 1];
+        for(size_t c = 1; c <= cells; c++) start[c] += start[c - 1];
+        for(size_t i = 0; i < n; i++) order[start[(keys[i].y - minY) * width + (keys[i].x - minX)]++] = i;
+    }
+    else
+    {
+        for(size_t i = 0; i < n; i++) order[i] = i;
+        std::sort(order.begin(), order.end(), [&keys](size_t a, size_t b) { return keys[a] < keys[b]; });
+    }
+
+    // Interpolate in resident chunks (one look up per chunk). Use noise elsewhere.
+    std::map<BinaryKey, terrainGenerator>::const_iterator chunk = chunkDict.end();
+
+    for(size_t i = 0; i < n; i++)
+    {
+        size_t query = order[i];
+        const glm::vec2 &p = pts[query];
+
+        if(i == 0 || !(keys[query] == keys[order[i - 1]]))
+            chunk = chunkDict.find(keys[query]);
+
+        if(chunk != chunkDict.end())
+            out[query] = chunk->second.getHeight(p.x, p.y) * verticalScale;
+        else
+            out[query] = noise.GetNoise(p.x, p.y) * verticalScale;
+    }
+}
+
+bool terrainChunks::raycast(glm::vec3 origin, glm::vec3 direction, float maxDist, float &distance) const
+{
+    if(chunkDict.empty()) return false;
+
+    BinaryKey minKey(0, 0), maxKey(0, 0);
+    getKeyRange(minKey, maxKey);
+    return raycast(origin, direction, maxDist, distance, minKey, maxKey);
+}
+
+void terrainChunks::raycastMany(const glm::vec3* origins, const glm::vec3* directions, size_t n, float maxDist, float* distances) const
+{
+    BinaryKey minKey(0, 0), maxKey(0, 0);
+    getKeyRange(minKey, maxKey);                // Computed once for all the rays
+
+    for(size_t i = 0; i < n; i++)
+        if(chunkDict.empty() || !raycast(origins[i], directions[i], maxDist, distances[i], minKey, maxKey))
+            distances[i] = -1;
+}
+
+void terrainChunks::getKeyRange(BinaryKey &minKey, BinaryKey &maxKey) const
+{
+    minKey.set(INT_MAX, INT_MAX);
+    maxKey.set(INT_MIN, INT_MIN);
+
+    for(std::map<BinaryKey, terrainGenerator>::const_iterator it = chunkDict.begin(); it != chunkDict.end(); ++it)
+    {
+        minKey.set(std::min(minKey.x, it->first.x), std::min(minKey.y, it->first.y));
+        maxKey.set(std::max(maxKey.x, it->first.x), std::max(maxKey.y, it->first.y));
+    }
+}
+
+bool terrainChunks::raycast(glm::vec3 origin, glm::vec3 direction, float maxDist, float &distance, const BinaryKey &minKey, const BinaryKey &maxKey) const
+{
+    if(glm::length(direction) == 0) return false;
+    direction = glm::normalize(direction);
+
+    // Chunks store unscaled heights: scale the ray instead (t is preserved)
+    glm::vec3 chunkOrigin   (origin.x,    origin.y,    origin.z    / verticalScale);
+    glm::vec3 chunkDirection(direction.x, direction.y, direction.z / verticalScale);
+
+    // DDA over the chunk grid (XY)
+    int x = std::floor(origin.x / chunkSize);
+    int y = std::floor(origin.y / chunkSize);
+    int stepX = (direction.x > 0) ? 1 : (direction.x < 0 ? -1 : 0);
+    int stepY = (direction.y > 0) ? 1 : (direction.y < 0 ? -1 : 0);
+
+    float tMaxX   = stepX ? ((x + (stepX > 0)) * chunkSize - origin.x) / direction.x : INFINITY;     // Distance to the next chunk border
+    float tMaxY   = stepY ? ((y + (stepY > 0)) * chunkSize - origin.y) / direction.y : INFINITY;
+    float tDeltaX = stepX ? chunkSize / std::fabs(direction.x) : INFINITY;                          // Distance between chunk borders
+    float tDeltaY = stepY ? chunkSize / std::fabs(direction.y) : INFINITY;
+
+    float t = 0;
+    const float epsilon = 1e-4f * chunkSize;    // Overlap between consecutive chunk segments (hits on the border)
+
+    while(t <= maxDist)
+    {
+        float tNext = std::min(tMaxX, tMaxY);
+
+        std::map<BinaryKey, terrainGenerator>::const_iterator chunk = chunkDict.find(BinaryKey(x, y));
+        if(chunk != chunkDict.end() && chunk->second.raycast(chunkOrigin, chunkDirection, std::max(0.f, t - epsilon), std::min(tNext + epsilon, maxDist), distance))
+            return true;
+
+        if(tNext > maxDist) break;
+
+        if(tMaxX < tMaxY) { x += stepX; t = tMaxX; tMaxX += tDeltaX; }
+        else              { y += stepY; t = tMaxY; tMaxY += tDeltaY; }
+
+        // Leaving the area of loaded chunks
+        if((stepX < 0 && x < minKey.x) || (stepX > 0 && x > maxKey.x) ||
+           (stepY < 0 && y < minKey.y) || (stepY > 0 && y > maxKey.y))
+            break;
+    }
+
+    return false;
+}
+
+void terrainChunks::openStore(const std::string &directory)
+{
+    storeDirectory = directory;
+    reopenStore();
+}
+
+void terrainChunks::reopenStore()
+{
+    if(storeDirectory.empty()) return;
+
+    if(!store.open(storeDirectory, noise.getFingerprint(), chunkSize, vertexPerSide))
+        std::cout << "Chunk store disabled" << std::endl;
 }